@@ -0,0 +1,205 @@
+//
+//  Benchmark.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "Benchmark.h"
+#include <algorithm>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/time.h"
+}
+
+#define BENCHMARK_MAX_ITERATIONS 1000000000
+
+namespace bench {
+
+struct Benchmark {
+    std::string name;
+    Function fn;
+    int arg;
+};
+
+/* function statics, registration runs from static initializers of other files */
+static std::vector<Benchmark>& Benchmarks()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+static std::vector<std::pair<std::string, std::string>>& Context()
+{
+    static std::vector<std::pair<std::string, std::string>> context;
+    return context;
+}
+
+static int64_t CpuTime()
+{
+    return (int64_t)((double)clock() * 1000000 / CLOCKS_PER_SEC);
+}
+
+State::State(int64_t iterations, int arg):
+mIterations(iterations),
+mArg(arg),
+mRunning(false),
+mRealStart(0),
+mCpuStart(0),
+mRealTime(0.0),
+mCpuTime(0.0),
+mItems(0),
+mBytes(0)
+{
+}
+
+void State::pauseTiming()
+{
+    if (!mRunning)
+        return;
+    mRealTime += (av_gettime_relative() - mRealStart) / 1000000.0;
+    mCpuTime += (CpuTime() - mCpuStart) / 1000000.0;
+    mRunning = false;
+}
+
+void State::resumeTiming()
+{
+    if (mRunning)
+        return;
+    mRealStart = av_gettime_relative();
+    mCpuStart = CpuTime();
+    mRunning = true;
+}
+
+int Register(const char *name, Function fn)
+{
+    Benchmark b = { name, fn, 0 };
+    Benchmarks().push_back(b);
+    return 0;
+}
+
+int Register(const char *name, Function fn, int arg, const char *label)
+{
+    Benchmark b = { std::string(name) + "/" + label, fn, arg };
+    Benchmarks().push_back(b);
+    return 0;
+}
+
+void Use(double value)
+{
+    static volatile double sink;
+    sink = value;
+    (void)sink;
+}
+
+void SetContext(const char *key, const std::string& value)
+{
+    Context().push_back(std::make_pair(std::string(key), value));
+}
+
+double Percentile(std::vector<int64_t>& values, double p)
+{
+    size_t i;
+    if (values.empty())
+        return 0.0;
+    i = FFMIN((size_t)(p * (values.size() - 1) + 0.5), values.size() - 1);
+    std::nth_element(values.begin(), values.begin() + i, values.end());
+    return (double)values[i];
+}
+
+static void WriteString(FILE *out, const std::string& s)
+{
+    size_t i;
+    fputc('"', out);
+    for (i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* grows the iterations until a run takes min_time, as Google Benchmark does */
+static State Run(const Benchmark& b, double min_time)
+{
+    int64_t iterations = 1;
+    double multiplier;
+    
+    for (;;) {
+        State state(iterations, b.arg);
+        state.resumeTiming();
+        b.fn(state);
+        state.pauseTiming();
+        if (!state.getSkipped().empty() || state.getRealTime() >= min_time || iterations >= BENCHMARK_MAX_ITERATIONS)
+            return state;
+        /* a run too short to predict from only grows tenfold */
+        multiplier = state.getRealTime() / min_time > 0.1 ? min_time * 1.4 / state.getRealTime() : 10.0;
+        iterations = FFMIN(FFMAX((int64_t)(iterations * multiplier), iterations + 1), (int64_t)BENCHMARK_MAX_ITERATIONS);
+    }
+}
+
+int RunAll(const char *filter, double min_time, FILE *out)
+{
+    char date[64];
+    time_t now = time(NULL);
+    size_t i, j;
+    int first = 1, ran = 0;
+    
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(out, "{\n  \"context\": {\n    \"date\": \"%s\"", date);
+    for (i = 0; i < Context().size(); i++) {
+        fprintf(out, ",\n    ");
+        WriteString(out, Context()[i].first);
+        fprintf(out, ": ");
+        WriteString(out, Context()[i].second);
+    }
+    fprintf(out, "\n  },\n  \"benchmarks\": [");
+    
+    fprintf(stderr, "%-48s %14s %14s %12s\n", "benchmark", "time/iter", "cpu/iter", "iterations");
+    for (i = 0; i < Benchmarks().size(); i++) {
+        const Benchmark& b = Benchmarks()[i];
+        if (filter && !strstr(b.name.c_str(), filter))
+            continue;
+        
+        State state = Run(b, min_time);
+        fprintf(out, "%s\n    {\n      \"name\": ", first ? "" : ",");
+        WriteString(out, b.name);
+        first = 0;
+        ran++;
+        if (!state.getSkipped().empty()) {
+            fprintf(out, ",\n      \"skipped\": ");
+            WriteString(out, state.getSkipped());
+            fprintf(out, "\n    }");
+            fprintf(stderr, "%-48s skipped: %s\n", b.name.c_str(), state.getSkipped().c_str());
+            continue;
+        }
+        
+        fprintf(out, ",\n      \"iterations\": %" PRId64 ",\n      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\"",
+                state.iterations(), state.getRealTime() * 1e9 / state.iterations(), state.getCpuTime() * 1e9 / state.iterations());
+        if (state.getItems() && state.getRealTime() > 0)
+            fprintf(out, ",\n      \"items_per_second\": %.3f", state.getItems() / state.getRealTime());
+        if (state.getBytes() && state.getRealTime() > 0)
+            fprintf(out, ",\n      \"bytes_per_second\": %.3f", state.getBytes() / state.getRealTime());
+        for (j = 0; j < state.getCounters().size(); j++) {
+            fprintf(out, ",\n      ");
+            WriteString(out, state.getCounters()[j].first);
+            fprintf(out, ": %.3f", state.getCounters()[j].second);
+        }
+        fprintf(out, "\n    }");
+        fprintf(stderr, "%-48s %11.1f ns %11.1f ns %12" PRId64 "\n", b.name.c_str(),
+                state.getRealTime() * 1e9 / state.iterations(), state.getCpuTime() * 1e9 / state.iterations(), state.iterations());
+    }
+    fprintf(out, "\n  ]\n}\n");
+    fflush(out);
+    return ran;
+}
+
+}//end namespace bench
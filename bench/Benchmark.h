@@ -0,0 +1,84 @@
+//
+//  Benchmark.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace bench {
+
+/* what a benchmark function gets: it runs its body iterations() times, can
+ * keep setup and teardown out of the timing with resumeTiming/pauseTiming,
+ * and reports throughput and counters of its own */
+class State {
+public:
+    
+    State(int64_t iterations, int arg);
+    
+    inline int64_t iterations()const{return mIterations;}
+    inline int arg()const{return mArg;}
+    
+    void pauseTiming();
+    void resumeTiming();
+    inline void setItemsProcessed(int64_t items){mItems = items;}
+    inline void setBytesProcessed(int64_t bytes){mBytes = bytes;}
+    inline void setCounter(const char *name, double value){mCounters.push_back(std::make_pair(std::string(name), value));}
+    /* the benchmark can not run here, it is reported with the reason instead */
+    inline void skip(const std::string& reason){mSkipped = reason;}
+    
+    /* seconds of wall and cpu time spent while timing */
+    inline double getRealTime()const{return mRealTime;}
+    inline double getCpuTime()const{return mCpuTime;}
+    inline int64_t getItems()const{return mItems;}
+    inline int64_t getBytes()const{return mBytes;}
+    inline const std::vector<std::pair<std::string, double>>& getCounters()const{return mCounters;}
+    inline const std::string& getSkipped()const{return mSkipped;}
+
+private:
+    
+    int64_t mIterations;
+    int mArg;
+    bool mRunning;
+    int64_t mRealStart;
+    int64_t mCpuStart;
+    double mRealTime;
+    double mCpuTime;
+    int64_t mItems;
+    int64_t mBytes;
+    std::vector<std::pair<std::string, double>> mCounters;
+    std::string mSkipped;
+};
+
+typedef void (*Function)(State& state);
+
+/* name is reported as is, or as name/label for each argument */
+int Register(const char *name, Function fn);
+int Register(const char *name, Function fn, int arg, const char *label);
+
+/* keeps the compiler from optimizing a result away */
+void Use(double value);
+
+/* reported with the results, as the machine and libraries they ran on */
+void SetContext(const char *key, const std::string& value);
+
+/* runs the registered benchmarks whose name contains filter, each until it
+ * took min_time seconds, and writes the results as JSON to out */
+int RunAll(const char *filter, double min_time, FILE *out);
+
+/* percentile p (0..1) of values, which it sorts */
+double Percentile(std::vector<int64_t>& values, double p);
+
+}//end namespace bench
+
+#define BENCHMARK_CONCAT_(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+#define BENCHMARK(fn) static int BENCHMARK_CONCAT(fn##_registered_, __LINE__) = bench::Register(#fn, fn)
+#define BENCHMARK_ARG(fn, arg, label) static int BENCHMARK_CONCAT(fn##_registered_, __LINE__) = bench::Register(#fn, fn, arg, label)
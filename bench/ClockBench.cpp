@@ -0,0 +1,95 @@
+//
+//  ClockBench.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "Benchmark.h"
+#include "Clock.h"
+#include "VideoState.h"
+#include <limits.h>
+#include <math.h>
+
+extern "C" {
+#include "libavutil/lfg.h"
+}
+
+using namespace ffmpeg;
+
+#define SYNC_DIFFS 4096
+
+/* a master clock the slave drifts around, within and beyond the sync thresholds */
+static void MakeDiffs(double *diffs, double range)
+{
+    AVLFG lfg;
+    int i;
+    av_lfg_init(&lfg, 0x5eed);
+    for (i = 0; i < SYNC_DIFFS; i++)
+        diffs[i] = ((double)av_lfg_get(&lfg) / UINT_MAX * 2.0 - 1.0) * range;
+}
+
+/* arg is the speed, in percent; anything but 100 takes the speed correction */
+static void ClockGet(bench::State& state)
+{
+    Clock clock;
+    int serial = 0;
+    double sum = 0;
+    int64_t i;
+    
+    clock.init(&serial);
+    clock.set(0.0, serial);
+    clock.setSpeed(state.arg() / 100.0);
+    for (i = 0; i < state.iterations(); i++)
+        sum += clock.get();
+    bench::Use(sum);
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK_ARG(ClockGet, 100, "speed100");
+BENCHMARK_ARG(ClockGet, 99, "speed99");
+
+static void ClockSet(bench::State& state)
+{
+    Clock clock;
+    int serial = 0;
+    int64_t i;
+    
+    clock.init(&serial);
+    for (i = 0; i < state.iterations(); i++)
+        clock.set((double)i / 1000.0, serial);
+    bench::Use(clock.getPts());
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(ClockSet);
+
+/* the delay computeTargetDelay picks for the next picture of a 25 fps stream */
+static void ComputeTargetDelay(bench::State& state)
+{
+    double diffs[SYNC_DIFFS];
+    double sum = 0;
+    int64_t i;
+    
+    MakeDiffs(diffs, 0.2);
+    for (i = 0; i < state.iterations(); i++)
+        sum += VideoState::ComputeTargetDelay(0.04, diffs[i & (SYNC_DIFFS - 1)], 10.0);
+    bench::Use(sum);
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(ComputeTargetDelay);
+
+/* the samples synchronizeAudio asks for per 1024 sample frame at 48 kHz, with
+ * its running average of the A-V difference */
+static void SynchronizeAudio(bench::State& state)
+{
+    double diffs[SYNC_DIFFS];
+    double diff_cum = 0, avg_coef = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
+    int avg_count = 0;
+    int64_t sum = 0, i;
+    
+    MakeDiffs(diffs, 0.1);
+    for (i = 0; i < state.iterations(); i++)
+        sum += VideoState::SynchronizeAudio(1024, diffs[i & (SYNC_DIFFS - 1)], 48000, 0.02, &diff_cum, &avg_coef, &avg_count);
+    bench::Use((double)sum);
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(SynchronizeAudio);
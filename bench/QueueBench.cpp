@@ -0,0 +1,221 @@
+//
+//  QueueBench.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "Benchmark.h"
+#include "PacketQueue.h"
+#include "FrameQueue.h"
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C" {
+#include "libavutil/time.h"
+}
+
+using namespace ffmpeg;
+
+/* the packets carry no data, pts is the time they were put for the latency */
+static void MakePacket(AVPacket *pkt)
+{
+    av_init_packet(pkt);
+    pkt->data = NULL;
+    pkt->size = 0;
+    pkt->pts = av_gettime_relative();
+}
+
+/* put then get on one thread, the cost of the queue without contention */
+static void PacketQueuePutGet(bench::State& state)
+{
+    PacketQueue q;
+    AVPacket pkt;
+    int64_t i;
+    
+    state.pauseTiming();
+    if (q.init((PacketQueue::Mode)state.arg()) < 0) {
+        state.skip("could not init the packet queue");
+        return;
+    }
+    q.start();
+    q.get(&pkt, true);
+    state.resumeTiming();
+    
+    for (i = 0; i < state.iterations(); i++) {
+        MakePacket(&pkt);
+        q.put(&pkt);
+        q.get(&pkt, true);
+        av_packet_unref(&pkt);
+    }
+    
+    state.pauseTiming();
+    q.abort();
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK_ARG(PacketQueuePutGet, PacketQueue::MODE_LOCKED, "locked");
+BENCHMARK_ARG(PacketQueuePutGet, PacketQueue::MODE_SPSC, "spsc");
+
+struct PacketProducer {
+    PacketQueue *queue;
+    int64_t count;
+};
+
+static int PacketProducerThread(void *arg)
+{
+    PacketProducer *p = (PacketProducer*)arg;
+    AVPacket pkt;
+    int64_t i;
+    
+    for (i = 0; i < p->count; i++) {
+        MakePacket(&pkt);
+        if (p->queue->put(&pkt) < 0)
+            break;
+    }
+    return 0;
+}
+
+/* a producer thread puts, as the read thread does, and this one gets, as a
+ * decoder does; reports the time packets spent in the queue */
+static void PacketQueueThreaded(bench::State& state)
+{
+    PacketQueue q;
+    PacketProducer producer;
+    SDL_Thread *thread;
+    std::vector<int64_t> latencies;
+    AVPacket pkt;
+    int64_t i;
+    
+    state.pauseTiming();
+    if (q.init((PacketQueue::Mode)state.arg()) < 0) {
+        state.skip("could not init the packet queue");
+        return;
+    }
+    q.start();
+    q.get(&pkt, true);
+    latencies.reserve(state.iterations());
+    producer.queue = &q;
+    producer.count = state.iterations();
+    state.resumeTiming();
+    
+    if (!(thread = SDL_CreateThread(PacketProducerThread, "PacketProducer", &producer))) {
+        state.skip(std::string("SDL_CreateThread(): ") + SDL_GetError());
+        return;
+    }
+    for (i = 0; i < state.iterations(); i++) {
+        if (q.get(&pkt, true) < 0)
+            break;
+        latencies.push_back(av_gettime_relative() - pkt.pts);
+        av_packet_unref(&pkt);
+    }
+    SDL_WaitThread(thread, NULL);
+    
+    state.pauseTiming();
+    q.abort();
+    state.setItemsProcessed(state.iterations());
+    state.setCounter("latency_p50_us", bench::Percentile(latencies, 0.5));
+    state.setCounter("latency_p99_us", bench::Percentile(latencies, 0.99));
+    state.setCounter("latency_max_us", bench::Percentile(latencies, 1.0));
+}
+BENCHMARK_ARG(PacketQueueThreaded, PacketQueue::MODE_LOCKED, "locked");
+BENCHMARK_ARG(PacketQueueThreaded, PacketQueue::MODE_SPSC, "spsc");
+
+/* peekWriteable/push/peekReadable/next on one thread, arg is keep_last */
+static void FrameQueueRoundTrip(bench::State& state)
+{
+    PacketQueue pktq;
+    FrameQueue fq;
+    Frame *vp;
+    int64_t i;
+    
+    state.pauseTiming();
+    if (pktq.init() < 0 || fq.init(&pktq, VIDEO_PICTURE_QUEUE_SIZE, state.arg()) < 0) {
+        state.skip("could not init the frame queue");
+        return;
+    }
+    pktq.start();
+    state.resumeTiming();
+    
+    for (i = 0; i < state.iterations(); i++) {
+        if (!(vp = fq.peekWriteable()))
+            break;
+        vp->pts = (double)i;
+        fq.push();
+        if (!(vp = fq.peekReadable()))
+            break;
+        bench::Use(vp->pts);
+        fq.next();
+    }
+    
+    state.pauseTiming();
+    pktq.abort();
+    fq.signal();
+    state.setItemsProcessed(state.iterations());
+}
+BENCHMARK_ARG(FrameQueueRoundTrip, 0, "no_keep_last");
+BENCHMARK_ARG(FrameQueueRoundTrip, 1, "keep_last");
+
+struct FrameProducer {
+    FrameQueue *queue;
+    int64_t count;
+};
+
+static int FrameProducerThread(void *arg)
+{
+    FrameProducer *p = (FrameProducer*)arg;
+    Frame *vp;
+    int64_t i;
+    
+    for (i = 0; i < p->count; i++) {
+        if (!(vp = p->queue->peekWriteable()))
+            break;
+        vp->pts = av_gettime_relative();
+        p->queue->push();
+    }
+    return 0;
+}
+
+/* a decoder thread pushes into a queue of arg frames and this one takes them,
+ * as the video refresh does without waiting for their display time */
+static void FrameQueueThreaded(bench::State& state)
+{
+    PacketQueue pktq;
+    FrameQueue fq;
+    FrameProducer producer;
+    SDL_Thread *thread;
+    std::vector<int64_t> latencies;
+    Frame *vp;
+    int64_t i;
+    
+    state.pauseTiming();
+    if (pktq.init() < 0 || fq.init(&pktq, state.arg(), 0) < 0) {
+        state.skip("could not init the frame queue");
+        return;
+    }
+    pktq.start();
+    latencies.reserve(state.iterations());
+    producer.queue = &fq;
+    producer.count = state.iterations();
+    state.resumeTiming();
+    
+    if (!(thread = SDL_CreateThread(FrameProducerThread, "FrameProducer", &producer))) {
+        state.skip(std::string("SDL_CreateThread(): ") + SDL_GetError());
+        return;
+    }
+    for (i = 0; i < state.iterations(); i++) {
+        if (!(vp = fq.peekReadable()))
+            break;
+        latencies.push_back(av_gettime_relative() - (int64_t)vp->pts);
+        fq.next();
+    }
+    SDL_WaitThread(thread, NULL);
+    
+    state.pauseTiming();
+    pktq.abort();
+    fq.signal();
+    state.setItemsProcessed(state.iterations());
+    state.setCounter("latency_p50_us", bench::Percentile(latencies, 0.5));
+    state.setCounter("latency_p99_us", bench::Percentile(latencies, 0.99));
+}
+BENCHMARK_ARG(FrameQueueThreaded, 3, "size3");
+BENCHMARK_ARG(FrameQueueThreaded, 16, "size16");
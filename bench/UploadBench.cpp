@@ -0,0 +1,81 @@
+//
+//  UploadBench.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "Benchmark.h"
+#include "SDLUtil.h"
+#include <stdexcept>
+#include <string.h>
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+#define UPLOAD_WIDTH 1920
+#define UPLOAD_HEIGHT 1080
+
+/* a 1080p picture of pixel format arg uploaded to its texture on the renderer
+ * main() set up, the software one unless SDL_RENDER_DRIVER says otherwise */
+static void UploadTexture(bench::State& state)
+{
+    AVPixelFormat format = (AVPixelFormat)state.arg();
+    SDL_Texture *texture = nullptr;
+    struct SwsContext *sws = nullptr;
+    AVFrame *frame;
+    int64_t i;
+    int plane;
+    
+    state.pauseTiming();
+    try {
+        if (!sdl::renderer()->getHandle())
+            throw std::runtime_error("no renderer");
+    } catch (const std::exception& e) {
+        state.skip(std::string("SDL video is not available: ") + e.what());
+        return;
+    }
+    if (!(frame = av_frame_alloc())) {
+        state.skip("could not allocate a frame");
+        return;
+    }
+    frame->format = format;
+    frame->width = UPLOAD_WIDTH;
+    frame->height = UPLOAD_HEIGHT;
+    if (av_frame_get_buffer(frame, 32) < 0) {
+        av_frame_free(&frame);
+        state.skip("could not allocate the picture");
+        return;
+    }
+    /* mid grey in every plane, the content does not change the cost */
+    for (plane = 0; plane < AV_NUM_DATA_POINTERS && frame->buf[plane]; plane++)
+        memset(frame->buf[plane]->data, 0x80, frame->buf[plane]->size);
+    /* the first upload creates the texture and the conversion context */
+    if (sdl::util::UploadTexture(&texture, frame, &sws) < 0) {
+        state.skip(std::string("UploadTexture(): ") + SDL_GetError());
+        av_frame_free(&frame);
+        return;
+    }
+    state.resumeTiming();
+    
+    for (i = 0; i < state.iterations(); i++)
+        sdl::util::UploadTexture(&texture, frame, &sws);
+    
+    state.pauseTiming();
+    state.setItemsProcessed(state.iterations() * UPLOAD_WIDTH * UPLOAD_HEIGHT);
+    state.setBytesProcessed(state.iterations() * av_image_get_buffer_size(format, UPLOAD_WIDTH, UPLOAD_HEIGHT, 1));
+    if (texture)
+        SDL_DestroyTexture(texture);
+    sws_freeContext(sws);
+    av_frame_free(&frame);
+}
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_YUV420P, "yuv420p");
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_NV12, "nv12");
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_BGRA, "bgra");
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_RGB24, "rgb24");
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_P010, "p010");
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_YUV420P10, "yuv420p10");
+BENCHMARK_ARG(UploadTexture, AV_PIX_FMT_YUV422P, "yuv422p");
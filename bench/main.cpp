@@ -0,0 +1,70 @@
+//
+//  main.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "Benchmark.h"
+#include "FFMPEGUtil.h"
+#include "SDLUtil.h"
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+/* ffplayer_bench [-filter substring] [-min_time seconds] [-o results.json]
+ *
+ * runs without a display: SDL uses its dummy video driver and the software
+ * renderer unless SDL_VIDEODRIVER and SDL_RENDER_DRIVER say otherwise */
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    const char *output = nullptr;
+    double min_time = 0.5;
+    char version[64];
+    FILE *out = stdout;
+    int ran;
+    
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "-min_time") && i + 1 < argc)
+            min_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-filter substring] [-min_time seconds] [-o results.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (output && !(out = fopen(output, "w"))) {
+        perror(output);
+        return 1;
+    }
+    
+    av_log_set_level(AV_LOG_ERROR);
+    ffmpeg::StartUp();
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+    /* the upload benchmarks skip themselves if this fails */
+    sdl::Startup("ffplayer_bench", sdl::Settings().video().timer(), sdl::Window::Settings().hidden());
+    
+    bench::SetContext("num_cpus", std::to_string(std::thread::hardware_concurrency()));
+    bench::SetContext("libavcodec", AV_STRINGIFY(LIBAVCODEC_VERSION));
+    bench::SetContext("libavformat", AV_STRINGIFY(LIBAVFORMAT_VERSION));
+    snprintf(version, sizeof(version), "%d.%d.%d", SDL_MAJOR_VERSION, SDL_MINOR_VERSION, SDL_PATCHLEVEL);
+    bench::SetContext("sdl", version);
+    try {
+        if (sdl::renderer()->getHandle())
+            bench::SetContext("renderer", sdl::renderer()->getInfo()->name);
+    } catch (const std::exception&) {
+    }
+    
+    ran = bench::RunAll(filter, min_time, out);
+    
+    if (out != stdout)
+        fclose(out);
+    sdl::Shutdown();
+    ffmpeg::Shutdown();
+    return ran > 0 ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+//
+//  AudioGain.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "AudioGain.h"
+#include "Definitions.h"
+#include <math.h>
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AUDIO_GAIN_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define AUDIO_GAIN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define AUDIO_GAIN_TARGET_AVX2
+#endif
+#elif defined(__aarch64__)
+#define AUDIO_GAIN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace ffmpeg {
+
+typedef void (*ScaleS16Fn)(int16_t *out, const int16_t *in, int count, float gain);
+typedef void (*ScaleFloatFn)(float *out, const float *in, int count, float gain);
+
+static void ScaleS16_C(int16_t *out, const int16_t *in, int count, float gain)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        out[i] = av_clip_int16((int)lrintf(in[i] * gain));
+}
+
+static void ScaleFloat_C(float *out, const float *in, int count, float gain)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        out[i] = in[i] * gain;
+}
+
+#if AUDIO_GAIN_X86
+static void ScaleS16_SSE2(int16_t *out, const int16_t *in, int count, float gain)
+{
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    
+    for (; i + 8 <= count; i += 8) {
+        __m128i s  = _mm_loadu_si128((const __m128i*)(in + i));
+        /* sign extend to 32 bit by unpacking each sample with itself */
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+        hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    ScaleS16_C(out + i, in + i, count - i, gain);
+}
+
+static void ScaleFloat_SSE2(float *out, const float *in, int count, float gain)
+{
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+    ScaleFloat_C(out + i, in + i, count - i, gain);
+}
+
+static AUDIO_GAIN_TARGET_AVX2 void ScaleS16_AVX2(int16_t *out, const int16_t *in, int count, float gain)
+{
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+        lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), g));
+        hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), g));
+        /* packs works per 128 bit lane, put the quadwords back in order */
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8));
+    }
+    ScaleS16_C(out + i, in + i, count - i, gain);
+}
+
+static AUDIO_GAIN_TARGET_AVX2 void ScaleFloat_AVX2(float *out, const float *in, int count, float gain)
+{
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), g));
+    ScaleFloat_C(out + i, in + i, count - i, gain);
+}
+#endif
+
+#if AUDIO_GAIN_NEON
+static void ScaleS16_NEON(int16_t *out, const int16_t *in, int count, float gain)
+{
+    float32x4_t g = vdupq_n_f32(gain);
+    int i = 0;
+    
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t s  = vld1q_s16(in + i);
+        int32x4_t lo = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), g));
+        int32x4_t hi = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), g));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+    ScaleS16_C(out + i, in + i, count - i, gain);
+}
+
+static void ScaleFloat_NEON(float *out, const float *in, int count, float gain)
+{
+    float32x4_t g = vdupq_n_f32(gain);
+    int i = 0;
+    
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32(out + i, vmulq_f32(vld1q_f32(in + i), g));
+    ScaleFloat_C(out + i, in + i, count - i, gain);
+}
+#endif
+
+struct GainKernels {
+    ScaleS16Fn scaleS16;
+    ScaleFloatFn scaleFloat;
+};
+
+static GainKernels SelectKernels()
+{
+    GainKernels kernels = { ScaleS16_C, ScaleFloat_C };
+#if AUDIO_GAIN_X86
+    int flags = av_get_cpu_flags();
+    if (flags & AV_CPU_FLAG_SSE2) {
+        kernels.scaleS16 = ScaleS16_SSE2;
+        kernels.scaleFloat = ScaleFloat_SSE2;
+    }
+    if (flags & AV_CPU_FLAG_AVX2) {
+        kernels.scaleS16 = ScaleS16_AVX2;
+        kernels.scaleFloat = ScaleFloat_AVX2;
+    }
+#elif AUDIO_GAIN_NEON
+    kernels.scaleS16 = ScaleS16_NEON;
+    kernels.scaleFloat = ScaleFloat_NEON;
+#endif
+    return kernels;
+}
+
+static const GainKernels& Kernels()
+{
+    static const GainKernels kernels = SelectKernels();
+    return kernels;
+}
+
+void AudioGain::ScaleS16(int16_t *out, const int16_t *in, int count, float gain)
+{
+    Kernels().scaleS16(out, in, count, gain);
+}
+
+void AudioGain::ScaleFloat(float *out, const float *in, int count, float gain)
+{
+    Kernels().scaleFloat(out, in, count, gain);
+}
+
+AudioGain::AudioGain():
+mTarget(1.0f),
+mGain(1.0f),
+mRampFrom(1.0f),
+mRampTo(1.0f),
+mRampPosition(AUDIO_GAIN_RAMP_SAMPLES)
+{
+    Kernels();
+}
+
+void AudioGain::setTarget(float gain)
+{
+    mTarget.store(gain, std::memory_order_relaxed);
+}
+
+/* only call when the audio thread is not running */
+void AudioGain::reset(float gain)
+{
+    mTarget = gain;
+    mGain = mRampFrom = mRampTo = gain;
+    mRampPosition = AUDIO_GAIN_RAMP_SAMPLES;
+}
+
+bool AudioGain::isUnity()const
+{
+    return mGain == 1.0f && mTarget.load(std::memory_order_relaxed) == 1.0f;
+}
+
+bool AudioGain::isSilent()const
+{
+    return mGain == 0.0f && mTarget.load(std::memory_order_relaxed) == 0.0f;
+}
+
+/* picks up a new target and returns how many of the next nb_frames still
+ * belong to the ramp towards it */
+int AudioGain::beginRamp(int nb_frames)
+{
+    float target = mTarget.load(std::memory_order_relaxed);
+    
+    if (target != mRampTo) {
+        /* start from wherever the previous ramp got to */
+        mRampFrom = mGain;
+        mRampTo = target;
+        mRampPosition = 0;
+    }
+    return FFMIN(nb_frames, AUDIO_GAIN_RAMP_SAMPLES - mRampPosition);
+}
+
+void AudioGain::applyS16(int16_t *out, const int16_t *in, int nb_samples, int channels)
+{
+    int nb_frames = nb_samples / channels;
+    int ramp = beginRamp(nb_frames);
+    int i, c;
+    
+    if (ramp > 0) {
+        float step = (mRampTo - mRampFrom) / AUDIO_GAIN_RAMP_SAMPLES;
+        for (i = 0; i < ramp; i++) {
+            float gain = mRampFrom + step * (mRampPosition + i + 1);
+            for (c = 0; c < channels; c++, in++, out++)
+                *out = av_clip_int16((int)lrintf(*in * gain));
+        }
+        mRampPosition += ramp;
+        mGain = mRampPosition == AUDIO_GAIN_RAMP_SAMPLES ? mRampTo : mRampFrom + step * mRampPosition;
+        nb_samples -= ramp * channels;
+    }
+    ScaleS16(out, in, nb_samples, mGain);
+}
+
+void AudioGain::applyFloat(float *out, const float *in, int nb_samples, int channels)
+{
+    int nb_frames = nb_samples / channels;
+    int ramp = beginRamp(nb_frames);
+    int i, c;
+    
+    if (ramp > 0) {
+        float step = (mRampTo - mRampFrom) / AUDIO_GAIN_RAMP_SAMPLES;
+        for (i = 0; i < ramp; i++) {
+            float gain = mRampFrom + step * (mRampPosition + i + 1);
+            for (c = 0; c < channels; c++, in++, out++)
+                *out = *in * gain;
+        }
+        mRampPosition += ramp;
+        mGain = mRampPosition == AUDIO_GAIN_RAMP_SAMPLES ? mRampTo : mRampFrom + step * mRampPosition;
+        nb_samples -= ramp * channels;
+    }
+    ScaleFloat(out, in, nb_samples, mGain);
+}
+
+}//end namespace ffmpeg
@@ -0,0 +1,49 @@
+//
+//  AudioGain.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+namespace ffmpeg {
+
+/* applies a volume to interleaved samples in a single pass from the decoded
+ * buffer into the output; changes of the target gain are ramped linearly over
+ * AUDIO_GAIN_RAMP_SAMPLES sample frames so they do not click. setTarget() may
+ * be called from any thread, apply*() only from the audio thread */
+class AudioGain {
+public:
+    
+    AudioGain();
+    
+    void setTarget(float gain);
+    void reset(float gain);
+    
+    /* true when apply would be a plain copy, or plain silence */
+    bool isUnity()const;
+    bool isSilent()const;
+    
+    void applyS16(int16_t *out, const int16_t *in, int nb_samples, int channels);
+    void applyFloat(float *out, const float *in, int nb_samples, int channels);
+    
+    /* scale count samples by a constant gain with the best kernel the cpu has */
+    static void ScaleS16(int16_t *out, const int16_t *in, int count, float gain);
+    static void ScaleFloat(float *out, const float *in, int count, float gain);
+
+private:
+    
+    int beginRamp(int nb_frames);
+    
+    std::atomic<float> mTarget;
+    float mGain;            /* gain reached at the end of the last apply */
+    float mRampFrom;
+    float mRampTo;
+    int mRampPosition;      /* frames into the current ramp */
+};
+
+}//end namespace ffmpeg
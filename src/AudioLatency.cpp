@@ -0,0 +1,119 @@
+//
+//  AudioLatency.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "AudioLatency.h"
+#include "Definitions.h"
+#include <math.h>
+
+extern "C" {
+#include "libavutil/avutil.h"
+}
+
+namespace ffmpeg {
+
+AudioLatency::AudioLatency():
+mBytesPerSec(0),
+mStartTime(0),
+mDelivered(0),
+mCallbacks(0),
+mOutliers(0),
+mOutlierTime(0),
+mOutlierDelivered(0),
+mCount(0),
+mMeanX(0.0),
+mMeanY(0.0),
+mSxx(0.0),
+mSxy(0.0),
+mSyy(0.0),
+mLatency(NAN),
+mJitter(NAN),
+mRestarts(0)
+{
+}
+
+/* only call while the audio device is paused */
+void AudioLatency::reset(int bytes_per_sec)
+{
+    mBytesPerSec = bytes_per_sec;
+    mCallbacks = 0;
+    mRestarts = 0;
+    mLatency = NAN;
+    mJitter = NAN;
+}
+
+void AudioLatency::restart(int64_t time)
+{
+    mStartTime = time;
+    mDelivered = 0;
+    mCallbacks = 0;
+    mOutliers = 0;
+    mCount = 0;
+    mMeanX = mMeanY = 0.0;
+    mSxx = mSxy = mSyy = 0.0;
+}
+
+void AudioLatency::update(int64_t time, int len)
+{
+    double x, y, dx, dy, slope, residual, jitter;
+    int64_t delivered;
+    
+    if (mBytesPerSec <= 0)
+        return;
+    if (!mCallbacks)
+        restart(time);
+    
+    x = (double)mDelivered / mBytesPerSec;
+    y = (time - mStartTime) / 1000000.0;
+    delivered = mDelivered;
+    mDelivered += len;
+    /* the first callbacks only prime the device and come in a burst */
+    if (mCallbacks++ < AUDIO_LATENCY_PRIME_CALLBACKS)
+        return;
+    
+    if (mCount >= AUDIO_LATENCY_MIN_CALLBACKS) {
+        slope = mSxy / mSxx;
+        residual = y - (mMeanY + slope * (x - mMeanX));
+        if (fabs(residual) > FFMAX(AUDIO_LATENCY_OUTLIER_JITTERS * mJitter.load(std::memory_order_relaxed), AUDIO_LATENCY_OUTLIER_MIN)) {
+            /* a late callback that the device rode out is followed by one that
+             * catches up, if they keep coming the device ran dry and started over
+             * at the first of them, priming itself again */
+            if (!mOutliers++) {
+                mOutlierTime = time;
+                mOutlierDelivered = delivered;
+            }
+            if (mOutliers >= AUDIO_LATENCY_RESTART_OUTLIERS) {
+                delivered = mDelivered - mOutlierDelivered;
+                mRestarts++;
+                restart(mOutlierTime);
+                mDelivered = delivered;
+                mCallbacks = AUDIO_LATENCY_RESTART_OUTLIERS;
+            }
+            return;
+        }
+        mOutliers = 0;
+    }
+    
+    /* Welford style updates so the sums stay precise over long runs */
+    mCount++;
+    dx = x - mMeanX;
+    dy = y - mMeanY;
+    mMeanX += dx / mCount;
+    mMeanY += dy / mCount;
+    mSxx += dx * (x - mMeanX);
+    mSxy += dx * (y - mMeanY);
+    mSyy += dy * (y - mMeanY);
+    
+    if (mCount < AUDIO_LATENCY_MIN_CALLBACKS || mSxx <= 0.0)
+        return;
+    slope = mSxy / mSxx;
+    /* the line's time at zero bytes delivered, relative to the first callback */
+    mLatency = FFMAX(slope * mMeanX - mMeanY, 0.0);
+    jitter = (mSyy - mSxy * slope) / (mCount - 2);
+    mJitter = jitter > 0.0 ? sqrt(jitter) : 0.0;
+}
+
+}//end namespace ffmpeg
@@ -0,0 +1,59 @@
+//
+//  AudioLatency.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+namespace ffmpeg {
+
+/* estimates how long the audio device holds on to what the callback hands it from
+ * the callback timestamps alone. Once the device is primed, a callback fires whenever
+ * all but a constant number of the bytes delivered so far have been played, so the
+ * callback times regressed against the bytes delivered before them lie on a line
+ * that crosses zero bytes one device latency before the first callback; the spread
+ * around that line is the callback jitter. Silence counts as delivered, so pausing
+ * and underruns do not disturb the fit, a device hiccup does and restarts it.
+ * update() is only called from the audio callback, the getters from anywhere */
+class AudioLatency {
+public:
+    
+    AudioLatency();
+    
+    void reset(int bytes_per_sec);
+    void update(int64_t time, int len);
+    
+    /* seconds, NAN until enough callbacks were seen */
+    inline double getLatency()const{return mLatency.load(std::memory_order_relaxed);}
+    inline double getJitter()const{return mJitter.load(std::memory_order_relaxed);}
+    inline int getRestarts()const{return mRestarts.load(std::memory_order_relaxed);}
+
+private:
+    
+    void restart(int64_t time);
+    
+    int mBytesPerSec;
+    int64_t mStartTime;     /* first callback since the last restart, microseconds */
+    int64_t mDelivered;     /* bytes handed to the device since then */
+    int mCallbacks;
+    int mOutliers;          /* consecutive callbacks off the line */
+    int64_t mOutlierTime;   /* and where the first of them was */
+    int64_t mOutlierDelivered;
+    
+    /* running least squares of callback time (y) over delivered audio time (x),
+     * both in seconds since mStartTime */
+    int mCount;
+    double mMeanX, mMeanY;
+    double mSxx, mSxy, mSyy;
+    
+    std::atomic<double> mLatency;
+    std::atomic<double> mJitter;
+    std::atomic<int> mRestarts;
+};
+
+}//end namespace ffmpeg
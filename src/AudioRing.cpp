@@ -0,0 +1,154 @@
+//
+//  AudioRing.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "AudioRing.h"
+#include <string.h>
+
+extern "C" {
+#include "libavutil/avutil.h"
+#include "libavutil/mem.h"
+}
+
+namespace ffmpeg {
+
+AudioRing::AudioRing():
+mBuffer(nullptr),
+mSize(0),
+mWritePos(0),
+mReadPos(0),
+mMarkerWrite(0),
+mMarkerRead(0),
+mWriterWaiting(0),
+mSemaphore(nullptr)
+{
+}
+
+AudioRing::~AudioRing()
+{
+    destroy();
+}
+
+int AudioRing::init(int size)
+{
+    destroy();
+    mSize = 1;
+    while (mSize < size)
+        mSize <<= 1;
+    if (!(mBuffer = (uint8_t*)av_malloc(mSize)))
+        return AVERROR(ENOMEM);
+    if (!(mSemaphore = SDL_CreateSemaphore(0))) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateSemaphore(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    reset();
+    return 0;
+}
+
+void AudioRing::destroy()
+{
+    av_freep(&mBuffer);
+    mSize = 0;
+    if (mSemaphore) {
+        SDL_DestroySemaphore(mSemaphore);
+        mSemaphore = nullptr;
+    }
+}
+
+void AudioRing::reset()
+{
+    mWritePos = 0;
+    mReadPos = 0;
+    mMarkerWrite = 0;
+    mMarkerRead = 0;
+    mWriterWaiting = 0;
+}
+
+int AudioRing::writable()const
+{
+    if (mMarkerWrite.load(std::memory_order_relaxed) - mMarkerRead.load(std::memory_order_acquire) >= AUDIO_RING_MARKERS)
+        return 0;
+    return mSize - (int)(mWritePos.load(std::memory_order_relaxed) - mReadPos.load(std::memory_order_acquire));
+}
+
+int AudioRing::write(const uint8_t *data, int len, double clock, int serial)
+{
+    int64_t wpos = mWritePos.load(std::memory_order_relaxed);
+    int marker = mMarkerWrite.load(std::memory_order_relaxed);
+    int offset, len1;
+    Marker *m;
+    
+    if (marker - mMarkerRead.load(std::memory_order_acquire) >= AUDIO_RING_MARKERS)
+        return 0;
+    len = FFMIN(len, mSize - (int)(wpos - mReadPos.load(std::memory_order_acquire)));
+    if (len <= 0)
+        return 0;
+    
+    offset = (int)(wpos & (mSize - 1));
+    len1 = FFMIN(len, mSize - offset);
+    memcpy(mBuffer + offset, data, len1);
+    memcpy(mBuffer, data + len1, len - len1);
+    
+    m = &mMarkers[marker & (AUDIO_RING_MARKERS - 1)];
+    m->end = wpos + len;
+    m->clock = clock;
+    m->serial = serial;
+    mMarkerWrite.store(marker + 1, std::memory_order_release);
+    mWritePos.store(wpos + len, std::memory_order_release);
+    return len;
+}
+
+/* the seq_cst store of mWriterWaiting before re-checking the read side pairs
+ * with advance() moving the read side before reading mWriterWaiting, so the
+ * writer never sleeps through the room being made */
+void AudioRing::waitWritable(int timeout_ms)
+{
+    mWriterWaiting = 1;
+    if (writable() > 0) {
+        mWriterWaiting = 0;
+        return;
+    }
+    SDL_SemWaitTimeout(mSemaphore, timeout_ms);
+    mWriterWaiting = 0;
+}
+
+void AudioRing::wakeWriter()
+{
+    if (mSemaphore)
+        SDL_SemPost(mSemaphore);
+}
+
+int AudioRing::peek(const uint8_t **data, Marker *marker)
+{
+    int64_t rpos = mReadPos.load(std::memory_order_relaxed);
+    int64_t wpos = mWritePos.load(std::memory_order_acquire);
+    int offset;
+    
+    if (wpos == rpos)
+        return 0;
+    /* markers are pushed before the bytes they cover become visible and
+     * dropped once read past, so the oldest one covers the read position */
+    *marker = mMarkers[mMarkerRead.load(std::memory_order_relaxed) & (AUDIO_RING_MARKERS - 1)];
+    offset = (int)(rpos & (mSize - 1));
+    *data = mBuffer + offset;
+    return (int)FFMIN(marker->end - rpos, mSize - offset);
+}
+
+void AudioRing::advance(int len)
+{
+    int64_t rpos = mReadPos.load(std::memory_order_relaxed) + len;
+    int marker = mMarkerRead.load(std::memory_order_relaxed);
+    int end = mMarkerWrite.load(std::memory_order_acquire);
+    
+    while (marker != end && mMarkers[marker & (AUDIO_RING_MARKERS - 1)].end <= rpos)
+        marker++;
+    mMarkerRead.store(marker, std::memory_order_release);
+    mReadPos = rpos;
+    if (mWriterWaiting && mWriterWaiting.exchange(0))
+        SDL_SemPost(mSemaphore);
+}
+
+}//end namespace ffmpeg
@@ -0,0 +1,71 @@
+//
+//  AudioRing.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <atomic>
+#include "Definitions.h"
+
+namespace ffmpeg {
+
+/* single producer / single consumer byte ring between the audio render thread and
+ * the SDL audio callback. Every write also records a marker with the audio clock at
+ * the end of the written bytes and the serial they were decoded for, so the reader
+ * can tell the clock of any byte it plays and skip bytes left over from before a
+ * seek. Neither side ever takes a lock, the writer sleeps on a semaphore that the
+ * reader only posts while the writer is waiting for room */
+class AudioRing {
+public:
+    
+    struct Marker {
+        int64_t end;    /* write position just past the bytes this marker covers */
+        double clock;   /* audio clock at end, NAN if unknown */
+        int serial;
+    };
+    
+    AudioRing();
+    ~AudioRing();
+    
+    /* size is rounded up to a power of two, only call while neither side runs */
+    int init(int size);
+    void destroy();
+    void reset();
+    
+    /* writer: bytes write() would take right now, 0 while the markers are used up */
+    int writable()const;
+    /* writer: copy up to len bytes, returns how many were taken, 0 when full */
+    int write(const uint8_t *data, int len, double clock, int serial);
+    /* writer: sleep until there is room or timeout_ms passed or wakeWriter() */
+    void waitWritable(int timeout_ms);
+    void wakeWriter();
+    
+    /* reader: contiguous bytes at the read position that share one marker, 0 when empty */
+    int peek(const uint8_t **data, Marker *marker);
+    void advance(int len);
+    
+    /* bytes written but not yet read, from any thread */
+    inline int fill()const{return (int)(mWritePos.load(std::memory_order_acquire) - mReadPos.load(std::memory_order_acquire));}
+    inline int64_t getReadPosition()const{return mReadPos.load(std::memory_order_relaxed);}
+    inline int getSize()const{return mSize;}
+
+private:
+    
+    uint8_t *mBuffer;
+    int mSize;
+    std::atomic<int64_t> mWritePos;
+    std::atomic<int64_t> mReadPos;
+    Marker mMarkers[AUDIO_RING_MARKERS];
+    std::atomic<int> mMarkerWrite;
+    std::atomic<int> mMarkerRead;
+    std::atomic<int> mWriterWaiting;
+    SDL_sem *mSemaphore;
+};
+
+}//end namespace ffmpeg
@@ -7,6 +7,7 @@
 
 #include "Decoder.h"
 #include "FrameQueue.h"
+#include "Trace.h"
 
 namespace ffmpeg {
 
@@ -14,11 +15,17 @@ int Decoder::REORDER_PTS = -1;
 
 Decoder::Decoder():
 mPacket(),
+mBatch(),
+mBatchSerials(),
+mBatchCount(0),
+mBatchIndex(0),
+mBatchMax(DECODER_PACKET_BATCH_SIZE),
 mQueue(nullptr),
 mAVContext(nullptr),
 mPacketSerial(-1),
 mFinished(0),
 mPacketPending(0),
+mStreamIndex(-1),
 mQueueEmptyCondVar(nullptr),
 mStartPTS(AV_NOPTS_VALUE),
 mStartPTS_TB({0,0}),
@@ -38,15 +45,28 @@ void Decoder::init(AVCodecContext *avctx, ffmpeg::PacketQueue *queue, SDL_cond *
     mQueueEmptyCondVar = empty_queue_cond;
     mStartPTS = AV_NOPTS_VALUE;
     mPacketSerial = -1;
+    mBatchCount = 0;
+    mBatchIndex = 0;
+    mBatchMax = avctx->codec_type == AVMEDIA_TYPE_VIDEO ? DECODER_VIDEO_PACKET_BATCH_SIZE : DECODER_PACKET_BATCH_SIZE;
 }
 
 void Decoder::destroy()
 {
     av_packet_unref(&mPacket);
+    clearBatch();
     avcodec_free_context(&mAVContext);
 }
+
+/* drop the packets fetched from the queue but not decoded yet */
+void Decoder::clearBatch()
+{
+    while (mBatchIndex < mBatchCount)
+        av_packet_unref(&mBatch[mBatchIndex++]);
+    mBatchCount = 0;
+    mBatchIndex = 0;
+}
     
-int Decoder::decodeFrame(AVFrame *frame, AVSubtitle *sub)
+int Decoder::decodeFrame(AVFrame *frame, AVSubtitle *sub, bool block)
 {
     int ret = AVERROR(EAGAIN);
     
@@ -55,6 +75,7 @@ int Decoder::decodeFrame(AVFrame *frame, AVSubtitle *sub)
         
         if (mQueue->getSerial() == mPacketSerial) {
             do {
+                int64_t start = trace::Begin();
                 if (mQueue->getAbortRequest())
                     return -1;
                 
@@ -90,22 +111,37 @@ int Decoder::decodeFrame(AVFrame *frame, AVSubtitle *sub)
                     avcodec_flush_buffers(mAVContext);
                     return 0;
                 }
-                if (ret >= 0)
+                if (ret >= 0) {
+                    trace::Record(trace::STAGE_DECODE, start, mStreamIndex, frame->pts);
                     return 1;
+                }
             } while (ret != AVERROR(EAGAIN));
         }
         
-        do {
-            if (mQueue->getNumPackets() == 0)
-                SDL_CondSignal(mQueueEmptyCondVar);
+        for (;;) {
             if (mPacketPending) {
                 av_packet_move_ref(&pkt, &mPacket);
                 mPacketPending = 0;
             } else {
-                if (mQueue->get(&pkt, true, &mPacketSerial) < 0)
-                    return -1;
+                if (mBatchIndex == mBatchCount) {
+                    if (mQueue->getNumPackets() == 0)
+                        SDL_CondSignal(mQueueEmptyCondVar);
+                    mBatchIndex = 0;
+                    if ((mBatchCount = mQueue->getBatch(mBatch, mBatchMax, mBatchSerials, block)) < 0) {
+                        mBatchCount = 0;
+                        return -1;
+                    }
+                    if (!mBatchCount)
+                        return AVERROR(EAGAIN);
+                }
+                av_packet_move_ref(&pkt, &mBatch[mBatchIndex]);
+                mPacketSerial = mBatchSerials[mBatchIndex++];
             }
-        } while (mQueue->getSerial() != mPacketSerial);
+            if (mQueue->getSerial() == mPacketSerial)
+                break;
+            /* queued before a flush, the decoder has to skip it */
+            av_packet_unref(&pkt);
+        }
         
         if (pkt.data == PacketQueue::sFlushPacket.data) {
             avcodec_flush_buffers(mAVContext);
@@ -126,6 +162,7 @@ int Decoder::decodeFrame(AVFrame *frame, AVSubtitle *sub)
                     ret = got_frame ? 0 : (pkt.data ? AVERROR(EAGAIN) : AVERROR_EOF);
                 }
             } else {
+                mStreamIndex = pkt.stream_index;
                 if (avcodec_send_packet(mAVContext, &pkt) == AVERROR(EAGAIN)) {
                     av_log(mAVContext, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
                     mPacketPending = 1;
@@ -143,12 +180,15 @@ void Decoder::abort(FrameQueue *fq)
     fq->signal();
     SDL_WaitThread(mDecoderThread, NULL);
     mDecoderThread = nullptr;
+    clearBatch();
     mQueue->flush();
 }
 
 int Decoder::start(int(*threadFn)(void*), void *arg)
 {
     mQueue->start();
+    if (!threadFn)
+        return 0;
     mDecoderThread = SDL_CreateThread(threadFn, "decoder", arg);
     if (!mDecoderThread) {
         av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
@@ -22,8 +22,10 @@ public:
     
     void init(AVCodecContext *avctx, PacketQueue *queue, SDL_cond *empty_queue_cond);
     void destroy();
-    int decodeFrame(AVFrame *frame, AVSubtitle *sub);
+    /* without block it returns AVERROR(EAGAIN) instead of waiting for packets */
+    int decodeFrame(AVFrame *frame, AVSubtitle *sub, bool block = true);
     void abort(class FrameQueue* fq);
+    /* no threadFn when a PlayerHost worker calls decodeFrame() */
     int start(int(*threadFn)(void*), void *arg);
     
     inline int getFinished()const{return mFinished;}
@@ -35,12 +37,20 @@ public:
     inline AVCodecContext* getAVContext(){return mAVContext;}
 
 private:
+    void clearBatch();
+    
     AVPacket mPacket;
+    AVPacket mBatch[DECODER_PACKET_BATCH_SIZE];
+    int mBatchSerials[DECODER_PACKET_BATCH_SIZE];
+    int mBatchCount;
+    int mBatchIndex;
+    int mBatchMax;
     PacketQueue *mQueue;
     AVCodecContext *mAVContext;
     int mPacketSerial;
     int mFinished;
     int mPacketPending;
+    int mStreamIndex;           /* of the last packet sent, only used to tag trace events */
     SDL_cond *mQueueEmptyCondVar;
     int64_t mStartPTS;
     AVRational mStartPTS_TB;
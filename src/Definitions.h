@@ -13,9 +13,36 @@
 #include <SDL.h>
 
 #define VIDEO_PICTURE_QUEUE_SIZE 3
+/* streaming textures pictures are uploaded to ahead of their display, one is on
+ * screen and the others hold queued pictures. Sized for the default queue depth,
+ * not VIDEO_PICTURE_QUEUE_MAX_SIZE: a deeper queue only uploads its later
+ * pictures when they are displayed, rather than holding that many textures */
+#define VIDEO_TEXTURE_RING_SIZE (VIDEO_PICTURE_QUEUE_SIZE + 1)
+/* the picture queue can be resized at runtime up to this many frames */
+#define VIDEO_PICTURE_QUEUE_MAX_SIZE 16
 #define SUBPICTURE_QUEUE_SIZE 16
 #define SAMPLE_QUEUE_SIZE 9
-#define FRAME_QUEUE_SIZE FFMAX(SAMPLE_QUEUE_SIZE, FFMAX(VIDEO_PICTURE_QUEUE_SIZE, SUBPICTURE_QUEUE_SIZE))
+#define FRAME_QUEUE_MAX_SIZE 64
+/* default depth of the queue in front of each frame sink, the oldest frame is
+ * dropped when a sink falls further behind */
+#define FRAME_SINK_QUEUE_SIZE 8
+/* pictures the shared memory sink's ring holds, and the alignment of its slots
+ * and of the planes in them, a cache line */
+#define SHM_SINK_SLOTS 4
+#define SHM_SINK_ALIGN 64
+
+/* pictures SDL cannot show as they are get converted in the video thread by up to
+ * this many threads, each taking a band at least VIDEO_CONVERT_MIN_BAND_HEIGHT high */
+#define VIDEO_CONVERT_MAX_THREADS 8
+#define VIDEO_CONVERT_MIN_BAND_HEIGHT 64
+/* lines each band converts above and below its own, and drops, so the vertical
+ * chroma filter sees its neighbours' lines; rounded up to a chroma line */
+#define VIDEO_CONVERT_BAND_OVERLAP 8
+
+/* adaptive picture queue: seconds without late frame drops before a slot is given back */
+#define PICTURE_QUEUE_SHRINK_DELAY 10.0
+/* adaptive picture queue: default budget for the decoded pictures it may hold */
+#define PICTURE_QUEUE_MEMORY_LIMIT (256 * 1024 * 1024)
 
 /* no AV sync correction is done if below the minimum AV sync threshold */
 #define AV_SYNC_THRESHOLD_MIN 0.04
@@ -31,6 +58,14 @@
 #define SAMPLE_ARRAY_SIZE (8 * 65536)
 #define MAX_QUEUE_SIZE (15 * 1024 * 1024)
 #define MIN_FRAMES 25
+/* number of packet queue nodes allocated at once when the node pool runs dry */
+#define PACKET_QUEUE_SLAB_ITEMS 64
+/* default number of slots of a lock-free packet queue, rounded up to a power of two */
+#define PACKET_QUEUE_RING_SIZE 1024
+/* most packets a decoder pulls out of its packet queue at once; video packets
+ * are kept fewer so the read thread's buffering heuristics still see them queued */
+#define DECODER_PACKET_BATCH_SIZE 16
+#define DECODER_VIDEO_PACKET_BATCH_SIZE 4
 /* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
 #define AUDIO_DIFF_AVG_NB   20
 
@@ -41,15 +76,77 @@
 
 /* Step size for volume control in dB */
 #define SDL_VOLUME_STEP (0.75)
+/* volume changes are ramped over this many sample frames so they do not click */
+#define AUDIO_GAIN_RAMP_SAMPLES 256
+
+/* the audio render thread keeps this many device buffers rendered ahead of the callback */
+#define AUDIO_RING_PERIODS 4
+/* writes the audio ring can keep track of at once, must be a power of two */
+#define AUDIO_RING_MARKERS 64
+/* how long the audio render thread sleeps when it has nothing to do, in milliseconds */
+#define AUDIO_RENDER_IDLE_WAIT 10
+
+/* audio latency estimation: callbacks left out while the device fills up, callbacks
+ * needed for an estimate, and when a callback is too far off the fitted line (in
+ * jitters, at least AUDIO_LATENCY_OUTLIER_MIN seconds); that many in a row restart it */
+#define AUDIO_LATENCY_PRIME_CALLBACKS 8
+#define AUDIO_LATENCY_MIN_CALLBACKS 16
+#define AUDIO_LATENCY_OUTLIER_JITTERS 6.0
+#define AUDIO_LATENCY_OUTLIER_MIN 0.005
+#define AUDIO_LATENCY_RESTART_OUTLIERS 3
+/* once the latency is measured the A-V sync threshold follows the callback jitter,
+ * but never drops below AUDIO_DIFF_THRESHOLD_MIN seconds */
+#define AUDIO_DIFF_JITTERS 3.0
+#define AUDIO_DIFF_THRESHOLD_MIN 0.01
 
 /* maximum audio speed change to get correct sync */
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
 
 #define FF_QUIT_EVENT    (SDL_USEREVENT + 2)
 
+/* fast start bounds how much avformat_find_stream_info reads when the container
+ * header is not enough, in bytes and microseconds */
+#define FAST_START_PROBESIZE (256 * 1024)
+#define FAST_START_ANALYZE_DURATION 500000
+
+/* custom input contexts hand the demuxer this many bytes at a time */
+#define INPUT_IO_BUFFER_SIZE (64 * 1024)
+/* read ahead input: blocks in flight, their default and allowed sizes, and the
+ * alignment of their memory and file offsets, as O_DIRECT needs */
+#define READ_AHEAD_BLOCKS 4
+#define READ_AHEAD_BLOCK_SIZE (2 * 1024 * 1024)
+#define READ_AHEAD_MIN_BLOCK_SIZE (1024 * 1024)
+#define READ_AHEAD_MAX_BLOCK_SIZE (8 * 1024 * 1024)
+#define READ_AHEAD_ALIGN 4096
+/* mapped input: pages advised ahead of the read position, pages kept mapped
+ * behind it for short seeks back, and a copy slower than this (seconds) had to
+ * fault pages in from the disk */
+#define MAPPED_IO_WINDOW (4 * 1024 * 1024)
+#define MAPPED_IO_KEEP_BEHIND (8 * 1024 * 1024)
+#define MAPPED_IO_STALL_TIME 0.001
+
 /* polls for possible required screen refresh at least this often, should be less than 1/fps */
 #define REFRESH_RATE 0.01
 
+/* events kept per thread by the tracer, must be a power of two */
+#define TRACE_RING_SIZE 16384
+
+/* default period of the stats emitter, in seconds */
+#define STATS_EMIT_INTERVAL 1.0
+/* room for a stats line with every counter large, longer ones are formatted on the heap */
+#define STATS_LINE_SIZE 4096
+
+/* headless mode samples the queue occupancy this often, in seconds */
+#define HEADLESS_POLL_INTERVAL 0.01
+
+/* a PlayerHost retries a task that had nothing to do after this many seconds,
+ * shares its workers between players in proportion to their weights and runs
+ * at most this many workers */
+#define PLAYER_HOST_RETRY_INTERVAL 0.005
+#define PLAYER_HOST_WEIGHT_VISIBLE 4.0
+#define PLAYER_HOST_WEIGHT_HIDDEN 1.0
+#define PLAYER_HOST_MAX_WORKERS 64
+
 #define EXTERNAL_CLOCK_MIN_FRAMES 2
 #define EXTERNAL_CLOCK_MAX_FRAMES 10
 
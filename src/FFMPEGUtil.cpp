@@ -8,6 +8,10 @@
 #include "FFMPEGUtil.h"
 #include "PacketQueue.h"
 #include "VideoState.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace ffmpeg {
     
@@ -72,6 +76,114 @@ namespace ffmpeg {
             return channel_count1 != channel_count2 || fmt1 != fmt2;
     }
     
+    /* pin the calling thread to the cpus in mask, threads it creates afterwards
+     * inherit it; the old mask is returned in previous so it can be restored */
+    int util::SetThreadAffinity(uint64_t mask, uint64_t *previous)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        int cpu, ret;
+        
+        if (previous) {
+            *previous = 0;
+            if ((ret = pthread_getaffinity_np(pthread_self(), sizeof(set), &set)))
+                return AVERROR(ret);
+            for (cpu = 0; cpu < 64; cpu++)
+                if (CPU_ISSET(cpu, &set))
+                    *previous |= UINT64_C(1) << cpu;
+        }
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < 64; cpu++)
+            if (mask & (UINT64_C(1) << cpu))
+                CPU_SET(cpu, &set);
+        if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)))
+            return AVERROR(ret);
+        return 0;
+#else
+        return AVERROR(ENOSYS);
+#endif
+    }
+    
+    int util::HasCompleteStreamInfo(AVFormatContext *s)
+    {
+        unsigned int i;
+        
+        if (!s->nb_streams)
+            return 0;
+        for (i = 0; i < s->nb_streams; i++) {
+            AVCodecParameters *par = s->streams[i]->codecpar;
+            switch (par->codec_type) {
+                case AVMEDIA_TYPE_VIDEO:
+                    if (par->codec_id == AV_CODEC_ID_NONE || par->width <= 0 || par->height <= 0)
+                        return 0;
+                    break;
+                case AVMEDIA_TYPE_AUDIO:
+                    if (par->codec_id == AV_CODEC_ID_NONE || par->sample_rate <= 0 || par->channels <= 0)
+                        return 0;
+                    break;
+                case AVMEDIA_TYPE_SUBTITLE:
+                    if (par->codec_id == AV_CODEC_ID_NONE)
+                        return 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return 1;
+    }
+    
+    int util::SameStreams(AVFormatContext *dst, AVFormatContext *src)
+    {
+        unsigned int i;
+        
+        if (dst->nb_streams != src->nb_streams)
+            return 0;
+        for (i = 0; i < dst->nb_streams; i++)
+            if (dst->streams[i]->codecpar->codec_type != src->streams[i]->codecpar->codec_type ||
+                dst->streams[i]->codecpar->codec_id != src->streams[i]->codecpar->codec_id)
+                return 0;
+        return 1;
+    }
+    
+    int util::MergeStreamInfo(AVFormatContext *dst, AVFormatContext *src)
+    {
+        unsigned int i;
+        
+        if (!SameStreams(dst, src))
+            return AVERROR_INVALIDDATA;
+        
+        for (i = 0; i < dst->nb_streams; i++) {
+            AVStream *d = dst->streams[i], *s = src->streams[i];
+            
+            if (d->codecpar->format < 0)
+                d->codecpar->format = s->codecpar->format;
+            if (!d->codecpar->bit_rate)
+                d->codecpar->bit_rate = s->codecpar->bit_rate;
+            if (!d->codecpar->sample_aspect_ratio.num)
+                d->codecpar->sample_aspect_ratio = s->codecpar->sample_aspect_ratio;
+            if (!d->codecpar->channel_layout)
+                d->codecpar->channel_layout = s->codecpar->channel_layout;
+            /* timestamps only carry over in the same time base */
+            if (av_cmp_q(d->time_base, s->time_base))
+                continue;
+            if (d->start_time == AV_NOPTS_VALUE)
+                d->start_time = s->start_time;
+            if (d->duration == AV_NOPTS_VALUE)
+                d->duration = s->duration;
+            if (!d->avg_frame_rate.num)
+                d->avg_frame_rate = s->avg_frame_rate;
+            if (!d->r_frame_rate.num)
+                d->r_frame_rate = s->r_frame_rate;
+        }
+        if (dst->start_time == AV_NOPTS_VALUE)
+            dst->start_time = src->start_time;
+        if (dst->duration == AV_NOPTS_VALUE)
+            dst->duration = src->duration;
+        if (!dst->bit_rate)
+            dst->bit_rate = src->bit_rate;
+        return 0;
+    }
+    
     int opts::check_stream_specifier(AVFormatContext *s, AVStream *st, const char *spec)
     {
         int ret = avformat_match_stream_specifier(s, st, spec);
@@ -117,8 +229,10 @@ namespace ffmpeg {
                     case  1: *p = 0; break;
                     case  0:         continue;
                     default:
-                        av_log(NULL, AV_LOG_FATAL, "stream specifier ran into a problem...");
-                        exit(1);
+                        /* the library does not exit under a host, the option is dropped */
+                        av_log(NULL, AV_LOG_ERROR, "Invalid stream specifier: %s, ignoring %s\n", p + 1, t->key);
+                        *p = ':';
+                        continue;
                 }
             
             if (av_opt_find(&cc, t->key, NULL, flags, AV_OPT_SEARCH_FAKE_OBJ) || !codec || (codec->priv_class && av_opt_find(&codec->priv_class, t->key, NULL, flags, AV_OPT_SEARCH_FAKE_OBJ)))
@@ -151,7 +265,14 @@ namespace ffmpeg {
     }
 
     int opts::getPts(){ return 0; }
-    int opts::findStreamInfo(){ return 1; }
+    static int sFindStreamInfo = 1;
+    int& opts::findStreamInfo(){ return sFindStreamInfo; }
+    static bool sFastStart = false;
+    bool& opts::fastStart(){ return sFastStart; }
+    static int64_t sProbeSize = 0;
+    int64_t& opts::probeSize(){ return sProbeSize; }
+    static int64_t sAnalyzeDuration = 0;
+    int64_t& opts::analyzeDuration(){ return sAnalyzeDuration; }
     static int64_t sStartTime = AV_NOPTS_VALUE;
     int64_t& opts::startTime(){ return sStartTime; }
     bool opts::showStatus(){ return true; }
@@ -174,6 +295,75 @@ namespace ffmpeg {
     int64_t& opts::duration(){ return sDuration; }
     int opts::framedrop(){return -1;}
     double opts::rdftspeed(){return 0.02;};
+    static int sPacketQueueMode = PacketQueue::MODE_LOCKED;
+    int& opts::packetQueueMode(){ return sPacketQueueMode; }
+    static int sVideoPictureQueueSize = VIDEO_PICTURE_QUEUE_SIZE;
+    int& opts::videoPictureQueueSize(){ return sVideoPictureQueueSize; }
+    static bool sAdaptivePictureQueue = false;
+    bool& opts::adaptivePictureQueue(){ return sAdaptivePictureQueue; }
+    static int64_t sPictureQueueMemoryLimit = PICTURE_QUEUE_MEMORY_LIMIT;
+    int64_t& opts::pictureQueueMemoryLimit(){ return sPictureQueueMemoryLimit; }
+    static opts::DecoderThreading sDecoderThreading[AVMEDIA_TYPE_NB] = {};
+    opts::DecoderThreading& opts::decoderThreading(AVMediaType type){ return sDecoderThreading[type]; }
+    static int sVideoConvertThreads = 0;
+    int& opts::videoConvertThreads(){ return sVideoConvertThreads; }
+    static bool sKeyframeScan = false;
+    bool& opts::keyframeScan(){ return sKeyframeScan; }
+    static bool sAccurateSeek = false;
+    bool& opts::accurateSeek(){ return sAccurateSeek; }
+    static bool sIndexCache = false;
+    bool& opts::indexCache(){ return sIndexCache; }
+    static int sIOMode = InputIO::MODE_AVIO;
+    int& opts::ioMode(){ return sIOMode; }
+    static int sReadAheadBlockSize = READ_AHEAD_BLOCK_SIZE;
+    int& opts::readAheadBlockSize(){ return sReadAheadBlockSize; }
+    static bool sReadAheadHints = true;
+    bool& opts::readAheadHints(){ return sReadAheadHints; }
+    static bool sReadAheadDirect = false;
+    bool& opts::readAheadDirect(){ return sReadAheadDirect; }
+    
+    int opts::Parse(int argc, char **argv, int i)
+    {
+        const char *opt = argv[i];
+        const char *arg = i + 1 < argc ? argv[i + 1] : nullptr;
+        
+        /* flags */
+        if (!strcmp(opt, "-keyframe_scan"))
+            keyframeScan() = true;
+        else if (!strcmp(opt, "-accurate_seek"))
+            accurateSeek() = true;
+        else if (!strcmp(opt, "-index_cache"))
+            indexCache() = true;
+        else if (!strcmp(opt, "-readahead_nohints"))
+            readAheadHints() = false;
+        else if (!strcmp(opt, "-direct_io"))
+            readAheadDirect() = true;
+        else if (!strcmp(opt, "-fast_start"))
+            fastStart() = true;
+        else if (!strcmp(opt, "-nofind_stream_info"))
+            findStreamInfo() = 0;
+        else if (!arg)
+            return 0;
+        else
+            goto with_value;
+        return 1;
+        
+    with_value:
+        if (!strcmp(opt, "-convert_threads"))
+            videoConvertThreads() = atoi(arg);
+        else if (!strcmp(opt, "-io"))
+            ioMode() = !strcmp(arg, "readahead") ? InputIO::MODE_READAHEAD :
+                       !strcmp(arg, "mmap") ? InputIO::MODE_MMAP : InputIO::MODE_AVIO;
+        else if (!strcmp(opt, "-readahead_block"))
+            readAheadBlockSize() = atoi(arg);
+        else if (!strcmp(opt, "-probesize"))
+            probeSize() = strtoll(arg, NULL, 10);
+        else if (!strcmp(opt, "-analyzeduration"))
+            analyzeDuration() = strtoll(arg, NULL, 10);
+        else
+            return 0;
+        return 2;
+    }
 
 
 }// end namespace
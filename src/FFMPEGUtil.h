@@ -41,16 +41,37 @@ namespace ffmpeg {
         int ComputeMod(int a, int b);
         int64_t GetValidChannelLayout(int64_t channel_layout, int channels);
         int CompareAudioFormats(AVSampleFormat fmt1, int64_t channel_count1, AVSampleFormat fmt2, int64_t channel_count2);
+        int SetThreadAffinity(uint64_t mask, uint64_t *previous);
+        /* true when the container header gave every stream what opening it needs */
+        int HasCompleteStreamInfo(AVFormatContext *s);
+        /* true when src, another open of the same file, has the streams of dst */
+        int SameStreams(AVFormatContext *dst, AVFormatContext *src);
+        /* fills in what dst left unset from src, an open of the same file that was
+         * probed; AVERROR_INVALIDDATA if their streams differ. Only while no other
+         * thread uses dst */
+        int MergeStreamInfo(AVFormatContext *dst, AVFormatContext *src);
         
     }//end namespace ffmpeg::util
     
     namespace opts {
         
+        struct DecoderThreading {
+            enum Type {
+                TYPE_AUTO = 0, TYPE_FRAME, TYPE_SLICE
+            };
+            int count;          /* number of decoder threads, 0 lets the decoder pick */
+            Type type;
+            uint64_t affinity;  /* cpu mask for the decoder threads, 0 leaves it alone */
+        };
+        
         int check_stream_specifier(AVFormatContext *s, AVStream *st, const char *spec);
         AVDictionary *filter_codec_opts(AVDictionary *opts, enum AVCodecID codec_id, AVFormatContext *s, AVStream *st, AVCodec *codec);
         AVDictionary **setup_find_stream_info_opts(AVFormatContext *s, AVDictionary *codec_opts);
         int getPts();
-        int findStreamInfo();
+        int& findStreamInfo();
+        bool& fastStart();
+        int64_t& probeSize();
+        int64_t& analyzeDuration();
         int64_t& startTime();
         bool showStatus();
         static const char* wantedStreamSpec[AVMEDIA_TYPE_NB] = {0};
@@ -67,6 +88,23 @@ namespace ffmpeg {
         int64_t& duration();
         int framedrop();
         double rdftspeed();
+        int& packetQueueMode();
+        int& videoPictureQueueSize();
+        bool& adaptivePictureQueue();
+        int64_t& pictureQueueMemoryLimit();
+        DecoderThreading& decoderThreading(AVMediaType type);
+        int& videoConvertThreads();
+        bool& keyframeScan();
+        bool& accurateSeek();
+        bool& indexCache();
+        int& ioMode();
+        int& readAheadBlockSize();
+        bool& readAheadHints();
+        bool& readAheadDirect();
+        
+        /* sets the option at argv[i] and returns the number of arguments it took,
+         * 0 when argv[i] is not a player option */
+        int Parse(int argc, char **argv, int i);
 
         
     }//end namespace opts
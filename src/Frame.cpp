@@ -17,7 +17,9 @@ width(0),
 height(0),
 format(0),
 uploaded(0),
-vflip(0)
+vflip(0),
+texture(-1),
+sequence(0)
 {}
 
 
@@ -27,6 +27,8 @@ struct Frame {
     AVRational sar;
     int uploaded;
     int vflip;
+    int texture;          /* slot of the video texture ring it was uploaded to */
+    int64_t sequence;     /* order in which pictures were queued */
 };
 
 }// end namespace ffmpeg
@@ -0,0 +1,247 @@
+//
+//  FrameConverter.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "FrameConverter.h"
+#include "SDLUtil.h"
+
+extern "C" {
+#include "libavutil/avutil.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+}
+
+namespace ffmpeg {
+
+FrameConverter::FrameConverter():
+mThreadCount(0),
+mBandCount(0),
+mBandHeight(0),
+mSource(nullptr),
+mDestination(nullptr),
+mPool(nullptr),
+mPoolSize(0),
+mJob(0),
+mPending(0),
+mStop(0),
+mMutex(nullptr),
+mJobCond(nullptr),
+mDoneCond(nullptr)
+{
+    int i;
+    for (i = 0; i < VIDEO_CONVERT_MAX_THREADS; i++) {
+        mBands[i].owner = this;
+        mBands[i].index = i;
+        mBands[i].thread = nullptr;
+        mBands[i].ctx = nullptr;
+        mBands[i].scratch = nullptr;
+        mBands[i].scratchSize = 0;
+        mBands[i].ret = 0;
+    }
+}
+
+FrameConverter::~FrameConverter()
+{
+    destroy();
+}
+
+int FrameConverter::init(int nb_threads)
+{
+    int i;
+    
+    if (!(mMutex = SDL_CreateMutex())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    if (!(mJobCond = SDL_CreateCond()) || !(mDoneCond = SDL_CreateCond())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    if (nb_threads <= 0)
+        nb_threads = SDL_GetCPUCount();
+    mThreadCount = av_clip(nb_threads, 1, VIDEO_CONVERT_MAX_THREADS);
+    mStop = 0;
+    
+    for (i = 1; i < mThreadCount; i++) {
+        if (!(mBands[i].thread = SDL_CreateThread(&FrameConverter::WorkerThread, "FrameConverter", (void*)&mBands[i]))) {
+            /* carry on with the workers we got */
+            av_log(NULL, AV_LOG_WARNING, "SDL_CreateThread(): %s\n", SDL_GetError());
+            mThreadCount = i;
+            break;
+        }
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Converting pictures with %d threads\n", mThreadCount);
+    return 0;
+}
+
+void FrameConverter::destroy()
+{
+    int i;
+    
+    if (mMutex) {
+        sdl::ScopedLock lock(mMutex);
+        mStop = 1;
+        SDL_CondBroadcast(mJobCond);
+    }
+    for (i = 0; i < VIDEO_CONVERT_MAX_THREADS; i++) {
+        if (mBands[i].thread) {
+            SDL_WaitThread(mBands[i].thread, NULL);
+            mBands[i].thread = nullptr;
+        }
+        sws_freeContext(mBands[i].ctx);
+        mBands[i].ctx = nullptr;
+        av_freep(&mBands[i].scratch);
+        mBands[i].scratchSize = 0;
+    }
+    mThreadCount = 0;
+    /* buffers still referenced by queued pictures keep the pool alive until they are freed */
+    av_buffer_pool_uninit(&mPool);
+    mPoolSize = 0;
+    SDL_DestroyCond(mJobCond);
+    SDL_DestroyCond(mDoneCond);
+    SDL_DestroyMutex(mMutex);
+    mJobCond = mDoneCond = nullptr;
+    mMutex = nullptr;
+}
+
+int FrameConverter::WorkerThread(void *arg)
+{
+    Band *band = (Band*)arg;
+    FrameConverter *converter = band->owner;
+    int job = 0;
+    
+    for (;;) {
+        {
+            sdl::ScopedLock lock(converter->mMutex);
+            while (!converter->mStop && converter->mJob == job)
+                SDL_CondWait(converter->mJobCond, converter->mMutex);
+            if (converter->mStop)
+                break;
+            job = converter->mJob;
+            if (band->index >= converter->mBandCount)
+                continue;
+        }
+        band->ret = converter->convertBand(band);
+        {
+            sdl::ScopedLock lock(converter->mMutex);
+            if (!--converter->mPending)
+                SDL_CondSignal(converter->mDoneCond);
+        }
+    }
+    return 0;
+}
+
+/* every band is converted as a picture of its own, with VIDEO_CONVERT_BAND_OVERLAP
+ * lines of its neighbours above and below it so the vertical chroma filter does
+ * not stop at its edges. Nothing is scaled vertically, the output lines map one to
+ * one to the input ones and those of the overlap are dropped */
+int FrameConverter::convertBand(Band *band)
+{
+    const AVFrame *src = mSource;
+    AVFrame *dst = mDestination;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    int nb_planes = av_pix_fmt_count_planes((AVPixelFormat)src->format);
+    int overlap = FFALIGN(VIDEO_CONVERT_BAND_OVERLAP, 1 << desc->log2_chroma_h);
+    int y = band->index * mBandHeight;
+    int h = FFMIN(mBandHeight, src->height - y);
+    int top, bottom, window;
+    const uint8_t *src_data[4] = {0};
+    uint8_t *dst_data[4] = {0};
+    int dst_linesize[4] = {0};
+    int i;
+    
+    if (h <= 0)
+        return 0;
+    top = FFMIN(overlap, y);
+    bottom = FFMIN(overlap, src->height - y - h);
+    window = top + h + bottom;
+    band->ctx = sws_getCachedContext(band->ctx,
+                                     src->width, window, (AVPixelFormat)src->format, dst->width, window,
+                                     (AVPixelFormat)dst->format, SWS_BICUBIC, NULL, NULL, NULL);
+    if (!band->ctx) {
+        av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
+        return AVERROR(EINVAL);
+    }
+    for (i = 0; i < 4; i++) {
+        src_data[i] = src->data[i];
+        /* a palette is not a plane to move down, top is a whole number of chroma lines */
+        if (i < nb_planes)
+            src_data[i] += (ptrdiff_t)((y - top) >> (i == 1 || i == 2 ? desc->log2_chroma_h : 0)) * src->linesize[i];
+    }
+    /* a single band has no neighbours, it goes straight to dst */
+    if (!top && !bottom) {
+        dst_data[0] = dst->data[0] + (ptrdiff_t)y * dst->linesize[0];
+        sws_scale(band->ctx, src_data, src->linesize, 0, h, dst_data, dst->linesize);
+        return 0;
+    }
+    /* the overlap would land on the lines of the neighbouring bands */
+    av_fast_malloc(&band->scratch, &band->scratchSize, (size_t)dst->linesize[0] * window);
+    if (!band->scratch)
+        return AVERROR(ENOMEM);
+    dst_data[0] = band->scratch;
+    dst_linesize[0] = dst->linesize[0];
+    sws_scale(band->ctx, src_data, src->linesize, 0, window, dst_data, dst_linesize);
+    av_image_copy_plane(dst->data[0] + (ptrdiff_t)y * dst->linesize[0], dst->linesize[0],
+                        band->scratch + (ptrdiff_t)top * dst_linesize[0], dst_linesize[0],
+                        av_image_get_linesize((AVPixelFormat)dst->format, dst->width, 0), h);
+    return 0;
+}
+
+int FrameConverter::convert(AVFrame *dst, const AVFrame *src, AVPixelFormat dst_format)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)src->format);
+    int linesize, size, bands, ret, i;
+    
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || av_pix_fmt_count_planes(dst_format) != 1 || !mThreadCount)
+        return AVERROR(EINVAL);
+    
+    linesize = FFALIGN(av_image_get_linesize(dst_format, src->width, 0), 32);
+    size = linesize * src->height;
+    if (!mPool || size != mPoolSize) {
+        av_buffer_pool_uninit(&mPool);
+        if (!(mPool = av_buffer_pool_init(size, NULL)))
+            return AVERROR(ENOMEM);
+        mPoolSize = size;
+    }
+    av_frame_unref(dst);
+    if (!(dst->buf[0] = av_buffer_pool_get(mPool)))
+        return AVERROR(ENOMEM);
+    dst->data[0] = dst->buf[0]->data;
+    dst->linesize[0] = linesize;
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->format = dst_format;
+    if ((ret = av_frame_copy_props(dst, src)) < 0)
+        return ret;
+    
+    /* bands start on a chroma line */
+    bands = av_clip(src->height / VIDEO_CONVERT_MIN_BAND_HEIGHT, 1, mThreadCount);
+    mBandHeight = FFALIGN((src->height + bands - 1) / bands, 1 << desc->log2_chroma_h);
+    mSource = src;
+    mDestination = dst;
+    if (bands > 1) {
+        sdl::ScopedLock lock(mMutex);
+        mBandCount = bands;
+        mPending = bands - 1;
+        mJob++;
+        SDL_CondBroadcast(mJobCond);
+    }
+    
+    ret = convertBand(&mBands[0]);
+    
+    if (bands > 1) {
+        sdl::ScopedLock lock(mMutex);
+        while (mPending)
+            SDL_CondWait(mDoneCond, mMutex);
+        for (i = 1; i < bands; i++)
+            if (mBands[i].ret < 0)
+                ret = mBands[i].ret;
+    }
+    return ret;
+}
+
+}//end namespace ffmpeg
@@ -0,0 +1,76 @@
+//
+//  FrameConverter.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include "Definitions.h"
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/buffer.h"
+#include "libswscale/swscale.h"
+}
+
+namespace ffmpeg {
+
+/* converts whole frames to another pixel format of the same size, split into
+ * horizontal bands that a pool of workers convert in parallel, each with its own
+ * SwsContext treating its band as a picture of its own. The calling thread
+ * converts the first band itself, so one thread means no workers at all */
+class FrameConverter {
+public:
+    
+    FrameConverter();
+    ~FrameConverter();
+    
+    /* nb_threads 0 picks one per cpu up to VIDEO_CONVERT_MAX_THREADS */
+    int init(int nb_threads);
+    void destroy();
+    
+    /* dst gets a pooled buffer and src's properties */
+    int convert(AVFrame *dst, const AVFrame *src, AVPixelFormat dst_format);
+    
+    inline int getThreadCount()const{return mThreadCount;}
+
+private:
+    
+    struct Band {
+        FrameConverter *owner;
+        int index;
+        SDL_Thread *thread;
+        struct SwsContext *ctx;
+        uint8_t *scratch;       /* the band with its overlap, before the overlap is dropped */
+        unsigned int scratchSize;
+        int ret;
+    };
+    
+    static int WorkerThread(void *arg);
+    int convertBand(Band *band);
+    
+    Band mBands[VIDEO_CONVERT_MAX_THREADS];
+    int mThreadCount;
+    int mBandCount;         /* bands of the current job, fewer than threads for small pictures */
+    int mBandHeight;
+    
+    /* the current job */
+    const AVFrame *mSource;
+    AVFrame *mDestination;
+    
+    AVBufferPool *mPool;
+    int mPoolSize;
+    
+    int mJob;               /* bumped for every frame, workers wait for it to change */
+    int mPending;           /* bands of the job still being converted by workers */
+    int mStop;
+    SDL_mutex *mMutex;
+    SDL_cond *mJobCond;
+    SDL_cond *mDoneCond;
+};
+
+}//end namespace ffmpeg
@@ -8,6 +8,8 @@
 #include "FrameQueue.h"
 #include "PacketQueue.h"
 #include "SDLUtil.h"
+#include "Trace.h"
+#include <new>
 
 namespace ffmpeg {
 
@@ -18,31 +20,38 @@ void FrameQueue::UnrefItem(Frame *f)
 }
 
 FrameQueue::FrameQueue():
+mQueue(nullptr),
+mCapacity(0),
 mRIndex(0),
 mWIndex(0),
 mSize(0),
 mMaxSize(0),
 mKeepLast(0),
 mRIndexShown(0),
+mWaiters(0),
 mMutex(nullptr),
 mCondVar(nullptr),
-mPacketQueue(nullptr)
+mPacketQueue(nullptr),
+mStreamIndex(-1)
 {
 }
 
 FrameQueue::~FrameQueue()
 {
     int i;
-    for (i = 0; i < mMaxSize; i++) {
+    for (i = 0; i < mCapacity; i++) {
         Frame *vp = &mQueue[i];
         UnrefItem(vp);
         av_frame_free(&vp->frame);
     }
+    delete [] mQueue;
     SDL_DestroyMutex(mMutex);
     SDL_DestroyCond(mCondVar);
 }
 
-int FrameQueue::init(PacketQueue *pktq, int max_size, int keep_last)
+/* capacity is the number of slots allocated, max_size how many of them
+ * may be filled; it can later be changed with resize() up to capacity */
+int FrameQueue::init(PacketQueue *pktq, int max_size, int keep_last, int capacity)
 {
     int i;
     if (!(mMutex = SDL_CreateMutex())) {
@@ -54,14 +63,27 @@ int FrameQueue::init(PacketQueue *pktq, int max_size, int keep_last)
         return AVERROR(ENOMEM);
     }
     mPacketQueue = pktq;
-    mMaxSize = FFMIN(max_size, FRAME_QUEUE_SIZE);
+    mCapacity = av_clip(FFMAX(capacity, max_size), 1, FRAME_QUEUE_MAX_SIZE);
+    mMaxSize = av_clip(max_size, 1, mCapacity);
     mKeepLast = !!keep_last;
-    for (i = 0; i < mMaxSize; i++)
+    if (!(mQueue = new (std::nothrow) Frame[mCapacity]))
+        return AVERROR(ENOMEM);
+    for (i = 0; i < mCapacity; i++)
         if (!(mQueue[i].frame = av_frame_alloc()))
             return AVERROR(ENOMEM);
     return 0;
 }
 
+/* change how many frames the queue may hold, frames already queued are kept
+ * even if there are more of them than the new size, the writer just waits */
+int FrameQueue::resize(int max_size)
+{
+    sdl::ScopedLock lock(mMutex);
+    mMaxSize = av_clip(max_size, 1 + mKeepLast, mCapacity);
+    SDL_CondSignal(mCondVar);
+    return mMaxSize;
+}
+
 void FrameQueue::signal()
 {
     sdl::ScopedLock lock(mMutex);
@@ -70,91 +92,117 @@ void FrameQueue::signal()
 
 Frame* FrameQueue::peek()
 {
-    return &mQueue[(mRIndex + mRIndexShown) % mMaxSize];
+    return &mQueue[(mRIndex.load(std::memory_order_relaxed) + mRIndexShown.load(std::memory_order_relaxed)) % mCapacity];
 }
 
 Frame* FrameQueue::peekNext()
 {
-    return &mQueue[(mRIndex + mRIndexShown + 1) % mMaxSize];
+    return &mQueue[(mRIndex.load(std::memory_order_relaxed) + mRIndexShown.load(std::memory_order_relaxed) + 1) % mCapacity];
+}
+
+/* the offset-th readable frame after peek(), NULL if there are not that many */
+Frame* FrameQueue::peekAhead(int offset)
+{
+    if (offset >= numRemaining())
+        return nullptr;
+    return &mQueue[(mRIndex.load(std::memory_order_relaxed) + mRIndexShown.load(std::memory_order_relaxed) + offset) % mCapacity];
 }
 
 Frame* FrameQueue::peekLast()
 {
-    return &mQueue[mRIndex];
+    return &mQueue[mRIndex.load(std::memory_order_relaxed)];
 }
 
-Frame* FrameQueue::peekWriteable()
+Frame* FrameQueue::peekWriteable(bool block)
 {
-    {
+    if (mSize.load(std::memory_order_acquire) >= mMaxSize.load(std::memory_order_relaxed)) {
+        if (!block)
+            return nullptr;
         /* wait until we have space to put a new frame */
         sdl::ScopedLock lock(mMutex);
+        mWaiters++;
         while (mSize >= mMaxSize &&
                !mPacketQueue->getAbortRequest()) {
             SDL_CondWait(mCondVar, mMutex);
         }
+        mWaiters--;
     }
     
     if (mPacketQueue->getAbortRequest())
         return nullptr;
     
-    return &mQueue[mWIndex];
+    return &mQueue[mWIndex.load(std::memory_order_relaxed)];
 }
 
 Frame* FrameQueue::peekReadable()
 {
-    {
+    if (mSize.load(std::memory_order_acquire) - mRIndexShown.load(std::memory_order_relaxed) <= 0) {
         /* wait until we have a readable a new frame */
         sdl::ScopedLock lock(mMutex);
+        mWaiters++;
         while ((mSize - mRIndexShown) <= 0 &&
                !mPacketQueue->getAbortRequest()) {
             SDL_CondWait(mCondVar, mMutex);
         }
+        mWaiters--;
     }
     
     if (mPacketQueue->getAbortRequest())
         return NULL;
     
-    return &mQueue[(mRIndex + mRIndexShown) % mMaxSize];
+    return peek();
 }
 
-void FrameQueue::push()
+/* the seq_cst update of mSize before reading mWaiters pairs with the waiter
+ * incrementing mWaiters before re-checking mSize, so a wakeup is never lost */
+void FrameQueue::wakeWaiters()
 {
-    if (++mWIndex == mMaxSize)
-        mWIndex = 0;
-    {
+    if (mWaiters) {
         sdl::ScopedLock lock(mMutex);
-        mSize++;
         SDL_CondSignal(mCondVar);
     }
 }
 
+void FrameQueue::push()
+{
+    int64_t start = trace::Begin();
+    int64_t pts = mQueue[mWIndex.load(std::memory_order_relaxed)].frame->pts;
+    int windex = mWIndex.load(std::memory_order_relaxed) + 1;
+    if (windex == mCapacity)
+        windex = 0;
+    mWIndex.store(windex, std::memory_order_relaxed);
+    mSize++;
+    wakeWaiters();
+    trace::Record(trace::STAGE_FRAME_PUSH, start, mStreamIndex, pts);
+}
+
 void FrameQueue::next()
 {
-    if (mKeepLast && !mRIndexShown) {
+    int rindex;
+    if (mKeepLast && !mRIndexShown.load(std::memory_order_relaxed)) {
         mRIndexShown = 1;
         return;
     }
-    UnrefItem(&mQueue[mRIndex]);
-    if (++mRIndex == mMaxSize){
-        mRIndex = 0;
-    }
-    {
-        sdl::ScopedLock lock(mMutex);
-        mSize--;
-        SDL_CondSignal(mCondVar);
+    rindex = mRIndex.load(std::memory_order_relaxed);
+    UnrefItem(&mQueue[rindex]);
+    if (++rindex == mCapacity){
+        rindex = 0;
     }
+    mRIndex.store(rindex, std::memory_order_release);
+    mSize--;
+    wakeWaiters();
 }
 
 /* return the number of undisplayed frames in the queue */
 int FrameQueue::numRemaining()const
 {
-    return mSize - mRIndexShown;
+    return mSize.load(std::memory_order_acquire) - mRIndexShown.load(std::memory_order_relaxed);
 }
 
 /* return last shown position */
 int64_t FrameQueue::lastShownPosition()const
 {
-    const Frame* fp = &mQueue[mRIndex];
+    const Frame* fp = &mQueue[mRIndex.load(std::memory_order_acquire)];
     if (mRIndexShown && fp->serial == mPacketQueue->getSerial())
         return fp->position;
     else
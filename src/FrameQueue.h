@@ -11,6 +11,7 @@
 #include "Definitions.h"
 #include <SDL.h>
 #include <SDL_thread.h>
+#include <atomic>
 
 namespace ffmpeg {
 
@@ -22,33 +23,49 @@ public:
     FrameQueue();
     ~FrameQueue();
     
-    int init( PacketQueue *pktq, int max_size, int keep_last);
+    int init( PacketQueue *pktq, int max_size, int keep_last, int capacity = 0);
+    int resize(int max_size);
     void signal();
     Frame* peek();
     Frame* peekNext();
+    Frame* peekAhead(int offset);
     Frame* peekLast();
-    Frame* peekWriteable();
+    /* NULL once aborted, or without block while the queue is full */
+    Frame* peekWriteable(bool block = true);
     Frame* peekReadable();
     void push();
     void next();
     int numRemaining()const;
     int64_t lastShownPosition()const;
     SDL_mutex* getMutex(){return mMutex;}
-    inline int getRIndexShown(){return mRIndexShown;}
+    inline int getRIndexShown(){return mRIndexShown.load(std::memory_order_relaxed);}
+    /* peekWriteable() would not wait, as long as the size is not lowered meanwhile */
+    inline bool canWrite()const{return mSize.load(std::memory_order_acquire) < mMaxSize.load(std::memory_order_relaxed);}
+    inline int getMaxSize()const{return mMaxSize;}
+    inline int getCapacity()const{return mCapacity;}
+    inline void setStreamIndex(int stream){mStreamIndex = stream;}
     
     static void UnrefItem(Frame* f);
     
 private:
-    Frame mQueue[FRAME_QUEUE_SIZE];
-    int mRIndex;
-    int mWIndex;
-    int mSize;
-    int mMaxSize;
+    void wakeWaiters();
+    
+    /* mRIndex/mRIndexShown are only written by the reader and mWIndex only by the
+     * writer, mSize hands frames over between the two (release on push/next, acquire
+     * on peek); the mutex is only taken to sleep when the queue is empty or full */
+    Frame *mQueue;
+    int mCapacity;
+    std::atomic<int> mRIndex;
+    std::atomic<int> mWIndex;
+    std::atomic<int> mSize;
+    std::atomic<int> mMaxSize;
     int mKeepLast;
-    int mRIndexShown;
+    std::atomic<int> mRIndexShown;
+    std::atomic<int> mWaiters;  /* threads waiting (or about to wait) on mCondVar */
     SDL_mutex *mMutex;
     SDL_cond *mCondVar;
     PacketQueue *mPacketQueue;
+    int mStreamIndex;           /* only used to tag trace events */
 };
 
 }//end namespace ffmpeg
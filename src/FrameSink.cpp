@@ -0,0 +1,168 @@
+//
+//  FrameSink.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "FrameSink.h"
+#include "SDLUtil.h"
+#include <new>
+
+extern "C" {
+#include "libavutil/common.h"
+}
+
+namespace ffmpeg {
+
+FrameSinkQueue::FrameSinkQueue(FrameSink *sink, AVMediaType type, FrameSink::Tap tap, int size):
+mSink(sink),
+mType(type),
+mTap(tap),
+mItems(nullptr),
+mSize(av_clip(size, 1, FRAME_QUEUE_MAX_SIZE)),
+mRIndex(0),
+mCount(0),
+mLastSerial(-1),
+mAbort(0),
+mMutex(nullptr),
+mCond(nullptr),
+mThread(nullptr),
+mDelivered(0),
+mDropped(0)
+{
+}
+
+FrameSinkQueue::~FrameSinkQueue()
+{
+    int i;
+    stop();
+    if (mItems) {
+        for (i = 0; i < mSize; i++)
+            av_frame_free(&mItems[i].frame);
+        delete[] mItems;
+    }
+    SDL_DestroyCond(mCond);
+    SDL_DestroyMutex(mMutex);
+}
+
+int FrameSinkQueue::start()
+{
+    int i;
+    
+    if (!(mItems = new (std::nothrow) Item[mSize]()))
+        return AVERROR(ENOMEM);
+    for (i = 0; i < mSize; i++)
+        if (!(mItems[i].frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+    if (!(mMutex = SDL_CreateMutex()) || !(mCond = SDL_CreateCond())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex/Cond(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    if (!(mThread = SDL_CreateThread(&FrameSinkQueue::DeliveryThread, "FrameSink", (void*)this))) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void FrameSinkQueue::stop()
+{
+    if (!mThread)
+        return;
+    {
+        sdl::ScopedLock lock(mMutex);
+        mAbort = 1;
+        dropQueued(-1);
+        SDL_CondSignal(mCond);
+    }
+    SDL_WaitThread(mThread, NULL);
+    mThread = nullptr;
+    mSink->onEnd();
+}
+
+/* with the mutex held, returns how many frames it dropped */
+int FrameSinkQueue::dropQueued(int serial)
+{
+    int dropped = 0;
+    while (mCount > 0) {
+        Item *item = &mItems[mRIndex];
+        if (item->info.serial == serial)
+            break;
+        av_frame_unref(item->frame);
+        mRIndex = (mRIndex + 1) % mSize;
+        mCount--;
+        mDropped++;
+        dropped++;
+    }
+    return dropped;
+}
+
+int FrameSinkQueue::put(AVFrame *frame, const FrameSink::Info& info)
+{
+    Item *item;
+    int dropped = 0, ret;
+    
+    sdl::ScopedLock lock(mMutex);
+    if (mAbort)
+        return AVERROR_EXIT;
+    /* after a seek what is left of the old serial is of no use to the sink */
+    if (info.serial != mLastSerial) {
+        dropped = dropQueued(info.serial);
+        mLastSerial = info.serial;
+    }
+    if (mCount == mSize) {
+        av_frame_unref(mItems[mRIndex].frame);
+        mRIndex = (mRIndex + 1) % mSize;
+        mCount--;
+        mDropped++;
+        dropped++;
+    }
+    item = &mItems[(mRIndex + mCount) % mSize];
+    if ((ret = av_frame_ref(item->frame, frame)) < 0)
+        return ret;
+    item->info = info;
+    mCount++;
+    SDL_CondSignal(mCond);
+    return dropped;
+}
+
+int FrameSinkQueue::DeliveryThread(void *arg)
+{
+    return ((FrameSinkQueue*)arg)->deliver();
+}
+
+int FrameSinkQueue::deliver()
+{
+    AVFrame *frame = av_frame_alloc();
+    FrameSink::Info info;
+    int serial = -1;
+    
+    if (!frame)
+        return AVERROR(ENOMEM);
+    for (;;) {
+        {
+            sdl::ScopedLock lock(mMutex);
+            while (!mAbort && !mCount)
+                SDL_CondWait(mCond, mMutex);
+            if (mAbort)
+                break;
+            /* the sink runs without the mutex, put() only ever waits for this move */
+            av_frame_move_ref(frame, mItems[mRIndex].frame);
+            info = mItems[mRIndex].info;
+            mRIndex = (mRIndex + 1) % mSize;
+            mCount--;
+        }
+        if (info.serial != serial) {
+            serial = info.serial;
+            mSink->onSerial(serial);
+        }
+        mSink->onFrame(frame, info);
+        av_frame_unref(frame);
+        mDelivered++;
+    }
+    av_frame_free(&frame);
+    return 0;
+}
+
+}//end namespace ffmpeg
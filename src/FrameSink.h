@@ -0,0 +1,102 @@
+//
+//  FrameSink.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <atomic>
+#include "Definitions.h"
+
+namespace ffmpeg {
+
+/* a consumer of a playing stream's decoded frames besides the display and the
+ * audio device, attached with VideoState::addFrameSink. It sees the frames the
+ * decoders produce, references to them and not copies, on a thread of its own */
+class FrameSink {
+public:
+    
+    enum Tap {
+        TAP_DECODED,            /* every frame as it leaves the decoder */
+        TAP_DISPLAYED           /* video only, the pictures the refresh shows when their time comes, headless every picture consumed */
+    };
+    
+    struct Info {
+        AVMediaType type;
+        int streamIndex;
+        AVRational timeBase;    /* of frame->pts */
+        double pts;             /* seconds, NAN if unknown */
+        double duration;        /* seconds, 0 if unknown */
+        int64_t position;       /* byte position of the frame in the input, -1 if unknown */
+        int serial;             /* packet serial, a new one starts with each seek */
+        int syncType;           /* the AV_SYNC_* the master clock follows */
+        double masterClock;     /* seconds when the frame was decoded, NAN until playback runs */
+    };
+    
+    virtual ~FrameSink(){}
+    
+    /* frame is only valid during the call, av_frame_ref() it to keep it */
+    virtual void onFrame(AVFrame *frame, const Info& info) = 0;
+    /* called before the first frame of a new serial, frames of older serials
+     * that were still queued for the sink were dropped */
+    virtual void onSerial(int serial){}
+    /* no frames follow, the sink was removed or the stream closed */
+    virtual void onEnd(){}
+};
+
+/* the queue between the decoder threads and one sink. put() never waits: when
+ * the sink falls behind its oldest frame is dropped, so a slow sink can only
+ * lose frames, never hold up decoding or the display */
+class FrameSinkQueue {
+public:
+    
+    FrameSinkQueue(FrameSink *sink, AVMediaType type, FrameSink::Tap tap, int size);
+    ~FrameSinkQueue();
+    
+    int start();
+    /* drops what is queued, waits for the sink to return and ends it */
+    void stop();
+    /* returns the number of frames it dropped to make room */
+    int put(AVFrame *frame, const FrameSink::Info& info);
+    
+    inline FrameSink* getSink()const{return mSink;}
+    inline AVMediaType getType()const{return mType;}
+    inline FrameSink::Tap getTap()const{return mTap;}
+    inline int64_t getDelivered()const{return mDelivered;}
+    inline int64_t getDropped()const{return mDropped;}
+
+private:
+    
+    struct Item {
+        AVFrame *frame;
+        FrameSink::Info info;
+    };
+    
+    static int DeliveryThread(void *arg);
+    int deliver();
+    int dropQueued(int serial);
+    
+    FrameSink *mSink;
+    AVMediaType mType;
+    FrameSink::Tap mTap;
+    Item *mItems;
+    int mSize;
+    int mRIndex;
+    int mCount;
+    int mLastSerial;            /* of the frames put, older ones are dropped */
+    int mAbort;
+    SDL_mutex *mMutex;
+    SDL_cond *mCond;
+    SDL_Thread *mThread;
+    std::atomic<int64_t> mDelivered;
+    std::atomic<int64_t> mDropped;
+};
+
+}//end namespace ffmpeg
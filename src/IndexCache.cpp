@@ -0,0 +1,343 @@
+//
+//  IndexCache.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "IndexCache.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+#define INDEX_CACHE_MAGIC "FFPIDX\0"
+#define INDEX_CACHE_VERSION 1
+#define INDEX_CACHE_SUFFIX ".ffpidx"
+
+namespace ffmpeg {
+
+/* all records are 8 byte aligned and in host byte order, a cache written on a
+ * machine of the other endianness fails the version check */
+struct IndexCache::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int64_t fileSize;           /* of the media, with its mtime the key of the cache */
+    int64_t fileMtime;
+    int64_t startTime;          /* AV_TIME_BASE */
+    int64_t duration;
+    int64_t bitRate;
+    int32_t nbStreams;
+    int32_t keyframeStream;     /* the stream the keyframes belong to, -1 for none */
+    int32_t nbKeyframes;
+    uint32_t pathSize;
+    uint64_t streamsOffset;
+    uint64_t keyframesOffset;
+    uint64_t pathOffset;
+};
+
+struct IndexCache::StreamRecord {
+    int32_t codecType;
+    int32_t codecId;
+    int32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t sampleRate;
+    int32_t channels;
+    int32_t pad;
+    uint64_t channelLayout;
+    int64_t bitRate;
+    int64_t startTime;          /* stream time base */
+    int64_t duration;
+    AVRational timeBase;
+    AVRational sampleAspectRatio;
+    AVRational avgFrameRate;
+    AVRational realFrameRate;
+};
+
+static inline uint64_t Align8(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+IndexCache::IndexCache():
+mData(nullptr),
+mSize(0),
+mHeader(nullptr),
+mLoadedKeyframes(-1),
+mValid(false)
+{
+}
+
+IndexCache::~IndexCache()
+{
+    close();
+}
+
+std::string IndexCache::CachePath(const std::string& filename)
+{
+    return filename + INDEX_CACHE_SUFFIX;
+}
+
+int IndexCache::StatFile(const std::string& filename, int64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    
+    if (stat(filename.c_str(), &st) < 0)
+        return AVERROR(errno);
+    if (!S_ISREG(st.st_mode))
+        return AVERROR(EINVAL);
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return 0;
+}
+
+int IndexCache::open(const std::string& filename)
+{
+    std::string path = CachePath(filename);
+    const Header *h;
+    int64_t file_size, file_mtime;
+    int ret;
+    
+    close();
+    mLoadedKeyframes = -1;
+    mValid = false;
+    /* urls and devices have nothing to key a cache on */
+    if ((ret = StatFile(filename, &file_size, &file_mtime)) < 0)
+        return ret;
+
+#ifndef _WIN32
+    {
+        struct stat st;
+        void *data;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        
+        if (fd < 0)
+            return AVERROR(errno);
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Header)) {
+            ::close(fd);
+            return AVERROR_INVALIDDATA;
+        }
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return AVERROR(errno);
+        mData = (const uint8_t*)data;
+        mSize = st.st_size;
+    }
+#else
+    {
+        FILE *f = fopen(path.c_str(), "rb");
+        uint8_t *data;
+        long size;
+        
+        if (!f)
+            return AVERROR(errno);
+        if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < (long)sizeof(Header) || fseek(f, 0, SEEK_SET) < 0 ||
+            !(data = (uint8_t*)av_malloc(size)) || fread(data, 1, size, f) != (size_t)size) {
+            fclose(f);
+            return AVERROR_INVALIDDATA;
+        }
+        fclose(f);
+        mData = data;
+        mSize = size;
+    }
+#endif
+
+    h = (const Header*)mData;
+    if (memcmp(h->magic, INDEX_CACHE_MAGIC, sizeof(h->magic)) || h->version != INDEX_CACHE_VERSION || h->headerSize != sizeof(Header) ||
+        h->nbStreams < 0 || h->nbKeyframes < 0 ||
+        h->streamsOffset + (uint64_t)h->nbStreams * sizeof(StreamRecord) > mSize ||
+        h->keyframesOffset + (uint64_t)h->nbKeyframes * sizeof(KeyframeIndex::Entry) > mSize ||
+        h->pathOffset + h->pathSize > mSize ||
+        (h->streamsOffset | h->keyframesOffset) & 7) {
+        av_log(NULL, AV_LOG_WARNING, "%s: not a usable index cache\n", path.c_str());
+        close();
+        return AVERROR_INVALIDDATA;
+    }
+    if (h->fileSize != file_size || h->fileMtime != file_mtime ||
+        h->pathSize != filename.size() || memcmp(mData + h->pathOffset, filename.data(), h->pathSize)) {
+        av_log(NULL, AV_LOG_VERBOSE, "%s: index cache is stale\n", path.c_str());
+        close();
+        return AVERROR_INVALIDDATA;
+    }
+    mHeader = h;
+    return 0;
+}
+
+void IndexCache::close()
+{
+    if (mData) {
+#ifndef _WIN32
+        munmap((void*)mData, mSize);
+#else
+        av_free((void*)mData);
+#endif
+    }
+    mData = nullptr;
+    mSize = 0;
+    mHeader = nullptr;
+}
+
+int IndexCache::applyStreamInfo(AVFormatContext *ic)
+{
+    const StreamRecord *records;
+    unsigned int i;
+    
+    if (!mHeader || ic->nb_streams != (unsigned int)mHeader->nbStreams)
+        return 0;
+    records = (const StreamRecord*)(mData + mHeader->streamsOffset);
+    /* streams found at runtime, as in mpegts, may come in another order */
+    for (i = 0; i < ic->nb_streams; i++)
+        if (ic->streams[i]->codecpar->codec_type != records[i].codecType || ic->streams[i]->codecpar->codec_id != records[i].codecId)
+            return 0;
+    
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        const StreamRecord *r = &records[i];
+        
+        if (par->format < 0)
+            par->format = r->format;
+        if (!par->width || !par->height) {
+            par->width = r->width;
+            par->height = r->height;
+        }
+        if (!par->sample_rate)
+            par->sample_rate = r->sampleRate;
+        if (!par->channels)
+            par->channels = r->channels;
+        if (!par->channel_layout)
+            par->channel_layout = r->channelLayout;
+        if (!par->bit_rate)
+            par->bit_rate = r->bitRate;
+        if (!par->sample_aspect_ratio.num)
+            par->sample_aspect_ratio = r->sampleAspectRatio;
+        /* durations and rates are in the stream time base, only take them if it is the same */
+        if (av_cmp_q(st->time_base, r->timeBase))
+            continue;
+        if (st->start_time == AV_NOPTS_VALUE)
+            st->start_time = r->startTime;
+        if (st->duration == AV_NOPTS_VALUE)
+            st->duration = r->duration;
+        if (!st->avg_frame_rate.num)
+            st->avg_frame_rate = r->avgFrameRate;
+        if (!st->r_frame_rate.num)
+            st->r_frame_rate = r->realFrameRate;
+    }
+    if (ic->start_time == AV_NOPTS_VALUE)
+        ic->start_time = mHeader->startTime;
+    if (ic->duration == AV_NOPTS_VALUE)
+        ic->duration = mHeader->duration;
+    if (!ic->bit_rate)
+        ic->bit_rate = mHeader->bitRate;
+    mValid = true;
+    return 1;
+}
+
+int IndexCache::loadKeyframes(int stream_index, KeyframeIndex *index)
+{
+    const KeyframeIndex::Entry *entries;
+    int i;
+    
+    if (!mHeader || mHeader->keyframeStream != stream_index)
+        return 0;
+    entries = (const KeyframeIndex::Entry*)(mData + mHeader->keyframesOffset);
+    for (i = 1; i < mHeader->nbKeyframes; i++)
+        if (entries[i].pts <= entries[i - 1].pts)
+            return AVERROR_INVALIDDATA;
+    index->load(entries, mHeader->nbKeyframes);
+    mLoadedKeyframes = mHeader->nbKeyframes;
+    return mLoadedKeyframes;
+}
+
+int IndexCache::Save(const std::string& filename, AVFormatContext *ic, int stream_index, KeyframeIndex *index)
+{
+    std::string path = CachePath(filename), tmp = path + ".tmp";
+    std::vector<KeyframeIndex::Entry> entries;
+    std::vector<StreamRecord> records(ic->nb_streams);
+    Header h;
+    FILE *f;
+    unsigned int i;
+    int ret;
+    
+    memset(&h, 0, sizeof(h));
+    if ((ret = StatFile(filename, &h.fileSize, &h.fileMtime)) < 0)
+        return ret;
+    if (stream_index >= 0)
+        index->snapshot(entries);
+    
+    memcpy(h.magic, INDEX_CACHE_MAGIC, sizeof(h.magic));
+    h.version = INDEX_CACHE_VERSION;
+    h.headerSize = sizeof(Header);
+    h.startTime = ic->start_time;
+    h.duration = ic->duration;
+    h.bitRate = ic->bit_rate;
+    h.nbStreams = ic->nb_streams;
+    h.keyframeStream = stream_index;
+    h.nbKeyframes = (int32_t)entries.size();
+    h.pathSize = (uint32_t)filename.size();
+    h.streamsOffset = Align8(sizeof(Header));
+    h.keyframesOffset = Align8(h.streamsOffset + records.size() * sizeof(StreamRecord));
+    h.pathOffset = h.keyframesOffset + entries.size() * sizeof(KeyframeIndex::Entry);
+    
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        StreamRecord *r = &records[i];
+        
+        memset(r, 0, sizeof(*r));
+        r->codecType = par->codec_type;
+        r->codecId = par->codec_id;
+        r->format = par->format;
+        r->width = par->width;
+        r->height = par->height;
+        r->sampleRate = par->sample_rate;
+        r->channels = par->channels;
+        r->channelLayout = par->channel_layout;
+        r->bitRate = par->bit_rate;
+        r->startTime = st->start_time;
+        r->duration = st->duration;
+        r->timeBase = st->time_base;
+        r->sampleAspectRatio = par->sample_aspect_ratio;
+        r->avgFrameRate = st->avg_frame_rate;
+        r->realFrameRate = st->r_frame_rate;
+    }
+    
+    /* written aside and renamed over the old cache, a reader never maps half a file */
+    if (!(f = fopen(tmp.c_str(), "wb"))) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_WARNING, "%s: could not write the index cache\n", tmp.c_str());
+        return ret;
+    }
+    if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+        fseek(f, (long)h.streamsOffset, SEEK_SET) < 0 ||
+        (records.size() && fwrite(records.data(), sizeof(StreamRecord), records.size(), f) != records.size()) ||
+        fseek(f, (long)h.keyframesOffset, SEEK_SET) < 0 ||
+        (entries.size() && fwrite(entries.data(), sizeof(KeyframeIndex::Entry), entries.size(), f) != entries.size()) ||
+        fwrite(filename.data(), 1, filename.size(), f) != filename.size()) {
+        fclose(f);
+        remove(tmp.c_str());
+        return AVERROR(EIO);
+    }
+    if (fclose(f) != 0 || rename(tmp.c_str(), path.c_str()) < 0) {
+        ret = AVERROR(errno);
+        remove(tmp.c_str());
+        return ret;
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "%s: saved %d streams and %d keyframes\n", path.c_str(), h.nbStreams, h.nbKeyframes);
+    return 0;
+}
+
+}//end namespace ffmpeg
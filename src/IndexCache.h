@@ -0,0 +1,63 @@
+//
+//  IndexCache.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <string>
+#include "KeyframeIndex.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+namespace ffmpeg {
+
+/* a sidecar file next to the media, <filename>.ffpidx, holding what an earlier
+ * open of it found out: the stream parameters avformat_find_stream_info probes
+ * for, the durations and the keyframe index. It is keyed by the path, size and
+ * modification time of the media and laid out as a header followed by fixed
+ * size records, so it is mapped and used in place rather than parsed */
+class IndexCache {
+public:
+    
+    IndexCache();
+    ~IndexCache();
+    
+    /* maps the cache of filename, AVERROR_INVALIDDATA if it is stale or broken */
+    int open(const std::string& filename);
+    void close();
+    
+    /* fills in the stream parameters the demuxer left unset, returns 1 when the
+     * streams matched and probing can be skipped */
+    int applyStreamInfo(AVFormatContext *ic);
+    /* returns the number of keyframes loaded into index */
+    int loadKeyframes(int stream_index, KeyframeIndex *index);
+    
+    /* what the last open loaded, -1 without a cache */
+    inline int getLoadedKeyframes()const{return mLoadedKeyframes;}
+    /* the last open found a cache whose streams matched, still answers after close() */
+    inline bool isValid()const{return mValid;}
+    
+    /* writes the cache of filename, replacing the old one in one go */
+    static int Save(const std::string& filename, AVFormatContext *ic, int stream_index, KeyframeIndex *index);
+
+private:
+    
+    struct Header;
+    struct StreamRecord;
+    
+    static std::string CachePath(const std::string& filename);
+    static int StatFile(const std::string& filename, int64_t *size, int64_t *mtime);
+    
+    const uint8_t *mData;
+    size_t mSize;
+    const Header *mHeader;
+    int mLoadedKeyframes;
+    bool mValid;
+};
+
+}//end namespace ffmpeg
@@ -0,0 +1,116 @@
+//
+//  InputIO.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "InputIO.h"
+#include "ReadAheadIO.h"
+#include "MappedIO.h"
+#include "Definitions.h"
+#include <string.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+namespace ffmpeg {
+
+InputIO* InputIO::Create(Mode mode)
+{
+    switch (mode) {
+        case MODE_READAHEAD:
+            return new (std::nothrow) ReadAheadIO();
+        case MODE_MMAP:
+            return new (std::nothrow) MappedIO();
+        default:
+            return nullptr;
+    }
+}
+
+/* the path of a file: url */
+static const char* LocalPath(const std::string& filename)
+{
+    return filename.compare(0, 5, "file:") ? filename.c_str() : filename.c_str() + 5;
+}
+
+bool InputIO::IsLocalFile(const std::string& filename)
+{
+    const char *protocol = avio_find_protocol_name(filename.c_str());
+    struct stat st;
+    
+    if (!protocol || strcmp(protocol, "file"))
+        return false;
+    return !stat(LocalPath(filename), &st) && S_ISREG(st.st_mode);
+}
+
+InputIO::InputIO():
+mBytesRead(0),
+mReadTime(0),
+mStalls(0),
+mStallTime(0),
+mContext(nullptr)
+{
+}
+
+InputIO::~InputIO()
+{
+    /* subclasses close their file in their own destructor, before this runs */
+    if (mContext) {
+        av_freep(&mContext->buffer);
+        avio_context_free(&mContext);
+    }
+}
+
+int InputIO::open(const std::string& filename)
+{
+    uint8_t *buffer;
+    int ret;
+    
+    if ((ret = openFile(LocalPath(filename))) < 0)
+        return ret;
+    if (!(buffer = (uint8_t*)av_malloc(INPUT_IO_BUFFER_SIZE))) {
+        closeFile();
+        return AVERROR(ENOMEM);
+    }
+    if (!(mContext = avio_alloc_context(buffer, INPUT_IO_BUFFER_SIZE, 0, this, &InputIO::ReadPacket, NULL, &InputIO::Seek))) {
+        av_free(buffer);
+        closeFile();
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+/* only once the format context using it is closed */
+void InputIO::close()
+{
+    if (mContext) {
+        av_freep(&mContext->buffer);
+        avio_context_free(&mContext);
+    }
+    closeFile();
+}
+
+InputIO::Stats InputIO::getStats()const
+{
+    Stats stats;
+    stats.bytesRead = mBytesRead;
+    stats.readTime = mReadTime / 1000000.0;
+    stats.stalls = mStalls;
+    stats.stallTime = mStallTime / 1000000.0;
+    return stats;
+}
+
+int InputIO::ReadPacket(void *opaque, uint8_t *buf, int size)
+{
+    return ((InputIO*)opaque)->read(buf, size);
+}
+
+int64_t InputIO::Seek(void *opaque, int64_t offset, int whence)
+{
+    return ((InputIO*)opaque)->seek(offset, whence & ~AVSEEK_FORCE);
+}
+
+}//end namespace ffmpeg
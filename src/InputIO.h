@@ -0,0 +1,74 @@
+//
+//  InputIO.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <string>
+#include <atomic>
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+namespace ffmpeg {
+
+/* a custom AVIOContext over a local file, handed to avformat_open_input in
+ * place of the default file protocol. Subclasses only implement reading and
+ * seeking, the AVIOContext plumbing and the counters live here */
+class InputIO {
+public:
+    
+    /* MODE_AVIO leaves input to libavformat, MODE_READAHEAD prefetches large
+     * blocks on a thread of its own, MODE_MMAP maps the whole file */
+    enum Mode {
+        MODE_AVIO = 0, MODE_READAHEAD, MODE_MMAP
+    };
+    
+    struct Stats {
+        int64_t bytesRead;      /* from the file */
+        double readTime;        /* seconds spent reading them */
+        int stalls;             /* reads from the demuxer that had to wait for the file */
+        double stallTime;       /* seconds the demuxer waited */
+    };
+    
+    /* nullptr for MODE_AVIO */
+    static InputIO* Create(Mode mode);
+    /* whether filename is a local file a custom context can take */
+    static bool IsLocalFile(const std::string& filename);
+    
+    virtual ~InputIO();
+    
+    int open(const std::string& filename);
+    void close();
+    
+    inline AVIOContext* getContext(){return mContext;}
+    Stats getStats()const;
+
+protected:
+    
+    InputIO();
+    
+    virtual int openFile(const char *path) = 0;
+    virtual void closeFile() = 0;
+    /* both are only called from the thread using the context */
+    virtual int read(uint8_t *buf, int size) = 0;
+    virtual int64_t seek(int64_t offset, int whence) = 0;
+    
+    std::atomic<int64_t> mBytesRead;
+    std::atomic<int64_t> mReadTime;     /* microseconds */
+    std::atomic<int> mStalls;
+    std::atomic<int64_t> mStallTime;    /* microseconds */
+
+private:
+    
+    static int ReadPacket(void *opaque, uint8_t *buf, int size);
+    static int64_t Seek(void *opaque, int64_t offset, int whence);
+    
+    AVIOContext *mContext;
+};
+
+}//end namespace ffmpeg
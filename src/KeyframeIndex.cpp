@@ -0,0 +1,206 @@
+//
+//  KeyframeIndex.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "KeyframeIndex.h"
+#include "SDLUtil.h"
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/time.h"
+}
+
+namespace ffmpeg {
+
+KeyframeIndex::KeyframeIndex():
+mSize(0),
+mDirty(false),
+mMutex(nullptr)
+{
+}
+
+KeyframeIndex::~KeyframeIndex()
+{
+    destroy();
+}
+
+int KeyframeIndex::init()
+{
+    if (!(mMutex = SDL_CreateMutex())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void KeyframeIndex::destroy()
+{
+    if (mMutex) {
+        SDL_DestroyMutex(mMutex);
+        mMutex = nullptr;
+    }
+    mEntries.clear();
+    mSize = 0;
+    mDirty = false;
+}
+
+void KeyframeIndex::clear()
+{
+    sdl::ScopedLock lock(mMutex);
+    if (!mEntries.empty())
+        mDirty = true;
+    mEntries.clear();
+    mSize = 0;
+}
+
+std::vector<KeyframeIndex::Entry>::iterator KeyframeIndex::upperBound(int64_t pts)
+{
+    return std::upper_bound(mEntries.begin(), mEntries.end(), pts,
+                            [](int64_t p, const Entry& e){ return p < e.pts; });
+}
+
+void KeyframeIndex::addPacket(Run *run, const AVPacket *pkt)
+{
+    int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    std::vector<Entry>::iterator it;
+    size_t index;
+    
+    if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+        if (run->key != AV_NOPTS_VALUE)
+            run->packets++;
+        return;
+    }
+    if (pts == AV_NOPTS_VALUE || pkt->pos < 0) {
+        /* a keyframe we cannot seek to, what follows is not part of a known gop */
+        run->reset();
+        return;
+    }
+    
+    sdl::ScopedLock lock(mMutex);
+    it = upperBound(pts);
+    if (it != mEntries.begin() && (it - 1)->pts == pts) {
+        --it;
+        if (it->pos != pkt->pos) {
+            it->pos = pkt->pos;
+            mDirty = true;
+        }
+    } else {
+        Entry entry = { pts, pkt->pos, 0, 0 };
+        it = mEntries.insert(it, entry);
+        mSize = (int)mEntries.size();
+        mDirty = true;
+    }
+    index = it - mEntries.begin();
+    
+    /* the previous keyframe of this run closes its gop here */
+    if (run->key != AV_NOPTS_VALUE && index > 0 && mEntries[index - 1].pts == run->key &&
+        (mEntries[index - 1].gop != run->packets || mEntries[index - 1].last)) {
+        mEntries[index - 1].gop = run->packets;
+        mEntries[index - 1].last = 0;
+        mDirty = true;
+    }
+    run->key = pts;
+    run->packets = 1;
+}
+
+void KeyframeIndex::endOfStream(Run *run)
+{
+    std::vector<Entry>::iterator it;
+    
+    if (run->key == AV_NOPTS_VALUE)
+        return;
+    
+    sdl::ScopedLock lock(mMutex);
+    it = upperBound(run->key);
+    if (it != mEntries.begin() && (it - 1)->pts == run->key && ((it - 1)->gop != run->packets || !(it - 1)->last)) {
+        (it - 1)->gop = run->packets;
+        (it - 1)->last = 1;
+        mDirty = true;
+    }
+    run->reset();
+}
+
+int KeyframeIndex::lookup(int64_t pts, Entry *entry)
+{
+    std::vector<Entry>::iterator it;
+    
+    sdl::ScopedLock lock(mMutex);
+    it = upperBound(pts);
+    if (it == mEntries.begin())
+        return 0;
+    --it;
+    /* pts has to fall within a gop that was read through */
+    if (!it->gop && !it->last)
+        return 0;
+    *entry = *it;
+    return 1;
+}
+
+bool KeyframeIndex::isComplete()
+{
+    sdl::ScopedLock lock(mMutex);
+    if (mEntries.empty() || !mEntries.back().last)
+        return false;
+    for (const Entry& entry : mEntries)
+        if (!entry.gop)
+            return false;
+    return true;
+}
+
+void KeyframeIndex::load(const Entry *entries, int count)
+{
+    sdl::ScopedLock lock(mMutex);
+    mEntries.assign(entries, entries + count);
+    mSize = (int)mEntries.size();
+    mDirty = false;
+}
+
+void KeyframeIndex::snapshot(std::vector<Entry>& entries)
+{
+    sdl::ScopedLock lock(mMutex);
+    entries = mEntries;
+}
+
+static int ScanInterruptCallback(void *ctx)
+{
+    return *(int*)ctx;
+}
+
+int KeyframeIndex::scan(const char *filename, AVInputFormat *iformat, int stream_index, int *abort)
+{
+    AVFormatContext *ic = avformat_alloc_context();
+    AVPacket pkt1, *pkt = &pkt1;
+    int64_t start = av_gettime_relative();
+    Run run;
+    int ret;
+    
+    if (!ic)
+        return AVERROR(ENOMEM);
+    ic->interrupt_callback.callback = ScanInterruptCallback;
+    ic->interrupt_callback.opaque = abort;
+    if ((ret = avformat_open_input(&ic, filename, iformat, NULL)) < 0)
+        return ret;
+    
+    while (!*abort) {
+        if ((ret = av_read_frame(ic, pkt)) < 0) {
+            if (ret == AVERROR_EOF || avio_feof(ic->pb)) {
+                endOfStream(&run);
+                ret = 0;
+            }
+            break;
+        }
+        if (pkt->stream_index == stream_index)
+            addPacket(&run, pkt);
+        av_packet_unref(pkt);
+    }
+    
+    av_log(NULL, AV_LOG_VERBOSE, "Keyframe scan of %s %s: %d keyframes in %.3fs\n", filename,
+           ret < 0 ? "failed" : *abort ? "aborted" : "done", getSize(), (av_gettime_relative() - start) / 1000000.0);
+    avformat_close_input(&ic);
+    return ret;
+}
+
+}//end namespace ffmpeg
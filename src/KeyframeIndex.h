@@ -0,0 +1,89 @@
+//
+//  KeyframeIndex.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <vector>
+#include <atomic>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+namespace ffmpeg {
+
+/* keyframes of one video stream, in the stream's time base, remembered for the
+ * life of the opened file. It is filled by whoever reads the stream: the read
+ * thread as it plays, and optionally a scan thread reading the file from the
+ * start on its own. A keyframe only answers a lookup when the packets after it
+ * were read up to the next keyframe, or to the end of the file, so a gap in
+ * what was read never sends a seek to a keyframe far behind its target */
+class KeyframeIndex {
+public:
+    
+    /* fixed size, the index cache maps arrays of these straight from disk */
+    struct Entry {
+        int64_t pts;
+        int64_t pos;        /* byte position of the keyframe packet */
+        int32_t gop;        /* packets up to the next keyframe, 0 while unknown */
+        int32_t last;       /* read on to the end of the stream without another keyframe */
+    };
+    
+    /* the reading state of one producer, packets only count as contiguous
+     * within a run */
+    struct Run {
+        int64_t key;        /* pts of the last keyframe added, AV_NOPTS_VALUE when none */
+        int packets;        /* packets since */
+        Run():key(AV_NOPTS_VALUE), packets(0){}
+        inline void reset(){key = AV_NOPTS_VALUE; packets = 0;}
+    };
+    
+    KeyframeIndex();
+    ~KeyframeIndex();
+    
+    int init();
+    void destroy();
+    void clear();
+    
+    /* safe to call from any thread */
+    void addPacket(Run *run, const AVPacket *pkt);
+    void endOfStream(Run *run);
+    
+    /* the keyframe to start decoding at to show pts, 0 if it is not known */
+    int lookup(int64_t pts, Entry *entry);
+    
+    /* lock free */
+    inline int getSize()const{return mSize;}
+    
+    /* changed since it was created or loaded, what the index cache holds is out of date */
+    inline bool isDirty()const{return mDirty;}
+    
+    /* every keyframe known up to the end of the stream, nothing left to scan for */
+    bool isComplete();
+    
+    /* copy the entries in and out in one go, for the index cache */
+    void load(const Entry *entries, int count);
+    void snapshot(std::vector<Entry>& entries);
+    
+    /* reads the whole file with its own demuxer and indexes stream_index, for a
+     * background thread; returns early once *abort is set */
+    int scan(const char *filename, AVInputFormat *iformat, int stream_index, int *abort);
+
+private:
+    
+    /* the first entry with a pts above pts */
+    std::vector<Entry>::iterator upperBound(int64_t pts);
+    
+    std::vector<Entry> mEntries;
+    std::atomic<int> mSize;
+    std::atomic<bool> mDirty;
+    SDL_mutex *mMutex;
+};
+
+}//end namespace ffmpeg
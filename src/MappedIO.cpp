@@ -0,0 +1,170 @@
+//
+//  MappedIO.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "MappedIO.h"
+#include "FFMPEGUtil.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/time.h"
+}
+
+namespace ffmpeg {
+
+MappedIO::MappedIO():
+mData(nullptr),
+mFileSize(0),
+mPageSize(4096),
+mHints(opts::readAheadHints()),
+mPosition(0),
+mAdvisedEnd(0),
+mReleasedEnd(0)
+{
+}
+
+MappedIO::~MappedIO()
+{
+    close();
+}
+
+int MappedIO::openFile(const char *path)
+{
+#ifndef _WIN32
+    struct stat st;
+    void *data;
+    int fd, ret;
+    
+    if ((fd = ::open(path, O_RDONLY)) < 0)
+        return AVERROR(errno);
+    if (fstat(fd, &st) < 0) {
+        ret = AVERROR(errno);
+        ::close(fd);
+        return ret;
+    }
+    /* nothing to map, and a size_t could not hold it on 32 bit */
+    if (st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX) {
+        ::close(fd);
+        return AVERROR(EINVAL);
+    }
+    /* shared and read only, the pages are the page cache's own */
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return AVERROR(errno);
+    
+    mData = (uint8_t*)data;
+    mFileSize = st.st_size;
+    mPageSize = sysconf(_SC_PAGESIZE) > 0 ? sysconf(_SC_PAGESIZE) : 4096;
+    mPosition = mAdvisedEnd = mReleasedEnd = 0;
+    if (mHints)
+        madvise(mData, mFileSize, MADV_SEQUENTIAL);
+    advise();
+    av_log(NULL, AV_LOG_VERBOSE, "%s: mapped %" PRId64 " bytes\n", path, mFileSize);
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+void MappedIO::closeFile()
+{
+#ifndef _WIN32
+    if (mData)
+        munmap(mData, mFileSize);
+#endif
+    mData = nullptr;
+    mFileSize = 0;
+}
+
+/* keeps a window advised in ahead of the read position and drops what is far
+ * enough behind it, both in whole pages */
+void MappedIO::advise()
+{
+#ifndef _WIN32
+    int64_t start, end;
+    
+    if (!mHints)
+        return;
+    /* advised again once half the window was read */
+    if (mAdvisedEnd < mFileSize && mPosition + MAPPED_IO_WINDOW / 2 >= mAdvisedEnd) {
+        start = FFMAX(mAdvisedEnd, mPosition) & ~(mPageSize - 1);
+        end = FFMIN(mPosition + MAPPED_IO_WINDOW, mFileSize);
+        if (end > start)
+            madvise(mData + start, end - start, MADV_WILLNEED);
+        mAdvisedEnd = end;
+    }
+    /* other mappings of the file keep their pages, this one faults them back in if it seeks there */
+    end = (mPosition - MAPPED_IO_KEEP_BEHIND) & ~(mPageSize - 1);
+    if (end > mReleasedEnd) {
+        madvise(mData + mReleasedEnd, end - mReleasedEnd, MADV_DONTNEED);
+        mReleasedEnd = end;
+    }
+#endif
+}
+
+int MappedIO::read(uint8_t *buf, int size)
+{
+    int64_t start;
+    int len;
+    
+    if (mPosition >= mFileSize)
+        return AVERROR_EOF;
+    len = (int)FFMIN((int64_t)size, mFileSize - mPosition);
+    
+    start = av_gettime_relative();
+    memcpy(buf, mData + mPosition, len);
+    start = av_gettime_relative() - start;
+    mReadTime += start;
+    mBytesRead += len;
+    /* only a fault that went to the disk takes this long */
+    if (start >= MAPPED_IO_STALL_TIME * 1000000) {
+        mStalls++;
+        mStallTime += start;
+    }
+    
+    mPosition += len;
+    advise();
+    return len;
+}
+
+int64_t MappedIO::seek(int64_t offset, int whence)
+{
+    switch (whence) {
+        case AVSEEK_SIZE:
+            return mFileSize;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += mPosition;
+            break;
+        case SEEK_END:
+            offset += mFileSize;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+    /* the window follows the new position, in either direction */
+    if (offset < mPosition || offset >= mAdvisedEnd)
+        mAdvisedEnd = FFMIN(offset, mFileSize);
+    mReleasedEnd = FFMIN(mReleasedEnd, offset & ~(mPageSize - 1));
+    mPosition = offset;
+    advise();
+    return offset;
+}
+
+}//end namespace ffmpeg
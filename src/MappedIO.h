@@ -0,0 +1,46 @@
+//
+//  MappedIO.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include "InputIO.h"
+#include "Definitions.h"
+
+namespace ffmpeg {
+
+/* maps a local file read only and copies out of the mapping, so reads and
+ * seeks are pointer arithmetic and players of the same file share its pages
+ * in the page cache. The pages ahead of the read position are advised in, the
+ * ones far behind it are dropped from the mapping */
+class MappedIO : public InputIO {
+public:
+    
+    MappedIO();
+    ~MappedIO();
+
+protected:
+    
+    int openFile(const char *path) override;
+    void closeFile() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+
+private:
+    
+    void advise();
+    
+    uint8_t *mData;
+    int64_t mFileSize;
+    int64_t mPageSize;
+    bool mHints;
+    
+    int64_t mPosition;
+    int64_t mAdvisedEnd;        /* pages before this were advised in */
+    int64_t mReleasedEnd;       /* pages before this were dropped, or never touched */
+};
+
+}//end namespace ffmpeg
@@ -7,6 +7,8 @@
 
 #include "PacketQueue.h"
 #include "SDLUtil.h"
+#include "Trace.h"
+#include <thread>
 
 
 namespace ffmpeg {
@@ -14,8 +16,21 @@ namespace ffmpeg {
 AVPacket PacketQueue::sFlushPacket = AVPacket();
     
 PacketQueue::PacketQueue():
+mMode(MODE_LOCKED),
 mFirstPacket(nullptr),
 mLastPacket(nullptr),
+mFreeItems(nullptr),
+mSlabs(nullptr),
+mItemsInUse(0),
+mPoolStats(),
+mRing(nullptr),
+mRingMask(0),
+mRingHead(0),
+mRingTail(0),
+mRingHighWaterMark(0),
+mSleepers(0),
+mFlushing(0),
+mConsumerActive(0),
 mNumPackets(0),
 mSizeInBytes(0),
 mDuration(0),
@@ -28,12 +43,54 @@ mCondVar(nullptr)
 
 PacketQueue::~PacketQueue()
 {
+    Slab *slab, *next;
+    
     flush();
+    for (slab = mSlabs; slab; slab = next) {
+        next = slab->next;
+        av_free(slab);
+    }
+    av_freep(&mRing);
     SDL_DestroyMutex(mMutex);
     SDL_DestroyCond(mCondVar);
 }
 
-int PacketQueue::init()
+/* must be called with mMutex held */
+PacketQueue::Item* PacketQueue::allocItem()
+{
+    Item *item;
+    
+    if (!mFreeItems) {
+        int i;
+        Slab *slab = (Slab*)av_malloc(sizeof(Slab));
+        if (!slab)
+            return nullptr;
+        slab->next = mSlabs;
+        mSlabs = slab;
+        for (i = 0; i < PACKET_QUEUE_SLAB_ITEMS; i++) {
+            slab->items[i].next = mFreeItems;
+            mFreeItems = &slab->items[i];
+        }
+        mPoolStats.growCount++;
+        mPoolStats.bytesHeld += sizeof(Slab);
+    }
+    
+    item = mFreeItems;
+    mFreeItems = item->next;
+    if (++mItemsInUse > mPoolStats.highWaterMark)
+        mPoolStats.highWaterMark = mItemsInUse;
+    return item;
+}
+
+/* must be called with mMutex held */
+void PacketQueue::releaseItem(Item *item)
+{
+    item->next = mFreeItems;
+    mFreeItems = item;
+    mItemsInUse--;
+}
+
+int PacketQueue::init(Mode mode, int capacity)
 {
     mMutex = SDL_CreateMutex();
     if (!mMutex) {
@@ -45,12 +102,33 @@ int PacketQueue::init()
         av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
         return AVERROR(ENOMEM);
     }
+    mMode = mode;
+    if (mMode == MODE_SPSC) {
+        unsigned ring_size = 2;
+        while (ring_size < (unsigned)capacity)
+            ring_size <<= 1;
+        mRing = (Item*)av_mallocz_array(ring_size, sizeof(Item));
+        if (!mRing) {
+            av_log(NULL, AV_LOG_FATAL, "Could not allocate packet ring of %u slots\n", ring_size);
+            return AVERROR(ENOMEM);
+        }
+        mRingMask = ring_size - 1;
+        mRingHead = 0;
+        mRingTail = 0;
+        mPoolStats.growCount = 1;
+        mPoolStats.bytesHeld = ring_size * sizeof(Item);
+    }
     mAbortRequest = 1;
     return 0;
 }
 
 void PacketQueue::start()
 {
+    if (mMode == MODE_SPSC) {
+        mAbortRequest = 0;
+        putRing(&sFlushPacket);
+        return;
+    }
     sdl::ScopedLock lock(mMutex);
     mAbortRequest = 0;
     _put(&sFlushPacket);
@@ -60,18 +138,23 @@ void PacketQueue::abort()
 {
     sdl::ScopedLock lock(mMutex);
     mAbortRequest = 1;
-    SDL_CondSignal(mCondVar);
+    SDL_CondBroadcast(mCondVar);
 }
 
 void PacketQueue::flush()
 {
     Item *pkt, *pkt1;
     
+    if (mMode == MODE_SPSC) {
+        flushRing();
+        return;
+    }
+    
     sdl::ScopedLock lock(mMutex);
     for (pkt = mFirstPacket; pkt; pkt = pkt1) {
         pkt1 = pkt->next;
         av_packet_unref(&pkt->packet);
-        av_freep(&pkt);
+        releaseItem(pkt);
     }
     mLastPacket = nullptr;
     mFirstPacket = nullptr;
@@ -87,7 +170,7 @@ int PacketQueue::_put(AVPacket *pkt)
     if (mAbortRequest)
         return -1;
     
-    pkt1 = (Item*)av_malloc(sizeof(Item));
+    pkt1 = allocItem();
     if (!pkt1)
         return -1;
     pkt1->packet = *pkt;
@@ -121,54 +204,211 @@ int PacketQueue::putNullPacket(int stream)
 
 int PacketQueue::put(AVPacket *pkt)
 {
+    int64_t start = trace::Begin();
+    int stream = pkt->stream_index;
+    int64_t pts = pkt->pts;
     int ret;
-    {
+    if (mMode == MODE_SPSC) {
+        ret = putRing(pkt);
+    } else {
         sdl::ScopedLock lock(mMutex);
         ret = _put(pkt);
     }
     
     if (pkt != &sFlushPacket && ret < 0)
         av_packet_unref(pkt);
+    else if (pkt != &sFlushPacket)
+        trace::Record(trace::STAGE_PACKET_PUT, start, stream, pts);
     
     return ret;
 }
 
 int PacketQueue::get(AVPacket *pkt, bool block, int *serial)
+{
+    return getBatch(pkt, 1, serial, block);
+}
+
+/* the packets of one batch share the wait, so they get the same span */
+static void TraceBatch(int64_t start, AVPacket *out, int count)
+{
+    int i;
+    if (!start)
+        return;
+    for (i = 0; i < count; i++)
+        if (out[i].data != PacketQueue::sFlushPacket.data)
+            trace::Record(trace::STAGE_PACKET_GET, start, out[i].stream_index, out[i].pts);
+}
+
+/* dequeue up to max packets under a single lock, returns the number of
+ * packets written to out (0 only if !block), or -1 on abort */
+int PacketQueue::getBatch(AVPacket *out, int max, int *serials, bool block)
 {
     Item *pkt1;
-    int ret;
+    int count = 0;
+    int64_t start = trace::Begin();
+    
+    if (mMode == MODE_SPSC) {
+        count = getRing(out, max, serials, block);
+        TraceBatch(start, out, count);
+        return count;
+    }
     
     sdl::ScopedLock lock(mMutex);
     
     for (;;) {
-        if (mAbortRequest) {
-            ret = -1;
+        if (mAbortRequest)
+            return -1;
+        if (mFirstPacket || !block)
             break;
+        SDL_CondWait(mCondVar, mMutex);
+    }
+    
+    while (count < max && (pkt1 = mFirstPacket)) {
+        mFirstPacket = pkt1->next;
+        mNumPackets--;
+        mSizeInBytes -= pkt1->packet.size + sizeof(*pkt1);
+        mDuration -= pkt1->packet.duration;
+        out[count] = pkt1->packet;
+        if (serials)
+            serials[count] = pkt1->serial;
+        releaseItem(pkt1);
+        count++;
+    }
+    if (!mFirstPacket)
+        mLastPacket = nullptr;
+    
+    TraceBatch(start, out, count);
+    return count;
+}
+
+/* the ring functions below only take mMutex to sleep (queue empty or full)
+ * or to flush; mSleepers and mConsumerActive are the seq_cst handshakes
+ * that make that safe against the lock-free side */
+void PacketQueue::wakeSleepers()
+{
+    if (mSleepers) {
+        sdl::ScopedLock lock(mMutex);
+        SDL_CondBroadcast(mCondVar);
+    }
+}
+
+int PacketQueue::putRing(AVPacket *pkt)
+{
+    Item *item;
+    unsigned tail = mRingTail.load(std::memory_order_relaxed);
+    int used;
+    
+    if (mAbortRequest)
+        return -1;
+    
+    if (tail - mRingHead.load(std::memory_order_acquire) > mRingMask) {
+        /* full, wait for the decoder to make room */
+        sdl::ScopedLock lock(mMutex);
+        mSleepers++;
+        while (!mAbortRequest && isRingFull())
+            SDL_CondWait(mCondVar, mMutex);
+        mSleepers--;
+        if (mAbortRequest)
+            return -1;
+    }
+    
+    item = &mRing[tail & mRingMask];
+    item->packet = *pkt;
+    item->next = nullptr;
+    if (pkt == &sFlushPacket)
+        mSerial++;
+    item->serial = mSerial;
+    
+    mNumPackets++;
+    mSizeInBytes += item->packet.size + sizeof(*item);
+    mDuration += item->packet.duration;
+    mRingTail = tail + 1;
+    
+    used = tail + 1 - mRingHead.load(std::memory_order_relaxed);
+    if (used > mRingHighWaterMark.load(std::memory_order_relaxed))
+        mRingHighWaterMark.store(used, std::memory_order_relaxed);
+    
+    wakeSleepers();
+    return 0;
+}
+
+int PacketQueue::getRing(AVPacket *out, int max, int *serials, bool block)
+{
+    for (;;) {
+        if (mAbortRequest)
+            return -1;
+        
+        mConsumerActive = 1;
+        if (!mFlushing) {
+            unsigned head = mRingHead.load(std::memory_order_relaxed);
+            unsigned tail = mRingTail.load(std::memory_order_acquire);
+            int count = 0;
+            while (count < max && head != tail) {
+                Item *item = &mRing[head & mRingMask];
+                mNumPackets--;
+                mSizeInBytes -= item->packet.size + sizeof(*item);
+                mDuration -= item->packet.duration;
+                out[count] = item->packet;
+                if (serials)
+                    serials[count] = item->serial;
+                head++;
+                count++;
+            }
+            if (count) {
+                mRingHead = head;
+                mConsumerActive = 0;
+                wakeSleepers();
+                return count;
+            }
         }
+        mConsumerActive = 0;
         
-        pkt1 = mFirstPacket;
-        if (pkt1) {
-            mFirstPacket = pkt1->next;
-            if (!mFirstPacket)
-                mLastPacket = nullptr;
-            mNumPackets--;
-            mSizeInBytes -= pkt1->packet.size + sizeof(*pkt1);
-            mDuration -= pkt1->packet.duration;
-            *pkt = pkt1->packet;
-            if (serial)
-                *serial = pkt1->serial;
-            av_free(pkt1);
-            ret = 1;
-            break;
-        } else if (!block) {
-            ret = 0;
-            break;
-        } else {
-            SDL_CondWait(mCondVar, mMutex);
+        if (!block)
+            return 0;
+        
+        {
+            /* empty (or being flushed, in which case this waits for the flush) */
+            sdl::ScopedLock lock(mMutex);
+            mSleepers++;
+            while (!mAbortRequest && isRingEmpty())
+                SDL_CondWait(mCondVar, mMutex);
+            mSleepers--;
         }
     }
+}
+
+/* called by the producer (seek) or once the consumer thread is gone,
+ * so only the consumer can be racing with us here */
+void PacketQueue::flushRing()
+{
+    unsigned head, tail;
     
-    return ret;
+    sdl::ScopedLock lock(mMutex);
+    mFlushing = 1;
+    while (mConsumerActive)
+        std::this_thread::yield();
+    
+    tail = mRingTail;
+    for (head = mRingHead; head != tail; head++) {
+        Item *item = &mRing[head & mRingMask];
+        mNumPackets--;
+        mSizeInBytes -= item->packet.size + sizeof(*item);
+        mDuration -= item->packet.duration;
+        av_packet_unref(&item->packet);
+    }
+    mRingHead = head;
+    mFlushing = 0;
+    SDL_CondBroadcast(mCondVar);
+}
+
+PacketQueue::PoolStats PacketQueue::getPoolStats()
+{
+    PoolStats stats;
+    sdl::ScopedLock lock(mMutex);
+    stats = mPoolStats;
+    if (mMode == MODE_SPSC)
+        stats.highWaterMark = mRingHighWaterMark;
+    return stats;
 }
     
 }//end namespace ffmpeg
@@ -12,6 +12,8 @@ extern "C" {
 }
 #include <SDL.h>
 #include <SDL_thread.h>
+#include <atomic>
+#include "Definitions.h"
 
 namespace ffmpeg {
 
@@ -20,15 +22,29 @@ public:
     
     static AVPacket sFlushPacket;
     
+    /* MODE_LOCKED is the classic mutex protected linked list, MODE_SPSC is a
+     * bounded ring for exactly one producer (the read thread) and one consumer
+     * (the decoder) that only takes the mutex to sleep when empty or full */
+    enum Mode {
+        MODE_LOCKED = 0, MODE_SPSC
+    };
+    
+    struct PoolStats {
+        int highWaterMark;  /* most nodes in use at the same time */
+        int growCount;      /* number of slabs allocated */
+        size_t bytesHeld;   /* bytes held by all slabs, in use or free */
+    };
+    
     PacketQueue();
     ~PacketQueue();
-    int init();
+    int init(Mode mode = MODE_LOCKED, int capacity = PACKET_QUEUE_RING_SIZE);
     void start();
     void flush();
     void abort();
     int put(AVPacket *pkt);
     int putNullPacket(int stream);
     int get(AVPacket *pkt, bool block, int *serial = nullptr);
+    int getBatch(AVPacket *out, int max, int *serials, bool block = true);
     
     inline int size() const { return mSizeInBytes; }
     inline int getSerial() const { return mSerial; }
@@ -36,7 +52,9 @@ public:
     inline int getAbortRequest() const { return mAbortRequest; }
     inline int getNumPackets() const { return mNumPackets; }
     inline int64_t getDuration() const { return mDuration; }
-
+    inline Mode getMode() const { return mMode; }
+    PoolStats getPoolStats();
+    
 private:
     
     int _put(AVPacket *pkt);
@@ -47,14 +65,44 @@ private:
         int serial;
     };
     
+    struct Slab {
+        Slab *next;
+        Item items[PACKET_QUEUE_SLAB_ITEMS];
+    };
+    
+    Item* allocItem();
+    void releaseItem(Item *item);
+    
+    int putRing(AVPacket *pkt);
+    int getRing(AVPacket *out, int max, int *serials, bool block);
+    void flushRing();
+    void wakeSleepers();
+    inline bool isRingFull() const { return mRingTail - mRingHead > mRingMask; }
+    inline bool isRingEmpty() const { return mRingTail == mRingHead; }
+    
+    Mode mMode;
     Item *mFirstPacket, *mLastPacket;
-    int mNumPackets;
-    int mSizeInBytes;
-    int64_t mDuration;
-    int mAbortRequest;
+    Item *mFreeItems;
+    Slab *mSlabs;
+    int mItemsInUse;
+    PoolStats mPoolStats;
+    
+    Item *mRing;
+    unsigned mRingMask;
+    std::atomic<unsigned> mRingHead;    /* next slot to read, advanced by the consumer */
+    std::atomic<unsigned> mRingTail;    /* next slot to write, advanced by the producer */
+    std::atomic<int> mRingHighWaterMark;
+    std::atomic<int> mSleepers;         /* threads waiting (or about to wait) on mCondVar */
+    std::atomic<int> mFlushing;
+    std::atomic<int> mConsumerActive;
+    
+    std::atomic<int> mNumPackets;
+    std::atomic<int> mSizeInBytes;
+    std::atomic<int64_t> mDuration;
+    std::atomic<int> mAbortRequest;
     int mSerial;
     SDL_mutex *mMutex;
     SDL_cond *mCondVar;
 };
-    
+
 }
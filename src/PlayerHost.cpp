@@ -0,0 +1,318 @@
+//
+//  PlayerHost.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "PlayerHost.h"
+#include "VideoState.h"
+#include "SDLUtil.h"
+#include <algorithm>
+#include <math.h>
+#include <new>
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/time.h"
+}
+
+namespace ffmpeg {
+
+/* the order a player's ready tasks are stepped in, what the listener hears first */
+static const int sTaskOrder[PlayerHost::TASK_NB] = {
+    PlayerHost::TASK_AUDIO, PlayerHost::TASK_VIDEO, PlayerHost::TASK_SUBTITLE, PlayerHost::TASK_READ
+};
+
+PlayerHost::PlayerHost():
+mWorkers(),
+mWorkerCount(0),
+mStop(0),
+mMutex(nullptr),
+mWorkCond(nullptr),
+mDoneCond(nullptr),
+mSteps(0),
+mEmptySteps(0),
+mBusyTime(0)
+{
+}
+
+PlayerHost::~PlayerHost()
+{
+    stop();
+    for (Player *player : mPlayers)
+        player->state->mHost = nullptr;
+    for (Player *player : mPlayers)
+        delete player;
+    mPlayers.clear();
+    SDL_DestroyCond(mWorkCond);
+    SDL_DestroyCond(mDoneCond);
+    SDL_DestroyMutex(mMutex);
+}
+
+int PlayerHost::start(int nb_workers)
+{
+    int i;
+    
+    if (!mMutex && !(mMutex = SDL_CreateMutex())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    if ((!mWorkCond && !(mWorkCond = SDL_CreateCond())) || (!mDoneCond && !(mDoneCond = SDL_CreateCond()))) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    if (nb_workers <= 0)
+        nb_workers = SDL_GetCPUCount();
+    nb_workers = av_clip(nb_workers, 1, PLAYER_HOST_MAX_WORKERS);
+    mStop = 0;
+    
+    for (i = 0; i < nb_workers; i++) {
+        if (!(mWorkers[i] = SDL_CreateThread(&PlayerHost::WorkerThread, "PlayerHost", (void*)this))) {
+            av_log(NULL, AV_LOG_WARNING, "SDL_CreateThread(): %s\n", SDL_GetError());
+            break;
+        }
+    }
+    mWorkerCount = i;
+    if (!mWorkerCount) {
+        av_log(NULL, AV_LOG_FATAL, "PlayerHost: no workers\n");
+        return AVERROR(ENOMEM);
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Hosting players on %d workers\n", mWorkerCount);
+    return 0;
+}
+
+void PlayerHost::stop()
+{
+    int i;
+    
+    if (!mMutex)
+        return;
+    {
+        sdl::ScopedLock lock(mMutex);
+        mStop = 1;
+        SDL_CondBroadcast(mWorkCond);
+    }
+    for (i = 0; i < mWorkerCount; i++) {
+        SDL_WaitThread(mWorkers[i], NULL);
+        mWorkers[i] = nullptr;
+    }
+    mWorkerCount = 0;
+}
+
+/* with the mutex held */
+double PlayerHost::minVirtualRuntime()
+{
+    double vruntime = INFINITY;
+    for (Player *player : mPlayers)
+        vruntime = FFMIN(vruntime, player->vruntime);
+    return isinf(vruntime) ? 0.0 : vruntime;
+}
+
+/* with the mutex held */
+PlayerHost::Player* PlayerHost::find(VideoState *state)
+{
+    for (Player *player : mPlayers)
+        if (player->state == state)
+            return player;
+    return nullptr;
+}
+
+int PlayerHost::add(VideoState *state, double weight)
+{
+    Player *player;
+    int i;
+    
+    if (!mMutex || weight <= 0)
+        return AVERROR(EINVAL);
+    if (!(player = new (std::nothrow) Player()))
+        return AVERROR(ENOMEM);
+    player->state = state;
+    player->weight = weight;
+    for (i = 0; i < TASK_NB; i++) {
+        player->active[i] = false;
+        player->running[i] = false;
+        player->retryAt[i] = 0.0;
+    }
+    
+    sdl::ScopedLock lock(mMutex);
+    if (find(state)) {
+        delete player;
+        return AVERROR(EEXIST);
+    }
+    /* a newcomer starts level with the others rather than owed all the time they ran */
+    player->vruntime = minVirtualRuntime();
+    mPlayers.push_back(player);
+    state->mHost = this;
+    return 0;
+}
+
+void PlayerHost::remove(VideoState *state)
+{
+    Player *player;
+    int i;
+    
+    if (!mMutex)
+        return;
+    sdl::ScopedLock lock(mMutex);
+    if (!(player = find(state)))
+        return;
+    for (i = 0; i < TASK_NB; i++) {
+        player->active[i] = false;
+        while (player->running[i])
+            SDL_CondWait(mDoneCond, mMutex);
+    }
+    mPlayers.erase(std::find(mPlayers.begin(), mPlayers.end(), player));
+    state->mHost = nullptr;
+    delete player;
+}
+
+void PlayerHost::setWeight(VideoState *state, double weight)
+{
+    Player *player;
+    
+    if (!mMutex || weight <= 0)
+        return;
+    sdl::ScopedLock lock(mMutex);
+    if ((player = find(state)))
+        player->weight = weight;
+}
+
+void PlayerHost::activate(VideoState *state, int task)
+{
+    Player *player;
+    
+    sdl::ScopedLock lock(mMutex);
+    if (!(player = find(state)))
+        return;
+    player->active[task] = true;
+    player->retryAt[task] = 0.0;
+    SDL_CondSignal(mWorkCond);
+}
+
+void PlayerHost::deactivate(VideoState *state, int task)
+{
+    Player *player;
+    
+    sdl::ScopedLock lock(mMutex);
+    if (!(player = find(state)))
+        return;
+    player->active[task] = false;
+    while (player->running[task])
+        SDL_CondWait(mDoneCond, mMutex);
+}
+
+void PlayerHost::wake(VideoState *state)
+{
+    Player *player;
+    int i;
+    
+    sdl::ScopedLock lock(mMutex);
+    if (!(player = find(state)))
+        return;
+    for (i = 0; i < TASK_NB; i++)
+        player->retryAt[i] = 0.0;
+    SDL_CondSignal(mWorkCond);
+}
+
+PlayerHost::Stats PlayerHost::getStats()
+{
+    Stats stats = {};
+    
+    stats.workers = mWorkerCount;
+    if (mMutex) {
+        sdl::ScopedLock lock(mMutex);
+        stats.players = (int)mPlayers.size();
+    }
+    stats.steps = mSteps;
+    stats.emptySteps = mEmptySteps;
+    stats.busyTime = mBusyTime / 1000000.0;
+    return stats;
+}
+
+/* with the mutex held: the ready task of the player with the least virtual
+ * runtime, or null and in *next when the first retry is due */
+PlayerHost::Player* PlayerHost::pick(double now, int *task, double *next)
+{
+    Player *best = nullptr;
+    int i, t;
+    
+    *next = INFINITY;
+    for (Player *player : mPlayers) {
+        if (best && player->vruntime >= best->vruntime)
+            continue;
+        for (i = 0; i < TASK_NB; i++) {
+            t = sTaskOrder[i];
+            if (!player->active[t] || player->running[t])
+                continue;
+            if (player->retryAt[t] > now) {
+                *next = FFMIN(*next, player->retryAt[t]);
+                continue;
+            }
+            best = player;
+            *task = t;
+            break;
+        }
+    }
+    return best;
+}
+
+int PlayerHost::WorkerThread(void *arg)
+{
+    ((PlayerHost*)arg)->work();
+    return 0;
+}
+
+void PlayerHost::work()
+{
+    Player *player;
+    double now, next;
+    int64_t start, elapsed;
+    int task = TASK_READ, ret, i;
+    
+    for (;;) {
+        {
+            sdl::ScopedLock lock(mMutex);
+            for (;;) {
+                if (mStop)
+                    return;
+                now = av_gettime_relative() / 1000000.0;
+                if ((player = pick(now, &task, &next)))
+                    break;
+                if (isinf(next))
+                    SDL_CondWait(mWorkCond, mMutex);
+                else
+                    SDL_CondWaitTimeout(mWorkCond, mMutex, (Uint32)ceil((next - now) * 1000.0));
+            }
+            player->running[task] = true;
+        }
+        
+        /* the player cannot be removed nor the task ended while it runs */
+        start = av_gettime_relative();
+        ret = player->state->hostStep(task);
+        elapsed = av_gettime_relative() - start;
+        mSteps++;
+        mBusyTime += elapsed;
+        
+        {
+            sdl::ScopedLock lock(mMutex);
+            player->running[task] = false;
+            player->vruntime += elapsed / 1000000.0 / player->weight;
+            if (ret < 0) {
+                player->active[task] = false;
+            } else if (ret == 0) {
+                mEmptySteps++;
+                player->retryAt[task] = (start + elapsed) / 1000000.0 + PLAYER_HOST_RETRY_INTERVAL;
+            } else {
+                /* a packet read or a frame decoded may be what the other tasks wait for */
+                for (i = 0; i < TASK_NB; i++)
+                    if (i != task)
+                        player->retryAt[i] = 0.0;
+                SDL_CondSignal(mWorkCond);
+            }
+            SDL_CondBroadcast(mDoneCond);
+        }
+    }
+}
+
+}//end namespace ffmpeg
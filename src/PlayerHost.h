@@ -0,0 +1,99 @@
+//
+//  PlayerHost.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <atomic>
+#include <vector>
+#include "Definitions.h"
+
+namespace ffmpeg {
+
+class VideoState;
+
+/* runs the reading and decoding of many VideoStates on one pool of workers, one
+ * per cpu, instead of a thread per stream per player. Each player's read, video,
+ * audio and subtitle loops become tasks the workers step one iteration at a time:
+ * a step never waits for packets or for room in a frame queue, it returns and the
+ * task is retried PLAYER_HOST_RETRY_INTERVAL later, or sooner when the player is
+ * woken by a picture or samples being consumed or a seek.
+ *
+ * Players share the workers in proportion to their weight: each one's virtual
+ * runtime grows by the time its steps take divided by its weight, and a free
+ * worker always steps the player with the least of it. Within a player audio
+ * goes first, then video, subtitles, and reading last.
+ *
+ * Add a player before its streamOpen(), its destructor removes it */
+class PlayerHost {
+public:
+    
+    enum Task {
+        TASK_READ, TASK_VIDEO, TASK_AUDIO, TASK_SUBTITLE, TASK_NB
+    };
+    
+    struct Stats {
+        int workers;
+        int players;
+        int64_t steps;
+        int64_t emptySteps;     /* steps that found nothing to do */
+        double busyTime;        /* seconds spent stepping, by all workers */
+    };
+    
+    PlayerHost();
+    ~PlayerHost();
+    
+    /* nb_workers 0 picks one per cpu up to PLAYER_HOST_MAX_WORKERS */
+    int start(int nb_workers = 0);
+    /* the players must have been closed */
+    void stop();
+    
+    int add(VideoState *state, double weight = PLAYER_HOST_WEIGHT_VISIBLE);
+    void remove(VideoState *state);
+    /* PLAYER_HOST_WEIGHT_HIDDEN for a player that is off screen, for instance */
+    void setWeight(VideoState *state, double weight);
+    
+    void activate(VideoState *state, int task);
+    /* returns once no worker steps the task */
+    void deactivate(VideoState *state, int task);
+    /* something the player's tasks wait for may have changed, retry them now */
+    void wake(VideoState *state);
+    
+    Stats getStats();
+    inline int getWorkerCount()const{return mWorkerCount;}
+
+private:
+    
+    struct Player {
+        VideoState *state;
+        double weight;
+        double vruntime;                /* seconds stepped divided by the weight */
+        bool active[TASK_NB];
+        bool running[TASK_NB];
+        double retryAt[TASK_NB];        /* av_gettime_relative() seconds, 0 when ready */
+    };
+    
+    static int WorkerThread(void *arg);
+    void work();
+    Player* find(VideoState *state);
+    Player* pick(double now, int *task, double *next);
+    double minVirtualRuntime();
+    
+    SDL_Thread *mWorkers[PLAYER_HOST_MAX_WORKERS];
+    int mWorkerCount;
+    std::vector<Player*> mPlayers;
+    int mStop;
+    SDL_mutex *mMutex;
+    SDL_cond *mWorkCond;
+    SDL_cond *mDoneCond;
+    std::atomic<int64_t> mSteps;
+    std::atomic<int64_t> mEmptySteps;
+    std::atomic<int64_t> mBusyTime;     /* microseconds */
+};
+
+}//end namespace ffmpeg
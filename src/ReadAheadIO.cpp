@@ -0,0 +1,321 @@
+//
+//  ReadAheadIO.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "ReadAheadIO.h"
+#include "SDLUtil.h"
+#include "FFMPEGUtil.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/common.h"
+#include "libavutil/time.h"
+}
+
+namespace ffmpeg {
+
+ReadAheadIO::ReadAheadIO():
+mFd(-1),
+mFileSize(0),
+mBlockSize(FFALIGN(av_clip(opts::readAheadBlockSize(), READ_AHEAD_MIN_BLOCK_SIZE, READ_AHEAD_MAX_BLOCK_SIZE), READ_AHEAD_ALIGN)),
+mHints(opts::readAheadHints()),
+mDirect(opts::readAheadDirect()),
+mPosition(0),
+mNextOffset(0),
+mGeneration(0),
+mStop(0),
+mThread(nullptr),
+mMutex(nullptr),
+mFilledCond(nullptr),
+mWantedCond(nullptr)
+{
+    int i;
+    for (i = 0; i < READ_AHEAD_BLOCKS; i++) {
+        mBlocks[i].data = nullptr;
+        mBlocks[i].offset = 0;
+        mBlocks[i].size = 0;
+        mBlocks[i].error = 0;
+        mBlocks[i].generation = 0;
+        mBlocks[i].state = BLOCK_EMPTY;
+    }
+}
+
+ReadAheadIO::~ReadAheadIO()
+{
+    close();
+}
+
+int ReadAheadIO::openFile(const char *path)
+{
+#ifndef _WIN32
+    struct stat st;
+    int flags = O_RDONLY;
+    int i;
+
+#ifdef O_DIRECT
+    if (mDirect)
+        flags |= O_DIRECT;
+#endif
+    if ((mFd = ::open(path, flags)) < 0 && mDirect) {
+        /* not every filesystem takes O_DIRECT */
+        av_log(NULL, AV_LOG_WARNING, "%s: direct io not available, reading through the page cache\n", path);
+        mDirect = false;
+        mFd = ::open(path, O_RDONLY);
+    }
+    if (mFd < 0)
+        return AVERROR(errno);
+#ifdef __APPLE__
+    if (mDirect)
+        fcntl(mFd, F_NOCACHE, 1);
+#endif
+    if (fstat(mFd, &st) < 0) {
+        closeFile();
+        return AVERROR(errno);
+    }
+    mFileSize = st.st_size;
+    
+    if (mHints && !mDirect) {
+#if defined(__linux__)
+        posix_fadvise(mFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+        fcntl(mFd, F_RDAHEAD, 1);
+#endif
+    }
+    
+    for (i = 0; i < READ_AHEAD_BLOCKS; i++) {
+        /* O_DIRECT wants the memory aligned like the file offsets */
+        if (posix_memalign((void**)&mBlocks[i].data, READ_AHEAD_ALIGN, mBlockSize)) {
+            closeFile();
+            return AVERROR(ENOMEM);
+        }
+    }
+    if (!(mMutex = SDL_CreateMutex()) || !(mFilledCond = SDL_CreateCond()) || !(mWantedCond = SDL_CreateCond())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex/Cond(): %s\n", SDL_GetError());
+        closeFile();
+        return AVERROR(ENOMEM);
+    }
+    mStop = 0;
+    mPosition = mNextOffset = 0;
+    if (!(mThread = SDL_CreateThread(&ReadAheadIO::PrefetchThread, "ReadAheadIO", (void*)this))) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        closeFile();
+        return AVERROR(ENOMEM);
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "%s: reading ahead %d blocks of %d KB%s\n", path,
+           READ_AHEAD_BLOCKS, mBlockSize / 1024, mDirect ? ", direct" : "");
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+void ReadAheadIO::closeFile()
+{
+    int i;
+    
+    if (mThread) {
+        {
+            sdl::ScopedLock lock(mMutex);
+            mStop = 1;
+            SDL_CondSignal(mWantedCond);
+        }
+        SDL_WaitThread(mThread, NULL);
+        mThread = nullptr;
+    }
+    SDL_DestroyCond(mFilledCond);
+    SDL_DestroyCond(mWantedCond);
+    SDL_DestroyMutex(mMutex);
+    mFilledCond = mWantedCond = nullptr;
+    mMutex = nullptr;
+    for (i = 0; i < READ_AHEAD_BLOCKS; i++) {
+        free(mBlocks[i].data);
+        mBlocks[i].data = nullptr;
+        mBlocks[i].state = BLOCK_EMPTY;
+    }
+#ifndef _WIN32
+    if (mFd >= 0)
+        ::close(mFd);
+#endif
+    mFd = -1;
+}
+
+/* the block of the current generation that holds, or is being filled with, position */
+ReadAheadIO::Block* ReadAheadIO::findBlock(int64_t position)
+{
+    int i;
+    for (i = 0; i < READ_AHEAD_BLOCKS; i++) {
+        Block *block = &mBlocks[i];
+        if (block->state != BLOCK_EMPTY && block->generation == mGeneration &&
+            position >= block->offset && position < block->offset + mBlockSize)
+            return block;
+    }
+    return nullptr;
+}
+
+/* an empty block, or one the demuxer has read past */
+ReadAheadIO::Block* ReadAheadIO::freeBlock()
+{
+    Block *found = nullptr;
+    int i;
+    for (i = 0; i < READ_AHEAD_BLOCKS; i++) {
+        Block *block = &mBlocks[i];
+        if (block->state == BLOCK_EMPTY)
+            return block;
+        if (block->state == BLOCK_READY && !found && block->offset + block->size <= mPosition)
+            found = block;
+    }
+    return found;
+}
+
+/* drops everything in flight and prefetches from position instead */
+void ReadAheadIO::restart(int64_t position)
+{
+    int i;
+    for (i = 0; i < READ_AHEAD_BLOCKS; i++)
+        if (mBlocks[i].state == BLOCK_READY)
+            mBlocks[i].state = BLOCK_EMPTY;
+    mGeneration++;
+    mNextOffset = position & ~(int64_t)(READ_AHEAD_ALIGN - 1);
+    SDL_CondSignal(mWantedCond);
+}
+
+int ReadAheadIO::PrefetchThread(void *arg)
+{
+    return ((ReadAheadIO*)arg)->prefetch();
+}
+
+int ReadAheadIO::prefetch()
+{
+#ifndef _WIN32
+    Block *block;
+    int64_t offset, next, start;
+    int size, error;
+    ssize_t n;
+    
+    for (;;) {
+        {
+            sdl::ScopedLock lock(mMutex);
+            while (!mStop && (mNextOffset >= mFileSize || !(block = freeBlock())))
+                SDL_CondWait(mWantedCond, mMutex);
+            if (mStop)
+                break;
+            block->state = BLOCK_FILLING;
+            block->offset = offset = mNextOffset;
+            block->generation = mGeneration;
+            mNextOffset += mBlockSize;
+            next = mNextOffset;
+        }
+        
+        start = av_gettime_relative();
+        size = 0;
+        error = 0;
+        while (size < mBlockSize) {
+            n = pread(mFd, block->data + size, mBlockSize - size, offset + size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                error = AVERROR(errno);
+            if (n <= 0)
+                break;
+            size += n;
+        }
+        mReadTime += av_gettime_relative() - start;
+        mBytesRead += size;
+        /* let the kernel start on what comes after the blocks in flight */
+        if (mHints && !mDirect && next < mFileSize) {
+#if defined(__linux__)
+            posix_fadvise(mFd, next, mBlockSize, POSIX_FADV_WILLNEED);
+#elif defined(__APPLE__)
+            struct radvisory advice = { (off_t)next, mBlockSize };
+            fcntl(mFd, F_RDADVISE, &advice);
+#endif
+        }
+        
+        {
+            sdl::ScopedLock lock(mMutex);
+            if (block->generation != mGeneration) {
+                block->state = BLOCK_EMPTY;
+            } else {
+                block->size = size;
+                block->error = error;
+                block->state = BLOCK_READY;
+                SDL_CondSignal(mFilledCond);
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
+int ReadAheadIO::read(uint8_t *buf, int size)
+{
+    int64_t wait_start = 0;
+    Block *block;
+    int len;
+    
+    sdl::ScopedLock lock(mMutex);
+    for (;;) {
+        if (mPosition >= mFileSize)
+            return AVERROR_EOF;
+        block = findBlock(mPosition);
+        if (block && block->state == BLOCK_READY)
+            break;
+        /* neither in flight nor next in line, the demuxer seeked away */
+        if (!block && (mPosition < mNextOffset || mPosition >= mNextOffset + mBlockSize))
+            restart(mPosition);
+        if (!wait_start) {
+            wait_start = av_gettime_relative();
+            mStalls++;
+        }
+        SDL_CondWait(mFilledCond, mMutex);
+    }
+    if (wait_start)
+        mStallTime += av_gettime_relative() - wait_start;
+    if (mPosition >= block->offset + block->size)
+        return block->error ? block->error : AVERROR_EOF;
+    
+    len = (int)FFMIN((int64_t)size, block->offset + block->size - mPosition);
+    memcpy(buf, block->data + (mPosition - block->offset), len);
+    mPosition += len;
+    /* the block may be free for the prefetch thread now */
+    if (mPosition >= block->offset + block->size)
+        SDL_CondSignal(mWantedCond);
+    return len;
+}
+
+int64_t ReadAheadIO::seek(int64_t offset, int whence)
+{
+    sdl::ScopedLock lock(mMutex);
+    switch (whence) {
+        case AVSEEK_SIZE:
+            return mFileSize;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += mPosition;
+            break;
+        case SEEK_END:
+            offset += mFileSize;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (offset < 0)
+        return AVERROR(EINVAL);
+    /* read() restarts the prefetch if this left the blocks in flight */
+    mPosition = offset;
+    SDL_CondSignal(mWantedCond);
+    return offset;
+}
+
+}//end namespace ffmpeg
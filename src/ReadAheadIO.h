@@ -0,0 +1,75 @@
+//
+//  ReadAheadIO.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include "InputIO.h"
+#include "Definitions.h"
+
+namespace ffmpeg {
+
+/* reads a local file ahead of the demuxer on a thread of its own, in large
+ * blocks of aligned memory, so a slow disk or network mount stalls the prefetch
+ * thread rather than the read thread. A seek outside the blocks in flight drops
+ * them and restarts the prefetch at the new position */
+class ReadAheadIO : public InputIO {
+public:
+    
+    ReadAheadIO();
+    ~ReadAheadIO();
+
+protected:
+    
+    int openFile(const char *path) override;
+    void closeFile() override;
+    int read(uint8_t *buf, int size) override;
+    int64_t seek(int64_t offset, int whence) override;
+
+private:
+    
+    enum BlockState {
+        BLOCK_EMPTY = 0, BLOCK_FILLING, BLOCK_READY
+    };
+    
+    struct Block {
+        uint8_t *data;
+        int64_t offset;
+        int size;
+        int error;
+        int generation;
+        BlockState state;
+    };
+    
+    static int PrefetchThread(void *arg);
+    int prefetch();
+    /* a block stands for mBlockSize bytes from its offset, even when the file
+     * ended or failed before it was filled */
+    Block* findBlock(int64_t position);
+    Block* freeBlock();
+    void restart(int64_t position);
+    
+    int mFd;
+    int64_t mFileSize;
+    int mBlockSize;
+    bool mHints;
+    bool mDirect;
+    
+    Block mBlocks[READ_AHEAD_BLOCKS];
+    int64_t mPosition;      /* of the demuxer */
+    int64_t mNextOffset;    /* where the prefetch thread reads next */
+    int mGeneration;        /* bumped by restarts, blocks read for an older one are dropped */
+    
+    int mStop;
+    SDL_Thread *mThread;
+    SDL_mutex *mMutex;
+    SDL_cond *mFilledCond;
+    SDL_cond *mWantedCond;
+};
+
+}//end namespace ffmpeg
@@ -9,6 +9,7 @@
 #include <string>
 #include <exception>
 #include <map>
+#include <atomic>
 #include "Definitions.h"
 #include "VideoState.h"
 
@@ -21,6 +22,8 @@ static bool sVideoEnabled = true;
 static bool sAudioEnabled = true;
 static int64_t sAudioCallbackTime = 0;
 static std::map<AVPixelFormat, int> sTextureFormatMap;
+static std::atomic<int64_t> sUploadCounts[util::UPLOAD_PATH_NB];
+static int sLastUploadFormat = AV_PIX_FMT_NONE;
 
 ScopedLock::ScopedLock(SDL_mutex* mutex):mMutex(mutex){
     SDL_LockMutex(mMutex);
@@ -153,6 +156,11 @@ int Startup(const char* program_name, const Settings& settings, const Window::Se
         sTextureFormatMap.insert({ AV_PIX_FMT_YUV420P,        SDL_PIXELFORMAT_IYUV });
         sTextureFormatMap.insert({ AV_PIX_FMT_YUYV422,        SDL_PIXELFORMAT_YUY2 });
         sTextureFormatMap.insert({ AV_PIX_FMT_UYVY422,        SDL_PIXELFORMAT_UYVY });
+        sTextureFormatMap.insert({ AV_PIX_FMT_NV12,           SDL_PIXELFORMAT_NV12 });
+        sTextureFormatMap.insert({ AV_PIX_FMT_NV21,           SDL_PIXELFORMAT_NV21 });
+        /* packed to 8 bit on upload, only in native endianness */
+        sTextureFormatMap.insert({ AV_PIX_FMT_P010,           SDL_PIXELFORMAT_NV12 });
+        sTextureFormatMap.insert({ AV_PIX_FMT_YUV420P10,      SDL_PIXELFORMAT_IYUV });
         sTextureFormatMap.insert({ AV_PIX_FMT_NONE,           SDL_PIXELFORMAT_UNKNOWN });
     }
     
@@ -172,7 +180,7 @@ int Startup(const char* program_name, const Settings& settings, const Window::Se
     if (SDL_Init(settings.getFlags())) {
         av_log(NULL, AV_LOG_FATAL, "Could not initialize SDL - %s\n", SDL_GetError());
         av_log(NULL, AV_LOG_FATAL, "(Did you set the DISPLAY variable?)\n");
-        exit(1);
+        return -1;
     }
     
     SDL_EventState(SDL_SYSWMEVENT, SDL_IGNORE);
@@ -312,6 +320,84 @@ void util::GetSDLPixFmtAndBlendMode(int format, Uint32 *sdl_pix_fmt, SDL_BlendMo
     }
 }
 
+/* plane start and positive pitch in memory order, the picture is flipped on render
+ * when linesizes are negative */
+static const uint8_t* PlaneInMemoryOrder(const AVFrame *frame, int plane, int height, int *pitch)
+{
+    *pitch = frame->linesize[plane];
+    if (*pitch >= 0)
+        return frame->data[plane];
+    *pitch = -*pitch;
+    return frame->data[plane] + frame->linesize[plane] * (height - 1);
+}
+
+/* keeps the top 8 of the 10 bits, p010 stores them at the top of each 16 bit
+ * sample (shift 8), yuv420p10 at the bottom (shift 2) */
+static void PackPlane(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, int shift)
+{
+    int x, y;
+    for (y = 0; y < height; y++) {
+        const uint16_t *s = (const uint16_t *)src;
+        for (x = 0; x < width; x++)
+            dst[x] = FFMIN(s[x] >> shift, 255);
+        dst += dst_pitch;
+        src += src_pitch;
+    }
+}
+
+/* writes straight into the locked texture, which has the layout SDL_UpdateTexture
+ * expects for the format: the chroma planes follow the luma plane, with half its
+ * pitch for IYUV and the same pitch, rounded up to even, for NV12 */
+static int PackTexture(SDL_Texture *tex, const AVFrame *frame, Uint32 sdl_pix_fmt)
+{
+    int chroma_w = AV_CEIL_RSHIFT(frame->width, 1), chroma_h = AV_CEIL_RSHIFT(frame->height, 1);
+    int src_pitch[3], pitch, i;
+    const uint8_t *src[3];
+    uint8_t *pixels;
+    
+    for (i = 0; i < (sdl_pix_fmt == SDL_PIXELFORMAT_IYUV ? 3 : 2); i++) {
+        src[i] = PlaneInMemoryOrder(frame, i, i ? chroma_h : frame->height, &src_pitch[i]);
+        if ((frame->linesize[i] < 0) != (frame->linesize[0] < 0)) {
+            av_log(NULL, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
+            return -1;
+        }
+    }
+    if (SDL_LockTexture(tex, NULL, (void **)&pixels, &pitch) < 0)
+        return -1;
+    PackPlane(pixels, pitch, src[0], src_pitch[0], frame->width, frame->height, sdl_pix_fmt == SDL_PIXELFORMAT_IYUV ? 2 : 8);
+    pixels += pitch * frame->height;
+    if (sdl_pix_fmt == SDL_PIXELFORMAT_IYUV) {
+        int chroma_pitch = (pitch + 1) / 2;
+        PackPlane(pixels, chroma_pitch, src[1], src_pitch[1], chroma_w, chroma_h, 2);
+        PackPlane(pixels + chroma_pitch * chroma_h, chroma_pitch, src[2], src_pitch[2], chroma_w, chroma_h, 2);
+    } else {
+        PackPlane(pixels, 2 * ((pitch + 1) / 2), src[1], src_pitch[1], 2 * chroma_w, chroma_h, 8);
+    }
+    SDL_UnlockTexture(tex);
+    return 0;
+}
+
+static void CountUpload(const AVFrame *frame, util::UploadPath path)
+{
+    sUploadCounts[path]++;
+    if (frame->format != sLastUploadFormat) {
+        av_log(NULL, AV_LOG_VERBOSE, "Uploading %s frames by %s.\n",
+               av_get_pix_fmt_name((AVPixelFormat)frame->format), util::GetUploadPathName(path));
+        sLastUploadFormat = frame->format;
+    }
+}
+
+int64_t util::GetUploadCount(UploadPath path)
+{
+    return path >= 0 && path < UPLOAD_PATH_NB ? sUploadCounts[path].load() : 0;
+}
+
+const char* util::GetUploadPathName(UploadPath path)
+{
+    static const char *names[UPLOAD_PATH_NB] = { "copy", "yuv", "nv", "pack", "convert" };
+    return path >= 0 && path < UPLOAD_PATH_NB ? names[path] : "unknown";
+}
+
 int util::UploadTexture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx) {
     int ret = 0;
     Uint32 sdl_pix_fmt;
@@ -333,20 +419,58 @@ int util::UploadTexture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **i
                               0, frame->height, pixels, pitch);
                     SDL_UnlockTexture(*tex);
                 }
+                CountUpload(frame, UPLOAD_PATH_CONVERT);
             } else {
                 av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
                 ret = -1;
             }
             break;
         case SDL_PIXELFORMAT_IYUV:
-            if (frame->linesize[0] > 0 && frame->linesize[1] > 0 && frame->linesize[2] > 0) {
+            if (frame->format == AV_PIX_FMT_YUV420P10) {
+                if ((ret = PackTexture(*tex, frame, sdl_pix_fmt)) == 0)
+                    CountUpload(frame, UPLOAD_PATH_PACK);
+            } else if (frame->linesize[0] > 0 && frame->linesize[1] > 0 && frame->linesize[2] > 0) {
                 ret = SDL_UpdateYUVTexture(*tex, NULL, frame->data[0], frame->linesize[0],
                                            frame->data[1], frame->linesize[1],
                                            frame->data[2], frame->linesize[2]);
+                CountUpload(frame, UPLOAD_PATH_YUV);
             } else if (frame->linesize[0] < 0 && frame->linesize[1] < 0 && frame->linesize[2] < 0) {
                 ret = SDL_UpdateYUVTexture(*tex, NULL, frame->data[0] + frame->linesize[0] * (frame->height                    - 1), -frame->linesize[0],
                                            frame->data[1] + frame->linesize[1] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[1],
                                            frame->data[2] + frame->linesize[2] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[2]);
+                CountUpload(frame, UPLOAD_PATH_YUV);
+            } else {
+                av_log(NULL, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
+                return -1;
+            }
+            break;
+        case SDL_PIXELFORMAT_NV12:
+        case SDL_PIXELFORMAT_NV21:
+            if (frame->format == AV_PIX_FMT_P010) {
+                if ((ret = PackTexture(*tex, frame, sdl_pix_fmt)) == 0)
+                    CountUpload(frame, UPLOAD_PATH_PACK);
+            } else if ((frame->linesize[0] < 0) == (frame->linesize[1] < 0)) {
+                const uint8_t *y, *uv;
+                int y_pitch, uv_pitch;
+                y = PlaneInMemoryOrder(frame, 0, frame->height, &y_pitch);
+                uv = PlaneInMemoryOrder(frame, 1, AV_CEIL_RSHIFT(frame->height, 1), &uv_pitch);
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+                ret = SDL_UpdateNVTexture(*tex, NULL, y, y_pitch, uv, uv_pitch);
+#else
+                {
+                    /* no SDL_UpdateNVTexture before SDL 2.0.16, copy the planes by hand */
+                    uint8_t *pixels;
+                    int pitch, i;
+                    if ((ret = SDL_LockTexture(*tex, NULL, (void **)&pixels, &pitch)) < 0)
+                        return ret;
+                    for (i = 0; i < frame->height; i++, pixels += pitch)
+                        memcpy(pixels, y + i * y_pitch, frame->width);
+                    for (i = 0; i < AV_CEIL_RSHIFT(frame->height, 1); i++, pixels += 2 * ((pitch + 1) / 2))
+                        memcpy(pixels, uv + i * uv_pitch, 2 * AV_CEIL_RSHIFT(frame->width, 1));
+                    SDL_UnlockTexture(*tex);
+                }
+#endif
+                CountUpload(frame, UPLOAD_PATH_NV);
             } else {
                 av_log(NULL, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
                 return -1;
@@ -358,6 +482,7 @@ int util::UploadTexture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **i
             } else {
                 ret = SDL_UpdateTexture(*tex, NULL, frame->data[0], frame->linesize[0]);
             }
+            CountUpload(frame, UPLOAD_PATH_COPY);
             break;
     }
     return ret;
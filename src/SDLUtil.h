@@ -144,11 +144,23 @@ namespace sdl {
     
     namespace util {
         
+        /* how UploadTexture got a frame into its texture */
+        enum UploadPath {
+            UPLOAD_PATH_COPY = 0,   /* SDL_UpdateTexture of a packed format SDL knows */
+            UPLOAD_PATH_YUV,        /* SDL_UpdateYUVTexture of yuv420p */
+            UPLOAD_PATH_NV,         /* SDL_UpdateNVTexture of nv12/nv21 */
+            UPLOAD_PATH_PACK,       /* 10 bit 4:2:0 packed to 8 bit straight into the texture */
+            UPLOAD_PATH_CONVERT,    /* sws_scale to BGRA */
+            UPLOAD_PATH_NB
+        };
+        
         void FillRectangle(int x, int y, int w, int h);
         int ReallocTexture(SDL_Texture **texture, Uint32 new_format, int new_width, int new_height, SDL_BlendMode blendmode, int init_texture);
         void CalcDisplayRect(SDL_Rect *rect, int scr_xleft, int scr_ytop, int scr_width, int scr_height, int pic_width, int pic_height, AVRational pic_sar);
         void GetSDLPixFmtAndBlendMode(int format, Uint32 *sdl_pix_fmt, SDL_BlendMode *sdl_blendmode);
         int UploadTexture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx);
+        int64_t GetUploadCount(UploadPath path);
+        const char* GetUploadPathName(UploadPath path);
         
     }//end namespace sdl::util
     
@@ -0,0 +1,205 @@
+//
+//  SharedMemorySink.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "SharedMemorySink.h"
+#include <errno.h>
+#include <new>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+namespace ffmpeg {
+
+SharedMemorySink::SharedMemorySink():
+mSlotCount(SHM_SINK_SLOTS),
+mData(nullptr),
+mSize(0),
+mHeader(nullptr),
+mSequence(0),
+mFailed(false),
+mPublished(0),
+mSkipped(0)
+{
+}
+
+SharedMemorySink::~SharedMemorySink()
+{
+    close();
+}
+
+int SharedMemorySink::open(const std::string& name, int slots)
+{
+#ifndef _WIN32
+    if (name.empty() || name.find('/', 1) != std::string::npos)
+        return AVERROR(EINVAL);
+    close();
+    /* portable shared memory names are a single leading slash and no other */
+    mName = name[0] == '/' ? name : "/" + name;
+    mSlotCount = slots > 0 ? slots : SHM_SINK_SLOTS;
+    mFailed = false;
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+void SharedMemorySink::close()
+{
+#ifndef _WIN32
+    if (mData) {
+        munmap(mData, mSize);
+        shm_unlink(mName.c_str());
+    }
+#endif
+    mData = nullptr;
+    mHeader = nullptr;
+    mSize = 0;
+    mSequence = 0;
+}
+
+/* sized for frame, the header and the slot headers are written before the
+ * magic so a reader that sees it sees them */
+int SharedMemorySink::create(const AVFrame *frame)
+{
+#ifndef _WIN32
+    uint8_t *data[4];
+    int linesize[4];
+    size_t slot_size, size;
+    void *mapping;
+    int fd, picture_size, ret, i;
+    
+    if ((picture_size = av_image_fill_arrays(data, linesize, NULL, (AVPixelFormat)frame->format,
+                                             frame->width, frame->height, SHM_SINK_ALIGN)) < 0)
+        return picture_size;
+    slot_size = FFALIGN(sizeof(Slot) + (size_t)picture_size, SHM_SINK_ALIGN);
+    size = FFALIGN(sizeof(Header), SHM_SINK_ALIGN) + slot_size * mSlotCount;
+    
+    /* a ring left by a player that did not close stays with its readers, new ones get this one */
+    shm_unlink(mName.c_str());
+    if ((fd = shm_open(mName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return AVERROR(errno);
+    if (ftruncate(fd, size) < 0) {
+        ret = AVERROR(errno);
+        ::close(fd);
+        shm_unlink(mName.c_str());
+        return ret;
+    }
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        ret = AVERROR(errno);
+        shm_unlink(mName.c_str());
+        return ret;
+    }
+    
+    mData = (uint8_t*)mapping;
+    mSize = size;
+    mSequence = 0;
+    mHeader = new (mData) Header();
+    mHeader->version = VERSION;
+    mHeader->headerSize = sizeof(Header);
+    mHeader->slotHeaderSize = sizeof(Slot);
+    mHeader->slotCount = mSlotCount;
+    mHeader->slotOffset = FFALIGN(sizeof(Header), SHM_SINK_ALIGN);
+    mHeader->slotSize = slot_size;
+    mHeader->writerPid = getpid();
+    for (i = 0; i < mSlotCount; i++)
+        new (mData + mHeader->slotOffset + slot_size * i) Slot();
+    std::atomic_thread_fence(std::memory_order_release);
+    mHeader->magic = MAGIC;
+    
+    av_log(NULL, AV_LOG_INFO, "shared memory %s: %d slots of %zu bytes for %dx%d %s\n", mName.c_str(), mSlotCount,
+           slot_size, frame->width, frame->height, av_get_pix_fmt_name((AVPixelFormat)frame->format));
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
+void SharedMemorySink::onFrame(AVFrame *frame, const Info& info)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    uint8_t *data[4];
+    int linesize[4];
+    Slot *slot;
+    uint64_t n;
+    int size, ret, i;
+    
+    if (mName.empty() || mFailed || !desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+        mSkipped++;
+        return;
+    }
+    if (!mData && (ret = create(frame)) < 0) {
+        char errbuf[128];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        av_log(NULL, AV_LOG_ERROR, "shared memory %s: %s, no pictures will be published\n", mName.c_str(), errbuf);
+        mFailed = true;
+        mSkipped++;
+        return;
+    }
+    
+    n = mSequence + 1;
+    slot = (Slot*)(mData + mHeader->slotOffset + mHeader->slotSize * ((n - 1) % mHeader->slotCount));
+    size = av_image_fill_arrays(data, linesize, (uint8_t*)(slot + 1), (AVPixelFormat)frame->format,
+                                frame->width, frame->height, SHM_SINK_ALIGN);
+    if (size < 0 || sizeof(Slot) + (size_t)size > mHeader->slotSize) {
+        if (!mSkipped)
+            av_log(NULL, AV_LOG_WARNING, "shared memory %s: a %dx%d %s picture does not fit the slots, skipped\n",
+                   mName.c_str(), frame->width, frame->height, desc->name);
+        mSkipped++;
+        return;
+    }
+    
+    /* odd: readers that get to the slot now know to leave it */
+    slot->sequence.store(2 * n - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    slot->pts = frame->pts;
+    slot->timeBaseNum = info.timeBase.num;
+    slot->timeBaseDen = info.timeBase.den;
+    slot->ptsSeconds = info.pts;
+    slot->duration = info.duration;
+    slot->serial = info.serial;
+    slot->format = frame->format;
+    av_strlcpy(slot->formatName, desc->name, sizeof(slot->formatName));
+    slot->width = frame->width;
+    slot->height = frame->height;
+    slot->sarNum = frame->sample_aspect_ratio.num;
+    slot->sarDen = frame->sample_aspect_ratio.den;
+    slot->planes = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    for (i = 0; i < 4; i++) {
+        slot->linesize[i] = linesize[i];
+        slot->offset[i] = data[i] ? (uint64_t)(data[i] - (uint8_t*)slot) : 0;
+    }
+    slot->size = size;
+    av_image_copy(data, linesize, (const uint8_t**)frame->data, frame->linesize,
+                  (AVPixelFormat)frame->format, frame->width, frame->height);
+    
+    slot->sequence.store(2 * n, std::memory_order_release);
+    mHeader->sequence.store(n, std::memory_order_release);
+    mSequence = n;
+    mPublished++;
+}
+
+void SharedMemorySink::onEnd()
+{
+    if (mHeader)
+        mHeader->ended.store(1, std::memory_order_release);
+}
+
+}//end namespace ffmpeg
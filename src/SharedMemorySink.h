@@ -0,0 +1,108 @@
+//
+//  SharedMemorySink.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include "FrameSink.h"
+#include "Definitions.h"
+#include <atomic>
+#include <string>
+
+namespace ffmpeg {
+
+/* publishes the pictures a VideoState shows into a POSIX shared memory ring, for
+ * a process on the same host to read them out of its own mapping of it. Attach
+ * it with addFrameSink(sink, AVMEDIA_TYPE_VIDEO, size, FrameSink::TAP_DISPLAYED).
+ *
+ * The object is named as given to open(), "/ffplayer" for instance, and is laid
+ * out as a Header followed by Header::slotCount slots of Header::slotSize bytes,
+ * the first at Header::slotOffset. Each slot is a Slot followed by the planes of
+ * one picture at Slot::offset[] from the start of the slot. Everything is
+ * aligned to SHM_SINK_ALIGN bytes so slots never share a cache line.
+ *
+ * Picture n, counting from 1, goes to slot (n - 1) % slotCount. Its Slot::sequence
+ * is 2n - 1 while it is written and 2n once it is complete, and Header::sequence
+ * is n once it is. A reader takes n from Header::sequence, loads the slot's
+ * sequence with acquire ordering, reads the picture in place if it is 2n, then
+ * loads it again after an acquire fence: if it changed the writer lapped the
+ * reader and what it read is torn, it retries with the newest picture. The writer
+ * never waits for readers.
+ *
+ * The ring is created for the first picture, with slots big enough for it; later
+ * pictures that do not fit are counted and skipped. A new ring for a changed size
+ * would leave readers mapped to the old one */
+class SharedMemorySink : public FrameSink {
+public:
+    
+    enum {
+        MAGIC = 0x52534646,     /* "FFSR" */
+        VERSION = 1
+    };
+    
+    struct alignas(SHM_SINK_ALIGN) Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t headerSize;    /* sizeof(Header) */
+        uint32_t slotHeaderSize;/* sizeof(Slot) */
+        uint32_t slotCount;
+        std::atomic<uint32_t> ended;        /* set once no pictures follow */
+        uint64_t slotOffset;
+        uint64_t slotSize;
+        int64_t writerPid;
+        std::atomic<uint64_t> sequence;     /* the newest complete picture */
+    };
+    
+    struct alignas(SHM_SINK_ALIGN) Slot {
+        std::atomic<uint64_t> sequence;     /* odd while the picture is written */
+        int64_t pts;            /* frame->pts in timeBase units, AV_NOPTS_VALUE if unknown */
+        int32_t timeBaseNum;
+        int32_t timeBaseDen;
+        double ptsSeconds;      /* NAN if unknown */
+        double duration;        /* seconds, 0 if unknown */
+        int32_t serial;         /* packet serial, a new one starts with each seek */
+        int32_t format;         /* an AVPixelFormat */
+        char formatName[32];    /* av_get_pix_fmt_name(), the enum values change between FFmpeg majors */
+        int32_t width;
+        int32_t height;
+        int32_t sarNum;
+        int32_t sarDen;
+        int32_t planes;
+        int32_t linesize[4];
+        uint64_t offset[4];     /* of each plane, from the start of the slot */
+        uint64_t size;          /* bytes of picture data after the Slot */
+    };
+    
+    SharedMemorySink();
+    ~SharedMemorySink();
+    
+    /* the ring itself is created by the first picture, slots <= 0 for SHM_SINK_SLOTS */
+    int open(const std::string& name, int slots = 0);
+    /* unmaps and unlinks the ring, readers that still map it keep their mapping */
+    void close();
+    
+    void onFrame(AVFrame *frame, const Info& info) override;
+    void onEnd() override;
+    
+    inline int64_t getPublished()const{return mPublished;}
+    inline int64_t getSkipped()const{return mSkipped;}
+
+private:
+    
+    int create(const AVFrame *frame);
+    
+    std::string mName;
+    int mSlotCount;
+    uint8_t *mData;
+    size_t mSize;
+    Header *mHeader;
+    uint64_t mSequence;
+    bool mFailed;
+    std::atomic<int64_t> mPublished;
+    std::atomic<int64_t> mSkipped;      /* pictures that did not fit a slot or could not be copied */
+};
+
+}//end namespace ffmpeg
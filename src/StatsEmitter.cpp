@@ -0,0 +1,217 @@
+//
+//  StatsEmitter.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "StatsEmitter.h"
+#include "SDLUtil.h"
+#include "FFMPEGUtil.h"
+#include <errno.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/mem.h"
+}
+
+namespace ffmpeg {
+
+StatsEmitter::StatsEmitter():
+mState(nullptr),
+mInterval(STATS_EMIT_INTERVAL),
+mFile(nullptr),
+mSocket(-1),
+mStop(0),
+mThread(nullptr),
+mMutex(nullptr),
+mCondVar(nullptr)
+{
+}
+
+StatsEmitter::~StatsEmitter()
+{
+    stop();
+}
+
+int StatsEmitter::start(VideoState *state, const std::string& target, double interval)
+{
+    int ret;
+    
+    if (mThread)
+        return AVERROR(EBUSY);
+    
+    mState = state;
+    mTarget = target;
+    mInterval = interval > 0 ? interval : STATS_EMIT_INTERVAL;
+    mStop = 0;
+    if ((ret = openTarget()) < 0 && ret != AVERROR(EAGAIN))
+        return ret;
+    
+    if (!(mMutex = SDL_CreateMutex()) || !(mCondVar = SDL_CreateCond())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex/Cond(): %s\n", SDL_GetError());
+        stop();
+        return AVERROR(ENOMEM);
+    }
+    mThread = SDL_CreateThread(&StatsEmitter::EmitThread, "StatsEmitter", (void*)this);
+    if (!mThread) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+        stop();
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+void StatsEmitter::stop()
+{
+    if (mThread) {
+        {
+            sdl::ScopedLock lock(mMutex);
+            mStop = 1;
+            SDL_CondSignal(mCondVar);
+        }
+        SDL_WaitThread(mThread, NULL);
+        mThread = nullptr;
+    }
+    if (mFile) {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+#ifndef _WIN32
+    if (mSocket >= 0) {
+        close(mSocket);
+        mSocket = -1;
+    }
+#endif
+    SDL_DestroyCond(mCondVar);
+    SDL_DestroyMutex(mMutex);
+    mCondVar = nullptr;
+    mMutex = nullptr;
+}
+
+int StatsEmitter::openTarget()
+{
+    if (!mTarget.compare(0, 5, "unix:")) {
+#ifndef _WIN32
+        struct sockaddr_un addr = {};
+        std::string path = mTarget.substr(5);
+        
+        if (path.size() >= sizeof(addr.sun_path)) {
+            av_log(NULL, AV_LOG_ERROR, "stats socket path too long: %s\n", path.c_str());
+            return AVERROR(EINVAL);
+        }
+        if (mSocket < 0 && (mSocket = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+            return AVERROR(errno);
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        /* the collector may not be listening yet, emit() keeps trying */
+        if (connect(mSocket, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            return AVERROR(EAGAIN);
+        return 0;
+#else
+        return AVERROR(ENOSYS);
+#endif
+    }
+    
+    if (!mFile && !(mFile = fopen(mTarget.c_str(), "a"))) {
+        int ret = AVERROR(errno);
+        PrintError(mTarget.c_str(), ret);
+        return ret;
+    }
+    return 0;
+}
+
+int StatsEmitter::emit(const char *line, int len)
+{
+    if (mFile) {
+        if (fwrite(line, 1, len, mFile) != (size_t)len || fflush(mFile))
+            return AVERROR(errno);
+        return 0;
+    }
+#ifndef _WIN32
+    if (mSocket >= 0) {
+        /* never block the emitter on a slow collector, the next snapshot supersedes this one */
+        if (send(mSocket, line, len, MSG_DONTWAIT) < 0) {
+            if (errno == ECONNREFUSED || errno == ENOTCONN || errno == EDESTADDRREQ || errno == ENOENT)
+                openTarget();
+            return AVERROR(errno);
+        }
+        return 0;
+    }
+#endif
+    return AVERROR(EINVAL);
+}
+
+int StatsEmitter::Format(const VideoState::Stats& s, char *buf, int size)
+{
+    return snprintf(buf, size,
+                    "{\"time\":%" PRId64 ",\"frame_drops_early\":%d,\"frame_drops_late\":%d,"
+                    "\"video_queue\":{\"packets\":%d,\"bytes\":%d,\"duration\":%.3f},"
+                    "\"audio_queue\":{\"packets\":%d,\"bytes\":%d,\"duration\":%.3f},"
+                    "\"subtitle_queue\":{\"packets\":%d,\"bytes\":%d,\"duration\":%.3f},"
+                    "\"picture_queue\":{\"frames\":%d,\"size\":%d},\"sample_queue\":{\"frames\":%d},"
+                    "\"av_drift\":%.6f,\"audio_underruns\":%d,\"audio_ring_fill\":%d,"
+                    "\"audio_latency\":%.6f,\"audio_jitter\":%.6f,"
+                    "\"uploads\":{\"copy\":%" PRId64 ",\"yuv\":%" PRId64 ",\"nv\":%" PRId64 ",\"pack\":%" PRId64 ",\"convert\":%" PRId64 "},\"converted_frames\":%" PRId64 ","
+                    "\"uploaded_ahead\":%" PRId64 ",\"uploaded_on_display\":%" PRId64 ","
+                    "\"startup\":{\"open\":%.3f,\"first_frame\":%.3f},"
+                    "\"io\":{\"bytes\":%" PRId64 ",\"read_time\":%.3f,\"stalls\":%d,\"stall_time\":%.3f},"
+                    "\"sinks\":{\"count\":%d,\"queued\":%" PRId64 ",\"dropped\":%" PRId64 "},"
+                    "\"seek\":{\"keyframes\":%d,\"indexed\":%d,\"frames_discarded\":%" PRId64 "},"
+                    "\"external_clock\":{\"adjustments\":%d,\"speed\":%.3f}}\n",
+                    s.time, s.frameDropsEarly, s.frameDropsLate,
+                    s.videoQueue.packets, s.videoQueue.bytes, s.videoQueue.duration,
+                    s.audioQueue.packets, s.audioQueue.bytes, s.audioQueue.duration,
+                    s.subtitleQueue.packets, s.subtitleQueue.bytes, s.subtitleQueue.duration,
+                    s.pictureQueueFrames, s.pictureQueueSize, s.sampleQueueFrames,
+                    s.avDrift, s.audioUnderruns, s.audioRingFill,
+                    s.audioLatency, s.audioJitter,
+                    s.uploads[sdl::util::UPLOAD_PATH_COPY], s.uploads[sdl::util::UPLOAD_PATH_YUV], s.uploads[sdl::util::UPLOAD_PATH_NV],
+                    s.uploads[sdl::util::UPLOAD_PATH_PACK], s.uploads[sdl::util::UPLOAD_PATH_CONVERT], s.convertedFrames,
+                    s.picturesUploadedAhead, s.picturesUploadedOnDisplay,
+                    s.timeToOpen, s.timeToFirstFrame,
+                    s.io.bytesRead, s.io.readTime, s.io.stalls, s.io.stallTime,
+                    s.frameSinks, s.sinkFramesQueued, s.sinkFramesDropped,
+                    s.keyframes, s.seeksIndexed, s.seekFramesDiscarded,
+                    s.externalClockAdjustments, s.externalClockSpeed);
+}
+
+int StatsEmitter::EmitThread(void *arg)
+{
+    StatsEmitter *emitter = (StatsEmitter*)arg;
+    VideoState::Stats stats;
+    char line[STATS_LINE_SIZE], *buf;
+    int len;
+    
+    for (;;) {
+        {
+            sdl::ScopedLock lock(emitter->mMutex);
+            if (!emitter->mStop)
+                SDL_CondWaitTimeout(emitter->mCondVar, emitter->mMutex, (Uint32)(emitter->mInterval * 1000));
+            if (emitter->mStop)
+                break;
+        }
+        stats = emitter->mState->getStats();
+        len = Format(stats, line, sizeof(line));
+        if (len >= (int)sizeof(line)) {
+            /* the counters outgrew the line, format this one again at its full length */
+            if ((buf = (char*)av_malloc(len + 1)) && Format(stats, buf, len + 1) == len)
+                emitter->emit(buf, len);
+            else
+                av_log(NULL, AV_LOG_WARNING, "StatsEmitter: dropped a %d byte stats line\n", len);
+            av_free(buf);
+        } else if (len > 0) {
+            emitter->emit(line, len);
+        } else {
+            av_log(NULL, AV_LOG_WARNING, "StatsEmitter: could not format the stats line\n");
+        }
+    }
+    return 0;
+}
+
+}//end namespace ffmpeg
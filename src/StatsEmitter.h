@@ -0,0 +1,50 @@
+//
+//  StatsEmitter.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <string>
+#include <stdio.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+#include "Definitions.h"
+#include "VideoState.h"
+
+namespace ffmpeg {
+
+/* periodically writes VideoState::getStats() as one JSON object per line, either
+ * appended to a file or, for a target of the form "unix:/path", sent as a datagram
+ * to a unix socket; stop() it before the VideoState is closed */
+class StatsEmitter {
+public:
+    
+    StatsEmitter();
+    ~StatsEmitter();
+    
+    int start(VideoState *state, const std::string& target, double interval = STATS_EMIT_INTERVAL);
+    void stop();
+    
+    static int Format(const VideoState::Stats& stats, char *buf, int size);
+
+private:
+    
+    static int EmitThread(void *arg);
+    int openTarget();
+    int emit(const char *line, int len);
+    
+    VideoState *mState;
+    std::string mTarget;
+    double mInterval;
+    FILE *mFile;
+    int mSocket;
+    int mStop;
+    SDL_Thread *mThread;
+    SDL_mutex *mMutex;
+    SDL_cond *mCondVar;
+};
+
+}//end namespace ffmpeg
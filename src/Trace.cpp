@@ -0,0 +1,284 @@
+//
+//  Trace.cpp
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#include "Trace.h"
+#include "Definitions.h"
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+#include <new>
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+extern "C" {
+#include "libavutil/avutil.h"
+}
+
+namespace ffmpeg {
+namespace trace {
+
+    /* each thread writes only to its own ring, so recording needs no lock; dumps
+     * read the rings concurrently and drop whatever may have been overwritten
+     * while they were copying. A thread's ring goes on the free list when the
+     * thread exits and the next thread that records takes it over, its head
+     * keeps counting so dumps see what the old owner wrote as overwritten */
+    struct ThreadRing {
+        ThreadRing *next;
+        ThreadRing *nextFree;
+        uint64_t thread;        /* the owner, and name, change under sRingsLock */
+        char name[16];
+        std::atomic<uint64_t> head;
+        Event events[TRACE_RING_SIZE];
+    };
+    
+    /* hands the ring of an exiting thread back */
+    struct RingHolder {
+        ThreadRing *ring;
+        RingHolder():ring(nullptr){}
+        ~RingHolder();
+    };
+    
+    std::atomic<bool> sEnabled(false);
+    static std::atomic<int64_t> sResetTime(0);
+    static ThreadRing *sRings = nullptr;
+    static ThreadRing *sFreeRings = nullptr;
+    static SDL_SpinLock sRingsLock = 0;
+    static thread_local RingHolder tRing;
+    
+    RingHolder::~RingHolder()
+    {
+        if (!ring)
+            return;
+        SDL_AtomicLock(&sRingsLock);
+        ring->nextFree = sFreeRings;
+        sFreeRings = ring;
+        SDL_AtomicUnlock(&sRingsLock);
+    }
+    
+    static const char *sStageNames[STAGE_NB] = {
+        "read", "packet_put", "packet_get", "decode", "frame_push", "display", "upload"
+    };
+    
+    void Enable(bool set)
+    {
+        sEnabled = set;
+    }
+    
+    const char* StageName(int stage)
+    {
+        return stage >= 0 && stage < STAGE_NB ? sStageNames[stage] : "unknown";
+    }
+    
+    static ThreadRing* GetThreadRing()
+    {
+        uint64_t thread = SDL_ThreadID();
+        ThreadRing *ring;
+        char name[16];
+        
+#if defined(__linux__) || defined(__APPLE__)
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)))
+#endif
+            snprintf(name, sizeof(name), "thread %lu", (unsigned long)thread);
+        
+        SDL_AtomicLock(&sRingsLock);
+        if ((ring = sFreeRings)) {
+            sFreeRings = ring->nextFree;
+            ring->thread = thread;
+            memcpy(ring->name, name, sizeof(name));
+        }
+        SDL_AtomicUnlock(&sRingsLock);
+        if (ring)
+            return ring;
+        
+        if (!(ring = new (std::nothrow) ThreadRing()))
+            return nullptr;
+        ring->thread = thread;
+        memcpy(ring->name, name, sizeof(name));
+        ring->head = 0;
+        SDL_AtomicLock(&sRingsLock);
+        ring->next = sRings;
+        sRings = ring;
+        SDL_AtomicUnlock(&sRingsLock);
+        return ring;
+    }
+    
+    void Record(Stage stage, int64_t start, int stream, int64_t pts)
+    {
+        ThreadRing *ring = tRing.ring;
+        Event *event;
+        uint64_t head;
+        
+        if (!start || !IsEnabled())
+            return;
+        if (!ring && !(ring = tRing.ring = GetThreadRing()))
+            return;
+        
+        head = ring->head.load(std::memory_order_relaxed);
+        event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+        event->time = start;
+        event->duration = av_gettime_relative() - start;
+        event->pts = pts;
+        event->stage = stage;
+        event->stream = stream;
+        event->thread = ring->thread;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+    
+    void Reset()
+    {
+        sResetTime = av_gettime_relative();
+    }
+    
+    static ThreadRing* FirstRing()
+    {
+        ThreadRing *rings;
+        SDL_AtomicLock(&sRingsLock);
+        rings = sRings;
+        SDL_AtomicUnlock(&sRingsLock);
+        return rings;
+    }
+    
+    /* the current owner of ring, name gets 16 bytes */
+    static uint64_t RingOwner(ThreadRing *ring, char *name)
+    {
+        uint64_t thread;
+        SDL_AtomicLock(&sRingsLock);
+        thread = ring->thread;
+        if (name)
+            memcpy(name, ring->name, sizeof(ring->name));
+        SDL_AtomicUnlock(&sRingsLock);
+        return thread;
+    }
+    
+    static void WriteJSONString(FILE *f, const char *str, size_t size)
+    {
+        size_t i;
+        
+        fputc('"', f);
+        for (i = 0; i < size && str[i]; i++) {
+            unsigned char c = (unsigned char)str[i];
+            if (c == '"' || c == '\\')
+                fprintf(f, "\\%c", c);
+            else if (c < 0x20)
+                fprintf(f, "\\u%04x", c);
+            else
+                fputc(c, f);
+        }
+        fputc('"', f);
+    }
+    
+    static void Snapshot(std::vector<Event>& events)
+    {
+        int64_t reset_time = sResetTime;
+        ThreadRing *ring;
+        
+        for (ring = FirstRing(); ring; ring = ring->next) {
+            uint64_t owner = RingOwner(ring, nullptr);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+            size_t start = events.size();
+            uint64_t i;
+            
+            for (i = first; i < head; i++)
+                events.push_back(ring->events[i & (TRACE_RING_SIZE - 1)]);
+            
+            /* the writer may have lapped us while copying, the record at head - TRACE_RING_SIZE
+             * included, it is the one a write in progress at head overwrites */
+            head = ring->head.load(std::memory_order_acquire);
+            if (head >= TRACE_RING_SIZE && head - TRACE_RING_SIZE >= first) {
+                size_t torn = (size_t)FFMIN(head - TRACE_RING_SIZE + 1 - first, events.size() - start);
+                events.erase(events.begin() + start, events.begin() + start + torn);
+            }
+            /* what the threads that had the ring before recorded has no name in the dump */
+            events.erase(std::remove_if(events.begin() + start, events.end(), [owner](const Event& e){ return e.thread != owner; }), events.end());
+        }
+        events.erase(std::remove_if(events.begin(), events.end(), [reset_time](const Event& e){ return e.time < reset_time; }), events.end());
+        std::sort(events.begin(), events.end(), [](const Event& a, const Event& b){ return a.time < b.time; });
+    }
+    
+    /* chrome://tracing / Perfetto "trace event" format, one complete event per record */
+    int DumpJSON(const char *filename)
+    {
+        std::vector<Event> events;
+        ThreadRing *ring;
+        FILE *f;
+        size_t i;
+        
+        if (!(f = fopen(filename, "w")))
+            return AVERROR(errno);
+        
+        Snapshot(events);
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (ring = FirstRing(); ring; ring = ring->next) {
+            char name[sizeof(ring->name)];
+            uint64_t thread = RingOwner(ring, name);
+            fprintf(f, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%" PRIu64 ",\"args\":{\"name\":", thread);
+            WriteJSONString(f, name, sizeof(name));
+            fprintf(f, "}},\n");
+        }
+        for (i = 0; i < events.size(); i++) {
+            const Event& e = events[i];
+            fprintf(f, "{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"ffplayer\",\"pid\":1,\"tid\":%" PRIu64 ",\"ts\":%" PRId64 ",\"dur\":%" PRId64 ",\"args\":{\"stream\":%d,\"pts\":%" PRId64 "}}%s\n",
+                    StageName(e.stage), e.thread, e.time, e.duration, e.stream, e.pts,
+                    i + 1 < events.size() ? "," : "");
+        }
+        fprintf(f, "]}\n");
+        
+        if (fclose(f))
+            return AVERROR(errno);
+        return 0;
+    }
+    
+    /* "FFTRACE" magic, uint32 version, uint32 thread count, uint64 event count,
+     * then per thread a uint64 id and a 16 byte name, then the Event records;
+     * everything in host byte order */
+    int DumpBinary(const char *filename)
+    {
+        static const char magic[8] = "FFTRACE";
+        std::vector<Event> events;
+        ThreadRing *ring;
+        uint32_t version = 1, nb_threads = 0;
+        uint64_t nb_events;
+        FILE *f;
+        
+        if (!(f = fopen(filename, "wb")))
+            return AVERROR(errno);
+        
+        Snapshot(events);
+        for (ring = FirstRing(); ring; ring = ring->next)
+            nb_threads++;
+        nb_events = events.size();
+        
+        fwrite(magic, sizeof(magic), 1, f);
+        fwrite(&version, sizeof(version), 1, f);
+        fwrite(&nb_threads, sizeof(nb_threads), 1, f);
+        fwrite(&nb_events, sizeof(nb_events), 1, f);
+        for (ring = FirstRing(); ring; ring = ring->next) {
+            char name[sizeof(ring->name)];
+            uint64_t thread = RingOwner(ring, name);
+            fwrite(&thread, sizeof(thread), 1, f);
+            fwrite(name, sizeof(name), 1, f);
+        }
+        if (nb_events)
+            fwrite(&events[0], sizeof(Event), events.size(), f);
+        
+        if (ferror(f)) {
+            fclose(f);
+            return AVERROR(EIO);
+        }
+        if (fclose(f))
+            return AVERROR(errno);
+        return 0;
+    }
+
+}//end namespace ffmpeg::trace
+}//end namespace ffmpeg
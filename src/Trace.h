@@ -0,0 +1,62 @@
+//
+//  Trace.h
+//  sixmonths
+//
+//  Created by Michael Allison on 4/19/18.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+extern "C" {
+#include "libavutil/time.h"
+}
+
+namespace ffmpeg {
+namespace trace {
+
+    /* stage boundaries a packet or frame goes through on its way to the screen */
+    enum Stage {
+        STAGE_READ = 0,     /* av_read_frame in the read thread */
+        STAGE_PACKET_PUT,   /* PacketQueue::put, including waiting for room */
+        STAGE_PACKET_GET,   /* PacketQueue::getBatch, including waiting for packets */
+        STAGE_DECODE,       /* a successful avcodec_receive_frame */
+        STAGE_FRAME_PUSH,   /* FrameQueue::push */
+        STAGE_DISPLAY,      /* drawing a picture from videoRefresh */
+        STAGE_UPLOAD,       /* UploadTexture of a picture */
+        STAGE_NB
+    };
+    
+    /* one record, this is also the layout of the binary dump; pts is in the stream
+     * time base except for decoded audio frames, which are in 1/sample_rate */
+    struct Event {
+        int64_t time;       /* start, av_gettime_relative() microseconds */
+        int64_t duration;   /* microseconds */
+        int64_t pts;
+        int32_t stage;
+        int32_t stream;     /* stream index */
+        uint64_t thread;    /* SDL_ThreadID() of the recording thread */
+    };
+    
+    extern std::atomic<bool> sEnabled;
+    
+    void Enable(bool set = true);
+    inline bool IsEnabled(){ return sEnabled.load(std::memory_order_relaxed); }
+    const char* StageName(int stage);
+    
+    /* take the start time of a stage, 0 if tracing is off so Record() is a no-op */
+    inline int64_t Begin(){ return IsEnabled() ? av_gettime_relative() : 0; }
+    
+    /* record a stage that started at start (from Begin()) and ends now, into the
+     * calling thread's ring; the oldest events are overwritten once it is full */
+    void Record(Stage stage, int64_t start, int stream, int64_t pts);
+    
+    /* dump every thread's ring, can be called while the other threads keep tracing */
+    int DumpJSON(const char *filename);
+    int DumpBinary(const char *filename);
+    void Reset();
+
+}//end namespace ffmpeg::trace
+}//end namespace ffmpeg
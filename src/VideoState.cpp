@@ -8,11 +8,18 @@
 #include "VideoState.h"
 #include "SDLUtil.h"
 #include "FFMPEGUtil.h"
+#include "Trace.h"
+#include "PlayerHost.h"
 
 namespace ffmpeg {
     
     VideoState::VideoState():
         mReadThread(nullptr),
+        mHost(nullptr),
+        mHostTasksBegun(0),
+        mReadWaitMutex(nullptr),
+        mVideoTask(),
+        mAudioTask(),
         mInputFormat(nullptr),
         mFormatOptions(nullptr),
         mCodecOptions(nullptr),
@@ -26,9 +33,37 @@ namespace ffmpeg {
         mSeekPosition(0),
         mSeekRel(0),
         mSeekByBytes(false),
+        mKeyframeScanThread(nullptr),
+        mSeeksIndexed(0),
+        mAccurateSeekTarget(NAN),
+        mSeekFramesDiscarded(0),
         mReadPauseReturn(0),
         mFormatContext(nullptr),
+        mInputIO(nullptr),
+        mInputIOStats(),
+        mInputIOMutex(nullptr),
+        mStreamInfoThread(nullptr),
+        mProbedFormatContext(nullptr),
+        mStreamInfoProbed(0),
+        mStreamInfo(nullptr),
+        mOpenTime(0),
+        mTimeToOpen(-1.0),
+        mTimeToFirstFrame(-1.0),
         mRealtime(0),
+        mReadThreadDone(0),
+        mHeadless(false),
+        mHeadlessStop(0),
+        mHeadlessVideoFrames(0),
+        mHeadlessAudioSamples(0),
+        mPictureQueueSize(opts::videoPictureQueueSize()),
+        mAdaptivePictureQueue(opts::adaptivePictureQueue()),
+        mPictureQueueMemoryLimit(opts::pictureQueueMemoryLimit()),
+        mAdaptFrameDropsLate(0),
+        mAdaptTime(0.0),
+        mFrameSinkMutex(nullptr),
+        mNumFrameSinks(0),
+        mSinkFramesQueued(0),
+        mSinkFramesDropped(0),
         mAudioStream(-1),
         mSyncType(AV_SYNC_VIDEO_MASTER),
         mAudioClockTime(0.0),
@@ -38,18 +73,25 @@ namespace ffmpeg {
         mAudioDiffThresh(0.0),
         mAudioDiffAvgCount(0),
         mAudioAVStream(nullptr),
+        mAudioTimeBase(0.0),
         mAudioHWBufferSize(0),
-        mAudioBufferSize(0),
         mAudioBuffer(nullptr),
         mAudioBuffer1Size(0),
         mAudioBuffer1(nullptr),
-        mAudioBufferIndex(0),
-        mAudioWriteBufferSize(0),
+        mAudioPlayDevicePosition(0),
+        mAudioDevicePosition(0),
+        mAudioRenderThread(nullptr),
+        mAudioRenderStop(0),
         mAudioVolume(0),
         mMuted(0),
         mSwrCtx(nullptr),
         mFrameDropsEarly(0),
         mFrameDropsLate(0),
+        mAudioUnderruns(0),
+        mConvertedFrames(0),
+        mExternalClockAdjustments(0),
+        mExternalClockSpeed(1.0),
+        mAVDrift(0.0),
         mShowMode(ShowMode::SHOW_MODE_NONE),
         mSampleArrayIndex(0),
         mLast_i_Start(0),
@@ -60,14 +102,19 @@ namespace ffmpeg {
         mLastDisplayTime(0.0),
         mAudioVizTexture(nullptr),
         mSubtitleTexture(nullptr),
-        mVideoTexture(nullptr),
+        mVideoTextures(),
+        mPictureSequence(0),
+        mPicturesUploadedAhead(0),
+        mPicturesUploadedOnDisplay(0),
         mSubtileStream(-1),
         mSubtitleAVStream(nullptr),
+        mSubtitleTimeBase(0.0),
         mFrameTimer(0.0),
         mFrameLastReturnedTime(0.0),
         mFrameLastFilterDelay(0.0),
         mVideoStream(-1),
         mVideoAVStream(nullptr),
+        mVideoTimeBase(0.0),
         mMaxFrameDuration(0.0),
         mImageConvertContext(nullptr),
         mSubConvertContext(nullptr),
@@ -83,11 +130,21 @@ namespace ffmpeg {
         mLastAudioStream(-1),
         mLastSubtitleStream(-1),
         mContinueReadThread(nullptr)
-    {}
+    {
+        for (int i = 0; i < AVMEDIA_TYPE_NB; i++)
+            mDecoderThreading[i] = opts::decoderThreading((AVMediaType)i);
+        /* sinks may be added before streamOpen() */
+        if (!(mFrameSinkMutex = SDL_CreateMutex()) || !(mInputIOMutex = SDL_CreateMutex()))
+            av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
+    }
     
     VideoState::~VideoState()
     {
-        
+        if (mHost)
+            mHost->remove(this);
+        removeFrameSinks();
+        SDL_DestroyMutex(mFrameSinkMutex);
+        SDL_DestroyMutex(mInputIOMutex);
     }
     
     int VideoState::DecodeInterruptCallback(void *ctx)
@@ -112,6 +169,182 @@ namespace ffmpeg {
         
     }
     
+    void VideoState::setPictureQueueSize(int size)
+    {
+        mPictureQueueSize = av_clip(size, 2, VIDEO_PICTURE_QUEUE_MAX_SIZE);
+        if (mPictureQueue.getCapacity())
+            mPictureQueue.resize(mPictureQueueSize);
+    }
+    
+    /* grow the picture queue by one frame each time frames are dropped late, and give
+     * the frames back once playback has been smooth for a while or the decoded
+     * pictures held would exceed the memory limit; never goes below mPictureQueueSize */
+    void VideoState::adaptPictureQueueSize()
+    {
+        Frame *lastvp = mPictureQueue.peekLast();
+        int size = mPictureQueue.getMaxSize();
+        int limit = mPictureQueue.getCapacity();
+        int frame_size = 0;
+        double time = av_gettime_relative() / 1000000.0;
+        
+        if (lastvp->width > 0 && lastvp->height > 0 && lastvp->format >= 0)
+            frame_size = av_image_get_buffer_size((AVPixelFormat)lastvp->format, lastvp->width, lastvp->height, 1);
+        if (frame_size > 0)
+            limit = (int)FFMIN(limit, FFMAX(mPictureQueueSize, mPictureQueueMemoryLimit / frame_size));
+        
+        if (mFrameDropsLate > mAdaptFrameDropsLate) {
+            mAdaptFrameDropsLate = mFrameDropsLate;
+            mAdaptTime = time;
+            size++;
+        } else if (size > mPictureQueueSize && time - mAdaptTime > PICTURE_QUEUE_SHRINK_DELAY) {
+            mAdaptTime = time;
+            size--;
+        }
+        size = FFMIN(size, limit);
+        
+        if (size != mPictureQueue.getMaxSize()) {
+            av_log(NULL, AV_LOG_VERBOSE, "picture queue %d -> %d frames (late drops %d)\n",
+                   mPictureQueue.getMaxSize(), size, mFrameDropsLate.load());
+            mPictureQueue.resize(size);
+        }
+    }
+    
+    static void GetQueueStats(VideoState::QueueStats *stats, PacketQueue *queue, double time_base)
+    {
+        stats->packets = queue->getNumPackets();
+        stats->bytes = queue->size();
+        stats->duration = queue->getDuration() * time_base;
+    }
+    
+    VideoState::Stats VideoState::getStats()
+    {
+        Stats stats = {};
+        
+        stats.time = av_gettime_relative();
+        stats.frameDropsEarly = mFrameDropsEarly;
+        stats.frameDropsLate = mFrameDropsLate;
+        GetQueueStats(&stats.videoQueue, &mVideoPacketQueue, mVideoTimeBase);
+        GetQueueStats(&stats.audioQueue, &mAudioPacketQueue, mAudioTimeBase);
+        GetQueueStats(&stats.subtitleQueue, &mSubtitlePacketQueue, mSubtitleTimeBase);
+        stats.pictureQueueFrames = mPictureQueue.numRemaining();
+        stats.pictureQueueSize = mPictureQueue.getMaxSize();
+        stats.sampleQueueFrames = mSampleQueue.numRemaining();
+        stats.avDrift = mAVDrift;
+        stats.audioUnderruns = mAudioUnderruns;
+        stats.audioRingFill = mAudioRing.fill();
+        stats.audioLatency = isnan(mAudioLatency.getLatency()) ? -1.0 : mAudioLatency.getLatency();
+        stats.audioJitter = isnan(mAudioLatency.getJitter()) ? -1.0 : mAudioLatency.getJitter();
+        for (int i = 0; i < sdl::util::UPLOAD_PATH_NB; i++)
+            stats.uploads[i] = sdl::util::GetUploadCount((sdl::util::UploadPath)i);
+        stats.convertedFrames = mConvertedFrames;
+        stats.picturesUploadedAhead = mPicturesUploadedAhead;
+        stats.picturesUploadedOnDisplay = mPicturesUploadedOnDisplay;
+        stats.timeToOpen = mTimeToOpen;
+        stats.timeToFirstFrame = mTimeToFirstFrame;
+        {
+            sdl::ScopedLock lock(mInputIOMutex);
+            stats.io = mInputIO ? mInputIO->getStats() : mInputIOStats;
+        }
+        stats.frameSinks = mNumFrameSinks;
+        stats.sinkFramesQueued = mSinkFramesQueued;
+        stats.sinkFramesDropped = mSinkFramesDropped;
+        stats.keyframes = mKeyframeIndex.getSize();
+        stats.seeksIndexed = mSeeksIndexed;
+        stats.seekFramesDiscarded = mSeekFramesDiscarded;
+        stats.externalClockAdjustments = mExternalClockAdjustments;
+        stats.externalClockSpeed = mExternalClockSpeed;
+        return stats;
+    }
+    
+    int VideoState::addFrameSink(FrameSink *sink, AVMediaType type, int queue_size, FrameSink::Tap tap)
+    {
+        FrameSinkQueue *queue;
+        int ret;
+        
+        if (!sink || !mFrameSinkMutex || (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO))
+            return AVERROR(EINVAL);
+        if (tap == FrameSink::TAP_DISPLAYED && type != AVMEDIA_TYPE_VIDEO)
+            return AVERROR(EINVAL);
+        if (!(queue = new (std::nothrow) FrameSinkQueue(sink, type, tap, queue_size)))
+            return AVERROR(ENOMEM);
+        if ((ret = queue->start()) < 0) {
+            delete queue;
+            return ret;
+        }
+        sdl::ScopedLock lock(mFrameSinkMutex);
+        mFrameSinks.push_back(queue);
+        mNumFrameSinks = (int)mFrameSinks.size();
+        return 0;
+    }
+    
+    void VideoState::removeFrameSink(FrameSink *sink)
+    {
+        std::vector<FrameSinkQueue*> removed;
+        
+        if (!mFrameSinkMutex)
+            return;
+        {
+            sdl::ScopedLock lock(mFrameSinkMutex);
+            for (auto it = mFrameSinks.begin(); it != mFrameSinks.end();) {
+                if ((*it)->getSink() == sink) {
+                    removed.push_back(*it);
+                    it = mFrameSinks.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            mNumFrameSinks = (int)mFrameSinks.size();
+        }
+        /* stopped outside the lock, the decoders keep going while a sink finishes its frame */
+        for (FrameSinkQueue *queue : removed)
+            delete queue;
+    }
+    
+    void VideoState::removeFrameSinks()
+    {
+        std::vector<FrameSinkQueue*> removed;
+        
+        if (!mFrameSinkMutex)
+            return;
+        {
+            sdl::ScopedLock lock(mFrameSinkMutex);
+            removed.swap(mFrameSinks);
+            mNumFrameSinks = 0;
+        }
+        for (FrameSinkQueue *queue : removed)
+            delete queue;
+    }
+    
+    /* from the decoder threads, or for TAP_DISPLAYED from the refresh or the
+     * headless video sink, a reference to frame for each sink of its type and tap */
+    void VideoState::deliverToSinks(AVMediaType type, int stream_index, AVFrame *frame, AVRational tb, double pts, double duration, int serial, FrameSink::Tap tap)
+    {
+        FrameSink::Info info;
+        int ret;
+        
+        if (!mNumFrameSinks)
+            return;
+        info.type = type;
+        info.streamIndex = stream_index;
+        info.timeBase = tb;
+        info.pts = pts;
+        info.duration = duration;
+        info.position = frame->pkt_pos;
+        info.serial = serial;
+        info.syncType = getMasterSyncType();
+        info.masterClock = getMasterClock();
+        
+        sdl::ScopedLock lock(mFrameSinkMutex);
+        for (FrameSinkQueue *queue : mFrameSinks) {
+            if (queue->getType() != type || queue->getTap() != tap)
+                continue;
+            if ((ret = queue->put(frame, info)) < 0)
+                continue;
+            mSinkFramesQueued++;
+            mSinkFramesDropped += ret;
+        }
+    }
+    
     void VideoState::updateVideoPts(double pts, int64_t pos, int serial) {
         /* update current video pts */
         mVideoClock.set(pts, serial);
@@ -133,6 +366,41 @@ namespace ffmpeg {
         return mSubtileStream > 0 && mSubtitleAVStream;
     }
     
+    int64_t VideoState::getStartTime()
+    {
+        AVFormatContext *probed = mStreamInfo.load(std::memory_order_acquire);
+        if (mFormatContext->start_time == AV_NOPTS_VALUE && probed)
+            return probed->start_time;
+        return mFormatContext->start_time;
+    }
+    
+    int64_t VideoState::getBitRate()
+    {
+        AVFormatContext *probed = mStreamInfo.load(std::memory_order_acquire);
+        if (!mFormatContext->bit_rate && probed)
+            return probed->bit_rate;
+        return mFormatContext->bit_rate;
+    }
+    
+    /* in the stream's time base, the probed one only when it is the same */
+    int64_t VideoState::getStreamStartTime(int stream_index)
+    {
+        AVFormatContext *probed = mStreamInfo.load(std::memory_order_acquire);
+        AVStream *st = mFormatContext->streams[stream_index];
+        if (st->start_time == AV_NOPTS_VALUE && probed && !av_cmp_q(st->time_base, probed->streams[stream_index]->time_base))
+            return probed->streams[stream_index]->start_time;
+        return st->start_time;
+    }
+    
+    AVRational VideoState::guessFrameRate(AVStream *st)
+    {
+        AVFormatContext *probed = mStreamInfo.load(std::memory_order_acquire);
+        AVRational frame_rate = av_guess_frame_rate(mFormatContext, st, NULL);
+        if (!frame_rate.num && probed)
+            frame_rate = av_guess_frame_rate(probed, probed->streams[st->index], NULL);
+        return frame_rate;
+    }
+    
     void VideoState::seek(int amount)
     {
         int cur_pos;
@@ -144,8 +412,8 @@ namespace ffmpeg {
                 cur_pos = mSampleQueue.lastShownPosition();
             if (cur_pos < 0)
                 cur_pos = avio_tell(mFormatContext->pb);
-            if (mFormatContext->bit_rate)
-                amount *= mFormatContext->bit_rate / 8.0;
+            if (getBitRate())
+                amount *= getBitRate() / 8.0;
             else
                 amount *= 180000.0;
             cur_pos += amount;
@@ -155,8 +423,8 @@ namespace ffmpeg {
             if (isnan(cur_pos))
                 cur_pos = (double)mSeekPosition / AV_TIME_BASE;
             cur_pos += amount;
-            if (mFormatContext->start_time != AV_NOPTS_VALUE && cur_pos < mFormatContext->start_time / (double)AV_TIME_BASE)
-                cur_pos = mFormatContext->start_time / (double)AV_TIME_BASE;
+            if (getStartTime() != AV_NOPTS_VALUE && cur_pos < getStartTime() / (double)AV_TIME_BASE)
+                cur_pos = getStartTime() / (double)AV_TIME_BASE;
             streamSeek((int64_t)(cur_pos * AV_TIME_BASE), (int64_t)(amount * AV_TIME_BASE), 0);
         }
     }
@@ -187,6 +455,9 @@ namespace ffmpeg {
     
     bool VideoState::streamOpen( const std::string& filename, AVInputFormat *iformat)
     {
+        mOpenTime = av_gettime_relative();
+        mTimeToOpen = -1.0;
+        mTimeToFirstFrame = -1.0;
         mFilename = filename;
         if (mFilename.empty()){
             av_log(NULL, AV_LOG_ERROR, "must first open a video file!");
@@ -198,7 +469,8 @@ namespace ffmpeg {
         mXLeft   = 0;
         
         /* start video display */
-        if (mPictureQueue.init(&mVideoPacketQueue, VIDEO_PICTURE_QUEUE_SIZE, 1) < 0){
+        /* all slots are allocated up front so the depth can change later without moving queued frames */
+        if (mPictureQueue.init(&mVideoPacketQueue, mPictureQueueSize, 1, VIDEO_PICTURE_QUEUE_MAX_SIZE) < 0){
             av_log(NULL, AV_LOG_ERROR, "couldn't init the picture queue");
             streamClose();
             return false;
@@ -215,7 +487,11 @@ namespace ffmpeg {
             return false;
         }
         
-        if (mVideoPacketQueue.init() < 0 || mAudioPacketQueue.init() < 0 || mSubtitlePacketQueue.init() < 0){
+        PacketQueue::Mode packet_queue_mode = (PacketQueue::Mode)opts::packetQueueMode();
+        /* a full SPSC ring makes put() wait, which would hold up a host worker */
+        if (mHost)
+            packet_queue_mode = PacketQueue::MODE_LOCKED;
+        if (mVideoPacketQueue.init(packet_queue_mode) < 0 || mAudioPacketQueue.init(packet_queue_mode) < 0 || mSubtitlePacketQueue.init(packet_queue_mode) < 0){
             av_log(NULL, AV_LOG_ERROR, "couldn't init one of the the packet queues");
             streamClose();
             return false;
@@ -227,6 +503,11 @@ namespace ffmpeg {
             return false;
         }
         
+        if (mKeyframeIndex.init() < 0) {
+            streamClose();
+            return false;
+        }
+        
         //sync packet queues with clocks
         mVideoClock.init(mVideoPacketQueue.getSerialPtr());
         mAudioClock.init(mAudioPacketQueue.getSerialPtr());
@@ -236,8 +517,14 @@ namespace ffmpeg {
         
         mAudioVolume = av_clip(SDL_MIX_MAXVOLUME * 50 / 100, 0, SDL_MIX_MAXVOLUME);
         mMuted = 0;
+        mAudioGain.reset((float)mAudioVolume / SDL_MIX_MAXVOLUME);
         //TODO options?
         mSyncType = AV_SYNC_VIDEO_MASTER;
+        mReadThreadDone = 0;
+        if (mHost) {
+            mHost->activate(this, PlayerHost::TASK_READ);
+            return true;
+        }
         mReadThread = SDL_CreateThread(&VideoState::ReadThread, "VideoState::ReadThread", (void*)this);
         if (!mReadThread) {
             av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
@@ -282,6 +569,7 @@ namespace ffmpeg {
     void VideoState::toggleMute()
     {
         mMuted = !mMuted;
+        updateAudioGain();
     }
     
     void VideoState::updateVolume(int sign, double step)
@@ -289,6 +577,13 @@ namespace ffmpeg {
         double volume_level = mAudioVolume ? (20 * log(mAudioVolume / (double)SDL_MIX_MAXVOLUME) / log(10)) : -1000.0;
         int new_volume = lrint(SDL_MIX_MAXVOLUME * pow(10.0, (volume_level + sign * step) / 20.0));
         mAudioVolume = av_clip(mAudioVolume == new_volume ? (mAudioVolume + sign) : new_volume, 0, SDL_MIX_MAXVOLUME);
+        updateAudioGain();
+    }
+    
+    /* the audio callback ramps to the new gain on its own */
+    void VideoState::updateAudioGain()
+    {
+        mAudioGain.setTarget(mMuted ? 0.0f : (float)mAudioVolume / SDL_MIX_MAXVOLUME);
     }
     
     void VideoState::streamSeek(int64_t pos, int64_t rel, bool seek_by_bytes)
@@ -301,9 +596,31 @@ namespace ffmpeg {
                 mSeekFlags |= AVSEEK_FLAG_BYTE;
             mSeekReq = 1;
             SDL_CondSignal(mContinueReadThread);
+            if (mHost)
+                mHost->wake(this);
         }
     }
     
+    /* byte seeks straight to the keyframe the index has for target, for demuxers
+     * that would otherwise have to search the file for it. Returns < 0 when the
+     * index cannot help and the demuxer has to seek on its own */
+    int VideoState::indexedSeek(int64_t target, int64_t min, int64_t max)
+    {
+        AVFormatContext *ic = mFormatContext;
+        KeyframeIndex::Entry entry;
+        int64_t key;
+        
+        if (!mVideoAVStream || (ic->iformat->flags & AVFMT_NO_BYTE_SEEK) || ic->iformat->read_seek || ic->iformat->read_seek2)
+            return AVERROR(ENOSYS);
+        if (!mKeyframeIndex.lookup(av_rescale_q(target, AV_TIME_BASE_Q, mVideoAVStream->time_base), &entry))
+            return AVERROR(ENOENT);
+        /* unless the decoders run on to the target the keyframe is what gets shown */
+        key = av_rescale_q(entry.pts, mVideoAVStream->time_base, AV_TIME_BASE_Q);
+        if (!opts::accurateSeek() && (key < min || key > max))
+            return AVERROR(ERANGE);
+        return avformat_seek_file(ic, -1, entry.pos, entry.pos, entry.pos, AVSEEK_FLAG_BYTE);
+    }
+    
     int VideoState::StreamHasEnoughPackets(AVStream *st, int stream_id, PacketQueue *queue) {
         return stream_id < 0 ||
         queue->getAbortRequest() ||
@@ -376,45 +693,57 @@ namespace ffmpeg {
      * or external master clock */
     int VideoState::synchronizeAudio(int nb_samples)
     {
-        int wanted_nb_samples = nb_samples;
-        
         /* if not master, then we try to remove or add samples to correct the clock */
-        if (getMasterSyncType() != AV_SYNC_AUDIO_MASTER) {
-            double diff, avg_diff;
-            int min_nb_samples, max_nb_samples;
-            
-            diff = mAudioClock.get() - getMasterClock();
-            
-            if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
-                mAudioDiffCum = diff + mAudioDifAvgCoef * mAudioDiffCum;
-                if (mAudioDiffAvgCount < AUDIO_DIFF_AVG_NB) {
-                    /* not enough measures to have a correct estimate */
-                    mAudioDiffAvgCount++;
-                } else {
-                    /* estimate the A-V difference */
-                    avg_diff = mAudioDiffCum * (1.0 -mAudioDifAvgCoef);
-                    
-                    if (fabs(avg_diff) >= mAudioDiffThresh) {
-                        wanted_nb_samples = nb_samples + (int)(diff * mAudioSource.freq);
-                        min_nb_samples = ((nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
-                        max_nb_samples = ((nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
-                        wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples, max_nb_samples);
-                    }
-                    av_log(NULL, AV_LOG_TRACE, "diff=%f adiff=%f sample_diff=%d apts=%0.3f %f\n",
-                           diff, avg_diff, wanted_nb_samples - nb_samples,
-                           mAudioClockTime, mAudioDiffThresh);
-                }
+        if (getMasterSyncType() != AV_SYNC_AUDIO_MASTER)
+            return SynchronizeAudio(nb_samples, mAudioClock.get() - getMasterClock(), mAudioSource.freq, audioDiffThreshold(),
+                                    &mAudioDiffCum, &mAudioDifAvgCoef, &mAudioDiffAvgCount);
+        return nb_samples;
+    }
+    
+    int VideoState::SynchronizeAudio(int nb_samples, double diff, int freq, double threshold, double *diff_cum, double *avg_coef, int *avg_count)
+    {
+        int wanted_nb_samples = nb_samples;
+        double avg_diff;
+        int min_nb_samples, max_nb_samples;
+        
+        if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
+            *diff_cum = diff + *avg_coef * *diff_cum;
+            if (*avg_count < AUDIO_DIFF_AVG_NB) {
+                /* not enough measures to have a correct estimate */
+                (*avg_count)++;
             } else {
-                /* too big difference : may be initial PTS errors, so
-                 reset A-V filter */
-                mAudioDiffAvgCount = 0;
-                mAudioDifAvgCoef       = 0;
+                /* estimate the A-V difference */
+                avg_diff = *diff_cum * (1.0 - *avg_coef);
+                
+                if (fabs(avg_diff) >= threshold) {
+                    wanted_nb_samples = nb_samples + (int)(diff * freq);
+                    min_nb_samples = ((nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100));
+                    max_nb_samples = ((nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100));
+                    wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples, max_nb_samples);
+                }
+                av_log(NULL, AV_LOG_TRACE, "diff=%f adiff=%f sample_diff=%d %f\n",
+                       diff, avg_diff, wanted_nb_samples - nb_samples, threshold);
             }
+        } else {
+            /* too big difference : may be initial PTS errors, so
+             reset A-V filter */
+            *avg_count = 0;
+            *avg_coef       = 0;
         }
         
         return wanted_nb_samples;
     }
     
+    /* the clock error is about the callback jitter once the device latency is
+     * measured, until then correct only beyond a whole hardware buffer */
+    double VideoState::audioDiffThreshold()
+    {
+        double jitter = mAudioLatency.getJitter();
+        if (isnan(mAudioLatency.getLatency()) || isnan(jitter))
+            return mAudioDiffThresh;
+        return av_clipd(AUDIO_DIFF_JITTERS * jitter, AUDIO_DIFF_THRESHOLD_MIN, mAudioDiffThresh);
+    }
+    
     int VideoState::decodeAudioFrame()
     {
         int data_size, resampled_data_size;
@@ -427,17 +756,12 @@ namespace ffmpeg {
             return -1;
         
         do {
-#if defined(_WIN32)
-            while (mSampleQueue.numRemaining() == 0) {
-                if ((av_gettime_relative() - sdl::GetAudioCallbackTime()) > 1000000LL * mAudioHWBufferSize / mAudioTarget.bytes_per_sec / 2)
-                    return -1;
-                av_usleep (1000);
-            }
-#endif
             if (!(af = mSampleQueue.peekReadable()))
                 return -1;
             mSampleQueue.next();
         } while (af->serial != mAudioPacketQueue.getSerial());
+        if (mHost)
+            mHost->wake(this);
         
         data_size = av_samples_get_buffer_size(NULL, af->frame->channels,
                                                af->frame->nb_samples,
@@ -527,46 +851,123 @@ namespace ffmpeg {
         return resampled_data_size;
     }
     
-    /* prepare a new audio buffer */
+    /* decodes and resamples ahead of the device into mAudioRing, so none of that
+     * runs on the audio callback's real-time thread */
+    int VideoState::AudioRenderThread(void *arg)
+    {
+        VideoState *is = (VideoState*)arg;
+        int audio_size, written, len, serial;
+        double clock;
+        
+        while (!is->mAudioRenderStop) {
+            if ((audio_size = is->decodeAudioFrame()) < 0) {
+                /* paused, aborted or a conversion error */
+                SDL_Delay(AUDIO_RENDER_IDLE_WAIT);
+                continue;
+            }
+            if (is->mShowMode != VideoState::SHOW_MODE_VIDEO)
+                is->updateSampleDisplay((int16_t *)is->mAudioBuffer, audio_size);
+            
+            clock = is->mAudioClockTime;
+            serial = is->mAudioClockSerial;
+            written = 0;
+            /* give up on the rest of the frame if a seek made it stale meanwhile */
+            while (written < audio_size && !is->mAudioRenderStop && serial == is->mAudioPacketQueue.getSerial()) {
+                if ((len = FFMIN(is->mAudioRing.writable(), audio_size - written)) <= 0) {
+                    is->mAudioRing.waitWritable(AUDIO_RENDER_IDLE_WAIT);
+                    continue;
+                }
+                /* the clock marks the end of what is written, the frame pts marks the end of the frame */
+                is->mAudioRing.write(is->mAudioBuffer + written, len,
+                                     clock - (double)(audio_size - written - len) / is->mAudioTarget.bytes_per_sec, serial);
+                written += len;
+            }
+        }
+        return 0;
+    }
+    
+    int VideoState::startAudioRender()
+    {
+        mAudioPlayMarker.serial = -1;
+        mAudioPlayDevicePosition = 0;
+        mAudioDevicePosition = 0;
+        mAudioLatency.reset(mAudioTarget.bytes_per_sec);
+        mAudioRenderStop = 0;
+        mAudioRenderThread = SDL_CreateThread(&VideoState::AudioRenderThread, "VideoState::AudioRenderThread", (void*)this);
+        if (!mAudioRenderThread) {
+            av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+            return AVERROR(ENOMEM);
+        }
+        return 0;
+    }
+    
+    void VideoState::stopAudioRender()
+    {
+        if (!mAudioRenderThread)
+            return;
+        mAudioRenderStop = 1;
+        mAudioRing.wakeWriter();
+        SDL_WaitThread(mAudioRenderThread, NULL);
+        mAudioRenderThread = nullptr;
+    }
+    
+    /* only copies what the render thread prepared */
     void VideoState::SDLAudioCallback(void *opaque, Uint8 *stream, int len)
     {
         VideoState *is = (VideoState*)opaque;
-        int audio_size, len1;
+        AudioRing::Marker marker;
+        const uint8_t *data;
+        int len1, serial = is->mAudioPacketQueue.getSerial();
+        int64_t device_position = is->mAudioDevicePosition;
+        double latency;
         
         sdl::GetAudioCallbackTime() = av_gettime_relative();
+        is->mAudioDevicePosition += len;
         
-        while (len > 0) {
-            if (is->mAudioBufferIndex >= is->mAudioBufferSize) {
-                audio_size = is->decodeAudioFrame();
-                if (audio_size < 0) {
-                    /* if error, just output silence */
-                    is->mAudioBuffer = NULL;
-                    is->mAudioBufferSize = SDL_AUDIO_MIN_BUFFER_SIZE / is->mAudioTarget.frame_size * is->mAudioTarget.frame_size;
-                } else {
-                    if (is->mShowMode != VideoState::SHOW_MODE_VIDEO)
-                        is->updateSampleDisplay((int16_t *)is->mAudioBuffer, audio_size);
-                    is->mAudioBufferSize = audio_size;
-                }
-                is->mAudioBufferIndex = 0;
+        while (len > 0 && !is->mPaused) {
+            if (!(len1 = is->mAudioRing.peek(&data, &marker))) {
+                /* the render thread fell behind, not just starting or seeking */
+                if (is->mAudioPlayMarker.serial == serial)
+                    is->mAudioUnderruns++;
+                break;
+            }
+            if (marker.serial != serial) {
+                /* rendered before a seek */
+                is->mAudioRing.advance(len1);
+                continue;
             }
-            len1 = is->mAudioBufferSize - is->mAudioBufferIndex;
             if (len1 > len)
                 len1 = len;
-            if (!is->mMuted && is->mAudioBuffer && is->mAudioVolume == SDL_MIX_MAXVOLUME)
-                memcpy(stream, (uint8_t *)is->mAudioBuffer + is->mAudioBufferIndex, len1);
-            else {
+            if (is->mAudioGain.isSilent())
                 memset(stream, 0, len1);
-                if (!is->mMuted && is->mAudioBuffer)
-                    SDL_MixAudioFormat(stream, (uint8_t *)is->mAudioBuffer + is->mAudioBufferIndex, AUDIO_S16SYS, len1, is->mAudioVolume);
-            }
+            else if (is->mAudioGain.isUnity())
+                memcpy(stream, data, len1);
+            else
+                is->mAudioGain.applyS16((int16_t *)stream, (const int16_t *)data, len1 / sizeof(int16_t), is->mAudioTarget.channels);
+            is->mAudioRing.advance(len1);
+            is->mAudioPlayMarker = marker;
             len -= len1;
             stream += len1;
-            is->mAudioBufferIndex += len1;
+            is->mAudioPlayDevicePosition = is->mAudioDevicePosition - len;
         }
-        is->mAudioWriteBufferSize = is->mAudioBufferSize - is->mAudioBufferIndex;
-        /* Let's assume the audio driver that is used by SDL has two periods. */
-        if (!isnan(is->mAudioClockTime)) {
-            is->mAudioClock.setAt(is->mAudioClockTime - (double)(2 * is->mAudioHWBufferSize + is->mAudioWriteBufferSize) / is->mAudioTarget.bytes_per_sec, is->mAudioClockSerial, sdl::GetAudioCallbackTime() / 1000000.0);
+        /* silence while paused or starved */
+        if (len > 0)
+            memset(stream, 0, len);
+        /* the clock stands still while paused */
+        if (is->mPaused)
+            is->mAudioPlayDevicePosition += len;
+        
+        is->mAudioLatency.update(sdl::GetAudioCallbackTime(), is->mAudioDevicePosition - device_position);
+        
+        marker = is->mAudioPlayMarker;
+        if (marker.serial == serial && !isnan(marker.clock)) {
+            /* the device is playing what was handed to it latency ago; until that is
+             * measured assume the audio driver that is used by SDL has two periods */
+            latency = is->mAudioLatency.getLatency();
+            if (isnan(latency))
+                latency = (double)is->mAudioHWBufferSize / is->mAudioTarget.bytes_per_sec;
+            is->mAudioClock.setAt(marker.clock - (double)(marker.end - is->mAudioRing.getReadPosition() + is->mAudioPlayDevicePosition - device_position) / is->mAudioTarget.bytes_per_sec - latency,
+                                  marker.serial, sdl::GetAudioCallbackTime() / 1000000.0);
             is->mExternalClock.syncToSlave(&is->mAudioClock);
         }
     }
@@ -583,6 +984,9 @@ namespace ffmpeg {
         int64_t channel_layout;
         int ret = 0;
         int stream_lowres = opts::lowres();
+        opts::DecoderThreading threading = {};
+        uint64_t affinity = 0;
+        bool restore_affinity = false;
         
         if (stream_index < 0 || stream_index >= ic->nb_streams)
             return -1;
@@ -626,16 +1030,47 @@ namespace ffmpeg {
         if (opts::fast())
             avctx->flags2 |= AV_CODEC_FLAG2_FAST;
         
+        if (avctx->codec_type >= 0 && avctx->codec_type < AVMEDIA_TYPE_NB)
+            threading = mDecoderThreading[avctx->codec_type];
+        switch (threading.type) {
+            case opts::DecoderThreading::TYPE_FRAME: avctx->thread_type = FF_THREAD_FRAME; break;
+            case opts::DecoderThreading::TYPE_SLICE: avctx->thread_type = FF_THREAD_SLICE; break;
+            default:                                 avctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE; break;
+        }
+        
         opts = opts::filter_codec_opts(mCodecOptions, avctx->codec_id, ic, ic->streams[stream_index], codec);
-        if (!av_dict_get(opts, "threads", NULL, 0))
-            av_dict_set(&opts, "threads", "auto", 0);
+        if (!av_dict_get(opts, "threads", NULL, 0)) {
+            if (threading.count > 0)
+                av_dict_set_int(&opts, "threads", threading.count, 0);
+            else if (mHost)
+                /* the host's workers already keep the cores busy across players */
+                av_dict_set(&opts, "threads", "1", 0);
+            else
+                av_dict_set(&opts, "threads", "auto", 0);
+        }
         if (stream_lowres)
             av_dict_set_int(&opts, "lowres", stream_lowres, 0);
         if (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)
             av_dict_set(&opts, "refcounted_frames", "1", 0);
-        if ((ret = avcodec_open2(avctx, codec, &opts)) < 0) {
+        /* the decoder creates its worker threads inside avcodec_open2 and they inherit
+         * the affinity of this thread, so pin it just for the duration of the call */
+        if (threading.affinity) {
+            if ((ret = util::SetThreadAffinity(threading.affinity, &affinity)) < 0)
+                av_log(NULL, AV_LOG_WARNING, "Could not set the decoder thread affinity to 0x%" PRIx64 "\n", threading.affinity);
+            else
+                restore_affinity = true;
+        }
+        ret = avcodec_open2(avctx, codec, &opts);
+        if (restore_affinity)
+            util::SetThreadAffinity(affinity, NULL);
+        if (ret < 0) {
             goto fail;
         }
+        av_log(NULL, AV_LOG_INFO, "%s decoder %s: %d thread(s), %s threading%s\n",
+               av_get_media_type_string(avctx->codec_type), codec->name, avctx->thread_count,
+               avctx->active_thread_type == FF_THREAD_FRAME ? "frame" :
+               avctx->active_thread_type == FF_THREAD_SLICE ? "slice" : "no",
+               restore_affinity ? ", pinned" : "");
         if ((t = av_dict_get(opts, "", NULL, AV_DICT_IGNORE_SUFFIX))) {
             av_log(NULL, AV_LOG_ERROR, "Option %s not found.\n", t->key);
             ret =  AVERROR_OPTION_NOT_FOUND;
@@ -668,47 +1103,73 @@ namespace ffmpeg {
 #endif
                 
                 /* prepare audio output */
-                if ((ret = sdl::AudioOpen((void*)this, channel_layout, nb_channels, sample_rate, &mAudioTarget)) < 0)
+                if (mHeadless) {
+                    /* no device, the null sink takes what a device would have asked for */
+                    mAudioTarget.fmt = AV_SAMPLE_FMT_S16;
+                    mAudioTarget.freq = sample_rate;
+                    mAudioTarget.channels = nb_channels;
+                    mAudioTarget.channel_layout = util::GetValidChannelLayout(channel_layout, nb_channels);
+                    if (!mAudioTarget.channel_layout)
+                        mAudioTarget.channel_layout = av_get_default_channel_layout(nb_channels);
+                    mAudioTarget.frame_size = av_samples_get_buffer_size(NULL, mAudioTarget.channels, 1, mAudioTarget.fmt, 1);
+                    mAudioTarget.bytes_per_sec = av_samples_get_buffer_size(NULL, mAudioTarget.channels, mAudioTarget.freq, mAudioTarget.fmt, 1);
+                    if (mAudioTarget.bytes_per_sec <= 0 || mAudioTarget.frame_size <= 0) {
+                        av_log(NULL, AV_LOG_ERROR, "av_samples_get_buffer_size failed\n");
+                        ret = AVERROR(EINVAL);
+                        goto fail;
+                    }
+                    ret = SDL_AUDIO_MIN_BUFFER_SIZE * mAudioTarget.frame_size;
+                } else if ((ret = sdl::AudioOpen((void*)this, channel_layout, nb_channels, sample_rate, &mAudioTarget)) < 0)
                     goto fail;
                 mAudioHWBufferSize = ret;
                 mAudioSource = mAudioTarget;
-                mAudioBufferSize = 0;
-                mAudioBufferIndex = 0;
+                if (!mHeadless && (ret = mAudioRing.init(AUDIO_RING_PERIODS * mAudioHWBufferSize)) < 0)
+                    goto fail;
                 
                 /* init averaging filter */
                 mAudioDifAvgCoef  = exp(log(0.01) / AUDIO_DIFF_AVG_NB);
                 mAudioDiffAvgCount = 0;
-                /* since we do not have a precise anough audio FIFO fullness,
-                 we correct audio sync only if larger than this threshold */
+                /* until the device latency is measured we do not have a precise enough
+                 audio FIFO fullness, so we correct audio sync only if larger than this threshold */
                 mAudioDiffThresh = (double)(mAudioHWBufferSize) / mAudioTarget.bytes_per_sec;
                 
                 mAudioStream = stream_index;
                 mAudioAVStream = ic->streams[stream_index];
+                mAudioTimeBase = av_q2d(mAudioAVStream->time_base);
                 
                 mAudioDecoder.init(avctx, &mAudioPacketQueue, mContinueReadThread);
+                mSampleQueue.setStreamIndex(stream_index);
                 if ((mFormatContext->iformat->flags & (AVFMT_NOBINSEARCH | AVFMT_NOGENSEARCH | AVFMT_NO_BYTE_SEEK)) && !mFormatContext->iformat->read_seek) {
                     mAudioDecoder.setStartPts(mAudioAVStream->start_time);
                     mAudioDecoder.setStartPtsTimeBase(mAudioAVStream->time_base);
                 }
-                if ((ret = mAudioDecoder.start(VideoState::AudioThread, (void*)this)) < 0)
+                if ((ret = startDecoder(&mAudioDecoder, PlayerHost::TASK_AUDIO, VideoState::AudioThread)) < 0)
                     goto out;
-                SDL_PauseAudioDevice(sdl::audioDevice(), 0);
+                if (!mHeadless) {
+                    if ((ret = startAudioRender()) < 0)
+                        goto out;
+                    SDL_PauseAudioDevice(sdl::audioDevice(), 0);
+                }
                 break;
             case AVMEDIA_TYPE_VIDEO:
                 mVideoStream = stream_index;
                 mVideoAVStream = ic->streams[stream_index];
+                mVideoTimeBase = av_q2d(mVideoAVStream->time_base);
                 
                 mVideoDecoder.init(avctx, &mVideoPacketQueue, mContinueReadThread);
-                if ((ret = mVideoDecoder.start(VideoState::VideoThread, (void*)this)) < 0)
+                mPictureQueue.setStreamIndex(stream_index);
+                if ((ret = startDecoder(&mVideoDecoder, PlayerHost::TASK_VIDEO, VideoState::VideoThread)) < 0)
                     goto out;
                 mQueueAttachmentsReq = 1;
                 break;
             case AVMEDIA_TYPE_SUBTITLE:
                 mSubtileStream = stream_index;
                 mSubtitleAVStream = ic->streams[stream_index];
+                mSubtitleTimeBase = av_q2d(mSubtitleAVStream->time_base);
                 
                 mSubDecoder.init(avctx, &mSubtitlePacketQueue, mContinueReadThread);
-                if ((ret = mSubDecoder.start(VideoState::SubtitleThread, (void*)this)) < 0)
+                mSubtitleQueue.setStreamIndex(stream_index);
+                if ((ret = startDecoder(&mSubDecoder, PlayerHost::TASK_SUBTITLE, VideoState::SubtitleThread)) < 0)
                     goto out;
                 break;
             default:
@@ -735,9 +1196,13 @@ namespace ffmpeg {
         
         switch (codecpar->codec_type) {
             case AVMEDIA_TYPE_AUDIO:
+                stopHostTask(PlayerHost::TASK_AUDIO);
                 mAudioDecoder.abort(&mSampleQueue);
-                SDL_CloseAudioDevice(sdl::audioDevice());
+                stopAudioRender();
+                if (!mHeadless)
+                    SDL_CloseAudioDevice(sdl::audioDevice());
                 mAudioDecoder.destroy();
+                mAudioRing.destroy();
                 swr_free(&mSwrCtx);
                 av_freep(&mAudioBuffer1);
                 mAudioBuffer1Size = 0;
@@ -751,10 +1216,12 @@ namespace ffmpeg {
                 }
                 break;
             case AVMEDIA_TYPE_VIDEO:
+                stopHostTask(PlayerHost::TASK_VIDEO);
                 mVideoDecoder.abort(&mPictureQueue);
                 mVideoDecoder.destroy();
                 break;
             case AVMEDIA_TYPE_SUBTITLE:
+                stopHostTask(PlayerHost::TASK_SUBTITLE);
                 mSubDecoder.abort(&mSubtitleQueue);
                 mSubDecoder.destroy();
                 break;
@@ -766,14 +1233,17 @@ namespace ffmpeg {
         switch (codecpar->codec_type) {
             case AVMEDIA_TYPE_AUDIO:
                 mAudioAVStream = NULL;
+                mAudioTimeBase = 0.0;
                 mAudioStream = -1;
                 break;
             case AVMEDIA_TYPE_VIDEO:
                 mVideoAVStream = NULL;
+                mVideoTimeBase = 0.0;
                 mVideoStream = -1;
                 break;
             case AVMEDIA_TYPE_SUBTITLE:
                 mSubtitleAVStream = NULL;
+                mSubtitleTimeBase = 0.0;
                 mSubtileStream = -1;
                 break;
             default:
@@ -781,21 +1251,33 @@ namespace ffmpeg {
         }
     }
     
+    /* a PlayerHost runs the same ReadBegin(), ReadStep() and ReadEnd() on its workers */
     int VideoState::ReadThread(void *arg)
     {
         VideoState *is = (VideoState*)arg;
+        int ret;
+        
+        if ((ret = ReadBegin(is)) >= 0) {
+            while ((ret = ReadStep(is, true)) >= 0)
+                ;
+            if (ret == AVERROR_EXIT)
+                ret = 0;
+        }
+        ReadEnd(is, ret);
+        return 0;
+    }
+    
+    /* opens the input and its streams, the decoders start from here */
+    int VideoState::ReadBegin(VideoState *is)
+    {
         AVFormatContext *ic = NULL;
         int err, i, ret;
         int st_index[AVMEDIA_TYPE_NB];
-        AVPacket pkt1, *pkt = &pkt1;
-        int64_t stream_start_time;
-        int pkt_in_play_range = 0;
         AVDictionaryEntry *t;
-        SDL_mutex *wait_mutex = SDL_CreateMutex();
         int scan_all_pmts_set = 0;
-        int64_t pkt_ts;
+        int stream_info_cached = 0;
         
-        if (!wait_mutex) {
+        if (!(is->mReadWaitMutex = SDL_CreateMutex())) {
             av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
             ret = AVERROR(ENOMEM);
             goto fail;
@@ -806,6 +1288,7 @@ namespace ffmpeg {
         is->mLastAudioStream = is->mAudioStream = -1;
         is->mLastSubtitleStream = is->mSubtileStream = -1;
         is->mEOF = 0;
+        is->mKeyframeRun.reset();
         
         ic = avformat_alloc_context();
         if (!ic) {
@@ -821,6 +1304,26 @@ namespace ffmpeg {
             scan_all_pmts_set = 1;
         }
         
+        /* local files can be read through a custom context instead of the file protocol */
+        if (opts::ioMode() != InputIO::MODE_AVIO && InputIO::IsLocalFile(is->mFilename)) {
+            InputIO *io = InputIO::Create((InputIO::Mode)opts::ioMode());
+            if (io && (err = io->open(is->mFilename)) >= 0) {
+                ic->pb = io->getContext();
+                sdl::ScopedLock lock(is->mInputIOMutex);
+                is->mInputIO = io;
+                is->mInputIOStats = InputIO::Stats();
+            } else {
+                av_log(NULL, AV_LOG_WARNING, "%s: falling back to the default input\n", is->mFilename.c_str());
+                delete io;
+            }
+        }
+        
+        /* fast start bounds probing, explicit limits apply either way */
+        if (opts::probeSize() > 0 || opts::fastStart())
+            av_dict_set_int(&is->mFormatOptions, "probesize", opts::probeSize() > 0 ? opts::probeSize() : FAST_START_PROBESIZE, AV_DICT_DONT_OVERWRITE);
+        if (opts::analyzeDuration() > 0 || opts::fastStart())
+            av_dict_set_int(&is->mFormatOptions, "analyzeduration", opts::analyzeDuration() > 0 ? opts::analyzeDuration() : FAST_START_ANALYZE_DURATION, AV_DICT_DONT_OVERWRITE);
+        
         err = avformat_open_input(&ic, is->mFilename.c_str(), is->mInputFormat, &is->mFormatOptions);
         
         if (err < 0) {
@@ -845,7 +1348,22 @@ namespace ffmpeg {
         
         av_format_inject_global_side_data(ic);
         
-        if (opts::findStreamInfo()) {
+        /* a cache from an earlier open of the file stands in for probing it */
+        if (opts::indexCache() && is->mIndexCache.open(is->mFilename) >= 0 && is->mIndexCache.applyStreamInfo(ic) > 0) {
+            av_log(NULL, AV_LOG_VERBOSE, "%s: stream info from the index cache\n", is->mFilename.c_str());
+            stream_info_cached = 1;
+        }
+        
+        if (opts::findStreamInfo() && !stream_info_cached && opts::fastStart() && util::HasCompleteStreamInfo(ic)) {
+            /* start on the header's parameters, the rest of what probing finds comes later */
+            is->mStreamInfoProbed = 0;
+            if ((is->mStreamInfoThread = SDL_CreateThread(&VideoState::StreamInfoThread, "VideoState::StreamInfoThread", (void*)is)))
+                stream_info_cached = 1;
+            else
+                av_log(NULL, AV_LOG_WARNING, "SDL_CreateThread(): %s\n", SDL_GetError());
+        }
+        
+        if (opts::findStreamInfo() && !stream_info_cached) {
             AVDictionary **opts = opts::setup_find_stream_info_opts(ic, is->mCodecOptions);
             int orig_nb_streams = ic->nb_streams;
             
@@ -866,6 +1384,8 @@ namespace ffmpeg {
         if (ic->pb)
             ic->pb->eof_reached = 0; // FIXME hack, ffplay maybe should not use avio_feof() to test for the end
         
+        is->mTimeToOpen = (av_gettime_relative() - is->mOpenTime) / 1000000.0;
+        
         if (!is->mSeekByBytes)
             is->seekByBytes(!!(ic->iformat->flags & AVFMT_TS_DISCONT) && strcmp("ogg", ic->iformat->name));
         
@@ -885,6 +1405,8 @@ namespace ffmpeg {
             ret = avformat_seek_file(ic, -1, INT64_MIN, timestamp, INT64_MAX, 0);
             if (ret < 0) {
                 av_log(NULL, AV_LOG_WARNING, "%s: could not seek to position %0.3f\n", is->mFilename.c_str(), (double)timestamp / AV_TIME_BASE);
+            } else if (opts::accurateSeek()) {
+                is->mAccurateSeekTarget = timestamp / (double)AV_TIME_BASE;
             }
         }
         
@@ -908,12 +1430,12 @@ namespace ffmpeg {
             }
         }
         
-        if (sdl::IsVideoEnabled())
+        if (sdl::IsVideoEnabled() || is->mHeadless)
             st_index[AVMEDIA_TYPE_VIDEO] =
             av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO,
                                 st_index[AVMEDIA_TYPE_VIDEO], -1, NULL, 0);
         
-        if (sdl::IsAudioEnabled())
+        if (sdl::IsAudioEnabled() || is->mHeadless)
             st_index[AVMEDIA_TYPE_AUDIO] =
             av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO,
                                 st_index[AVMEDIA_TYPE_AUDIO],
@@ -956,6 +1478,10 @@ namespace ffmpeg {
             is->streamComponentOpen(st_index[AVMEDIA_TYPE_SUBTITLE]);
         }
         
+        if (is->mVideoStream >= 0 && is->mIndexCache.loadKeyframes(is->mVideoStream, &is->mKeyframeIndex) > 0)
+            av_log(NULL, AV_LOG_VERBOSE, "%s: %d keyframes from the index cache\n", is->mFilename.c_str(), is->mKeyframeIndex.getSize());
+        is->mIndexCache.close();
+        
         if (is->mVideoStream < 0 && is->mAudioStream < 0) {
             av_log(NULL, AV_LOG_FATAL, "Failed to open file '%s' or configure filtergraph\n", is->mFilename.c_str());
             ret = -1;
@@ -965,143 +1491,197 @@ namespace ffmpeg {
         if (opts::infiniteBuffer() < 0 && is->mRealtime)
             opts::infiniteBuffer() = 1;
         
-        for (;;) {
-            if (is->mAbortRequest)
-                break;
-            if (is->mPaused != is->mLastPaused) {
-                is->mLastPaused = is->mPaused;
-                if (is->mPaused)
-                    is->mReadPauseReturn = av_read_pause(ic);
-                else
-                    av_read_play(ic);
+        /* the read thread indexes what it plays, a scan gets the rest up front */
+        if (opts::keyframeScan() && is->mVideoStream >= 0 && !is->mRealtime && !(ic->iformat->flags & AVFMT_NOFILE) && !is->mKeyframeIndex.isComplete()) {
+            is->mKeyframeScanThread = SDL_CreateThread(&VideoState::KeyframeScanThread, "VideoState::KeyframeScanThread", (void*)is);
+            if (!is->mKeyframeScanThread)
+                av_log(NULL, AV_LOG_WARNING, "SDL_CreateThread(): %s\n", SDL_GetError());
+        }
+        return 0;
+        
+    fail:
+        if (ic && !is->mFormatContext)
+            avformat_close_input(&ic);
+        return ret;
+    }
+    
+    /* one pass of the read loop: 1 once it queued a packet or did a seek, 0 when
+     * there was nothing to do, after waiting up to 10 ms for a change with block,
+     * < 0 once reading is over, AVERROR_EXIT on request or on an input error */
+    int VideoState::ReadStep(VideoState *is, bool block)
+    {
+        AVFormatContext *ic = is->mFormatContext;
+        AVPacket pkt1, *pkt = &pkt1;
+        int64_t stream_start_time;
+        int pkt_in_play_range = 0;
+        int64_t pkt_ts;
+        int64_t read_start;
+        int ret;
+        
+        if (is->mAbortRequest)
+            return AVERROR_EXIT;
+        if (is->mPaused != is->mLastPaused) {
+            is->mLastPaused = is->mPaused;
+            if (is->mPaused)
+                is->mReadPauseReturn = av_read_pause(ic);
+            else
+                av_read_play(ic);
+        }
+        if (is->mStreamInfoThread && is->mStreamInfoProbed) {
+            SDL_WaitThread(is->mStreamInfoThread, NULL);
+            is->mStreamInfoThread = nullptr;
+            if (is->mProbedFormatContext && util::SameStreams(ic, is->mProbedFormatContext)) {
+                is->mStreamInfo.store(is->mProbedFormatContext, std::memory_order_release);
+            } else if (is->mProbedFormatContext) {
+                av_log(NULL, AV_LOG_WARNING, "%s: probed streams do not match the playing ones\n", is->mFilename.c_str());
+                avformat_close_input(&is->mProbedFormatContext);
             }
+        }
 #if CONFIG_RTSP_DEMUXER || CONFIG_MMSH_PROTOCOL
-            if (is->mPaused &&
-                (!strcmp(ic->iformat->name, "rtsp") ||
-                 (ic->pb && !strncmp(is->mFilename.c_str(), "mmsh:", 5)))) {
-                    /* wait 10 ms to avoid trying to get another packet */
-                    /* XXX: horrible */
+        if (is->mPaused &&
+            (!strcmp(ic->iformat->name, "rtsp") ||
+             (ic->pb && !strncmp(is->mFilename.c_str(), "mmsh:", 5)))) {
+                /* wait 10 ms to avoid trying to get another packet */
+                /* XXX: horrible */
+                if (block)
                     SDL_Delay(10);
-                    continue;
-                }
+                return 0;
+            }
 #endif
-            if (is->mSeekReq) {
-                int64_t seek_target = is->mSeekPosition;
-                int64_t seek_min    = is->mSeekRel > 0 ? seek_target - is->mSeekRel + 2: INT64_MIN;
-                int64_t seek_max    = is->mSeekRel < 0 ? seek_target - is->mSeekRel - 2: INT64_MAX;
-                // FIXME the +-2 is due to rounding being not done in the correct direction in generation
-                //      of the seek_pos/seek_rel variables
-                
+        if (is->mSeekReq) {
+            int64_t seek_target = is->mSeekPosition;
+            int64_t seek_min    = is->mSeekRel > 0 ? seek_target - is->mSeekRel + 2: INT64_MIN;
+            int64_t seek_max    = is->mSeekRel < 0 ? seek_target - is->mSeekRel - 2: INT64_MAX;
+            // FIXME the +-2 is due to rounding being not done in the correct direction in generation
+            //      of the seek_pos/seek_rel variables
+            
+            ret = AVERROR(ENOSYS);
+            if (!(is->mSeekFlags & AVSEEK_FLAG_BYTE) && (ret = is->indexedSeek(seek_target, seek_min, seek_max)) >= 0)
+                is->mSeeksIndexed++;
+            if (ret < 0)
                 ret = avformat_seek_file(is->mFormatContext, -1, seek_min, seek_target, seek_max, is->mSeekFlags);
-                
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_ERROR,
-                           //"%s: error while seeking\n", is->mFormatContext->url);
-                           "%s: error while seeking\n", is->mFormatContext->filename);
-                } else {
-                    if (is->mAudioStream >= 0) {
-                        is->mAudioPacketQueue.flush();
-                        is->mAudioPacketQueue.put(&PacketQueue::sFlushPacket);
-                    }
-                    if (is->mSubtileStream >= 0) {
-                        is->mSubtitlePacketQueue.flush();
-                        is->mSubtitlePacketQueue.put(&PacketQueue::sFlushPacket);
-                    }
-                    if (is->mVideoStream >= 0) {
-                        is->mVideoPacketQueue.flush();
-                        is->mVideoPacketQueue.put(&PacketQueue::sFlushPacket);
-                    }
-                    if (is->mSeekFlags & AVSEEK_FLAG_BYTE) {
-                        is->mExternalClock.set(NAN, 0);
-                    } else {
-                        is->mExternalClock.set(seek_target / (double)AV_TIME_BASE, 0);
-                    }
+            
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_ERROR,
+                       //"%s: error while seeking\n", is->mFormatContext->url);
+                       "%s: error while seeking\n", is->mFormatContext->filename);
+            } else {
+                is->mKeyframeRun.reset();
+                /* set before the flush packets hand the decoders the new serial */
+                is->mAccurateSeekTarget = opts::accurateSeek() && !(is->mSeekFlags & AVSEEK_FLAG_BYTE) ? seek_target / (double)AV_TIME_BASE : NAN;
+                if (is->mAudioStream >= 0) {
+                    is->mAudioPacketQueue.flush();
+                    is->mAudioPacketQueue.put(&PacketQueue::sFlushPacket);
                 }
-                
-                is->mSeekReq = 0;
-                is->mQueueAttachmentsReq = 1;
-                is->mEOF = 0;
-                if (is->mPaused)
-                    is->stepToNextFrame();
-            }
-            if (is->mQueueAttachmentsReq) {
-                if (is->mVideoAVStream && is->mVideoAVStream->disposition & AV_DISPOSITION_ATTACHED_PIC) {
-                    AVPacket copy = { 0 };
-                    if ((ret = av_packet_ref(&copy, &is->mVideoAVStream->attached_pic)) < 0)
-                        goto fail;
-                    is->mVideoPacketQueue.put(&copy);
-                    is->mVideoPacketQueue.putNullPacket(is->mVideoStream);
+                if (is->mSubtileStream >= 0) {
+                    is->mSubtitlePacketQueue.flush();
+                    is->mSubtitlePacketQueue.put(&PacketQueue::sFlushPacket);
+                }
+                if (is->mVideoStream >= 0) {
+                    is->mVideoPacketQueue.flush();
+                    is->mVideoPacketQueue.put(&PacketQueue::sFlushPacket);
+                }
+                if (is->mSeekFlags & AVSEEK_FLAG_BYTE) {
+                    is->mExternalClock.set(NAN, 0);
+                } else {
+                    is->mExternalClock.set(seek_target / (double)AV_TIME_BASE, 0);
                 }
-                is->mQueueAttachmentsReq = 0;
             }
             
-            /* if the queue are full, no need to read more */
-            if (opts::infiniteBuffer()<1 &&
-                (is->mAudioPacketQueue.size() + is->mVideoPacketQueue.size() + is->mSubtitlePacketQueue.size() > MAX_QUEUE_SIZE
-                 || (StreamHasEnoughPackets(is->mAudioAVStream, is->mAudioStream, &is->mAudioPacketQueue) &&
-                     StreamHasEnoughPackets(is->mVideoAVStream, is->mVideoStream, &is->mVideoPacketQueue) &&
-                     StreamHasEnoughPackets(is->mSubtitleAVStream, is->mSubtileStream, &is->mSubtitlePacketQueue)))) {
-                     /* wait 10 ms */
-                     SDL_LockMutex(wait_mutex);
-                     SDL_CondWaitTimeout(is->mContinueReadThread, wait_mutex, 10);
-                     SDL_UnlockMutex(wait_mutex);
-                     continue;
+            is->mSeekReq = 0;
+            is->mQueueAttachmentsReq = 1;
+            is->mEOF = 0;
+            if (is->mPaused)
+                is->stepToNextFrame();
+            return 1;
+        }
+        if (is->mQueueAttachmentsReq) {
+            if (is->mVideoAVStream && is->mVideoAVStream->disposition & AV_DISPOSITION_ATTACHED_PIC) {
+                AVPacket copy = { 0 };
+                if ((ret = av_packet_ref(&copy, &is->mVideoAVStream->attached_pic)) < 0)
+                    return ret;
+                is->mVideoPacketQueue.put(&copy);
+                is->mVideoPacketQueue.putNullPacket(is->mVideoStream);
+            }
+            is->mQueueAttachmentsReq = 0;
+        }
+        
+        /* if the queue are full, no need to read more */
+        if (opts::infiniteBuffer()<1 &&
+            (is->mAudioPacketQueue.size() + is->mVideoPacketQueue.size() + is->mSubtitlePacketQueue.size() > MAX_QUEUE_SIZE
+             || (StreamHasEnoughPackets(is->mAudioAVStream, is->mAudioStream, &is->mAudioPacketQueue) &&
+                 StreamHasEnoughPackets(is->mVideoAVStream, is->mVideoStream, &is->mVideoPacketQueue) &&
+                 StreamHasEnoughPackets(is->mSubtitleAVStream, is->mSubtileStream, &is->mSubtitlePacketQueue)))) {
+                 /* wait 10 ms */
+                 if (block) {
+                     SDL_LockMutex(is->mReadWaitMutex);
+                     SDL_CondWaitTimeout(is->mContinueReadThread, is->mReadWaitMutex, 10);
+                     SDL_UnlockMutex(is->mReadWaitMutex);
                  }
-            if (!is->mPaused &&
-                (!is->mAudioStream || (is->mAudioDecoder.getFinished() == is->mAudioPacketQueue.getSerial() && is->mSampleQueue.numRemaining() == 0)) &&
-                (!is->mVideoStream || (is->mVideoDecoder.getFinished() == is->mVideoPacketQueue.getSerial() && is->mPictureQueue.numRemaining() == 0))) {
-                if (opts::loopCount() != 1 && (!opts::loopCount() || --opts::loopCount())) {
-                    is->streamSeek(opts::startTime() != AV_NOPTS_VALUE ? opts::startTime() : 0, 0, 0);
-                } else if (opts::autoexit()) {
-                    ret = AVERROR_EOF;
-                    goto fail;
-                }
+                 return 0;
+             }
+        if (!is->mPaused &&
+            (!is->mAudioStream || (is->mAudioDecoder.getFinished() == is->mAudioPacketQueue.getSerial() && is->mSampleQueue.numRemaining() == 0)) &&
+            (!is->mVideoStream || (is->mVideoDecoder.getFinished() == is->mVideoPacketQueue.getSerial() && is->mPictureQueue.numRemaining() == 0))) {
+            if (opts::loopCount() != 1 && (!opts::loopCount() || --opts::loopCount())) {
+                is->streamSeek(opts::startTime() != AV_NOPTS_VALUE ? opts::startTime() : 0, 0, 0);
+            } else if (opts::autoexit()) {
+                return AVERROR_EOF;
             }
-            ret = av_read_frame(ic, pkt);
-            if (ret < 0) {
-                if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !is->mEOF) {
-                    if (is->mVideoStream >= 0)
-                        is->mVideoPacketQueue.putNullPacket(is->mVideoStream);
-                    if (is->mAudioStream >= 0)
-                        is->mAudioPacketQueue.putNullPacket(is->mAudioStream);
-                    if (is->mSubtileStream >= 0)
-                        is->mSubtitlePacketQueue.putNullPacket(is->mSubtileStream);
-                    is->mEOF = 1;
-                }
-                if (ic->pb && ic->pb->error)
-                    break;
-                SDL_LockMutex(wait_mutex);
-                SDL_CondWaitTimeout(is->mContinueReadThread, wait_mutex, 10);
-                SDL_UnlockMutex(wait_mutex);
-                continue;
-            } else {
-                is->mEOF = 0;
+        }
+        read_start = trace::Begin();
+        ret = av_read_frame(ic, pkt);
+        if (ret >= 0)
+            trace::Record(trace::STAGE_READ, read_start, pkt->stream_index, pkt->pts);
+        if (ret < 0) {
+            if ((ret == AVERROR_EOF || avio_feof(ic->pb)) && !is->mEOF) {
+                is->mKeyframeIndex.endOfStream(&is->mKeyframeRun);
+                if (is->mVideoStream >= 0)
+                    is->mVideoPacketQueue.putNullPacket(is->mVideoStream);
+                if (is->mAudioStream >= 0)
+                    is->mAudioPacketQueue.putNullPacket(is->mAudioStream);
+                if (is->mSubtileStream >= 0)
+                    is->mSubtitlePacketQueue.putNullPacket(is->mSubtileStream);
+                is->mEOF = 1;
             }
-            /* check if packet is in play range specified by user, then queue, otherwise discard */
-            stream_start_time = ic->streams[pkt->stream_index]->start_time;
-            pkt_ts = pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
-            pkt_in_play_range = opts::duration() == AV_NOPTS_VALUE ||
-            (pkt_ts - (stream_start_time != AV_NOPTS_VALUE ? stream_start_time : 0)) *
-            av_q2d(ic->streams[pkt->stream_index]->time_base) -
-            (double)(opts::startTime() != AV_NOPTS_VALUE ? opts::startTime() : 0) / 1000000
-            <= ((double)opts::duration() / 1000000);
-            if (pkt->stream_index == is->mAudioStream && pkt_in_play_range) {
-                is->mAudioPacketQueue.put(pkt);
-            } else if (pkt->stream_index == is->mVideoStream && pkt_in_play_range
-                       && !(is->mVideoAVStream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
-                is->mVideoPacketQueue.put(pkt);
-            } else if (pkt->stream_index == is->mSubtileStream && pkt_in_play_range) {
-                is->mSubtitlePacketQueue.put(pkt);
-            } else {
-                av_packet_unref(pkt);
+            if (ic->pb && ic->pb->error)
+                return AVERROR_EXIT;
+            if (block) {
+                SDL_LockMutex(is->mReadWaitMutex);
+                SDL_CondWaitTimeout(is->mContinueReadThread, is->mReadWaitMutex, 10);
+                SDL_UnlockMutex(is->mReadWaitMutex);
             }
+            return 0;
+        } else {
+            is->mEOF = 0;
         }
-        
-        ret = 0;
-    fail:
-        if (ic && !is->mFormatContext)
-            avformat_close_input(&ic);
-        
+        if (pkt->stream_index == is->mVideoStream)
+            is->mKeyframeIndex.addPacket(&is->mKeyframeRun, pkt);
+        /* check if packet is in play range specified by user, then queue, otherwise discard */
+        stream_start_time = is->getStreamStartTime(pkt->stream_index);
+        pkt_ts = pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+        pkt_in_play_range = opts::duration() == AV_NOPTS_VALUE ||
+        (pkt_ts - (stream_start_time != AV_NOPTS_VALUE ? stream_start_time : 0)) *
+        av_q2d(ic->streams[pkt->stream_index]->time_base) -
+        (double)(opts::startTime() != AV_NOPTS_VALUE ? opts::startTime() : 0) / 1000000
+        <= ((double)opts::duration() / 1000000);
+        if (pkt->stream_index == is->mAudioStream && pkt_in_play_range) {
+            is->mAudioPacketQueue.put(pkt);
+        } else if (pkt->stream_index == is->mVideoStream && pkt_in_play_range
+                   && !(is->mVideoAVStream->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            is->mVideoPacketQueue.put(pkt);
+        } else if (pkt->stream_index == is->mSubtileStream && pkt_in_play_range) {
+            is->mSubtitlePacketQueue.put(pkt);
+        } else {
+            av_packet_unref(pkt);
+        }
+        return 1;
+    }
+    
+    /* ret is 0 when reading stopped on request or on an input error, anything
+     * else tells the application to quit */
+    void VideoState::ReadEnd(VideoState *is, int ret)
+    {
         if (ret != 0) {
             SDL_Event event;
             
@@ -1109,26 +1689,156 @@ namespace ffmpeg {
             event.user.data1 = is;
             SDL_PushEvent(&event);
         }
-        SDL_DestroyMutex(wait_mutex);
+        SDL_DestroyMutex(is->mReadWaitMutex);
+        is->mReadWaitMutex = nullptr;
+        is->mReadThreadDone = 1;
+    }
+    
+    /* hosted, the decoder gets no thread and the host's workers step it instead */
+    int VideoState::startDecoder(Decoder *decoder, int task, int (*thread_fn)(void *))
+    {
+        int ret;
+        
+        if ((ret = decoder->start(mHost ? nullptr : thread_fn, (void*)this)) < 0)
+            return ret;
+        if (mHost)
+            mHost->activate(this, task);
         return 0;
     }
     
+    /* called by a host worker, never by two at once for the same task; a task
+     * begins with its first step and ends with the step that fails */
+    int VideoState::hostStep(int task)
+    {
+        int ret = 0;
+        
+        if (!(mHostTasksBegun & (1 << task))) {
+            switch (task) {
+                case PlayerHost::TASK_READ:     ret = ReadBegin(this); break;
+                case PlayerHost::TASK_VIDEO:    ret = VideoBegin(this); break;
+                case PlayerHost::TASK_AUDIO:    ret = AudioBegin(this); break;
+                default:                        break;
+            }
+            /* VideoBegin() and AudioBegin() leave nothing behind when they fail */
+            if (ret < 0) {
+                if (task == PlayerHost::TASK_READ)
+                    hostEnd(task, ret);
+                return ret;
+            }
+            mHostTasksBegun |= 1 << task;
+            return 1;
+        }
+        switch (task) {
+            case PlayerHost::TASK_READ:         ret = ReadStep(this, false); break;
+            case PlayerHost::TASK_VIDEO:        ret = VideoStep(this, false); break;
+            case PlayerHost::TASK_AUDIO:        ret = AudioStep(this, false); break;
+            case PlayerHost::TASK_SUBTITLE:     ret = SubtitleStep(this, false); break;
+            default:                            ret = AVERROR(EINVAL); break;
+        }
+        if (ret < 0)
+            hostEnd(task, ret);
+        return ret;
+    }
+    
+    /* what the task's thread does once its loop is over */
+    void VideoState::hostEnd(int task, int ret)
+    {
+        bool begun = mHostTasksBegun.fetch_and(~(1 << task)) & (1 << task);
+        
+        switch (task) {
+            case PlayerHost::TASK_READ:
+                if (!mReadThreadDone)
+                    ReadEnd(this, ret == AVERROR_EXIT ? 0 : ret);
+                break;
+            case PlayerHost::TASK_VIDEO:
+                if (begun)
+                    VideoEnd(this);
+                break;
+            case PlayerHost::TASK_AUDIO:
+                if (begun)
+                    AudioEnd(this);
+                break;
+            default:
+                break;
+        }
+    }
+    
+    /* returns once no worker steps the task, before its decoder is aborted */
+    void VideoState::stopHostTask(int task)
+    {
+        if (!mHost)
+            return;
+        mHost->deactivate(this, task);
+        hostEnd(task, 0);
+    }
+    
     void VideoState::streamClose()
     {
+        int video_stream;
+        
         /* XXX: use a special url_shutdown call to abort parse cleanly */
         mAbortRequest = 1;
         SDL_WaitThread(mReadThread, NULL);
+        mReadThread = nullptr;
+        stopHostTask(PlayerHost::TASK_READ);
+        
+        /* it stops once the abort request is set */
+        if (mKeyframeScanThread) {
+            SDL_WaitThread(mKeyframeScanThread, NULL);
+            mKeyframeScanThread = nullptr;
+        }
+        if (mStreamInfoThread) {
+            SDL_WaitThread(mStreamInfoThread, NULL);
+            mStreamInfoThread = nullptr;
+        }
         
         /* close each stream */
+        video_stream = mVideoStream;
         if (mAudioStream >= 0)
             streamComponentClose(mAudioStream);
         if (mVideoStream >= 0)
             streamComponentClose(mVideoStream);
         if (mSubtileStream >= 0)
             streamComponentClose(mSubtileStream);
+        
+        /* no thread reads the streams any more, what was probed can go into them for the cache */
+        if (mFormatContext && mStreamInfo)
+            util::MergeStreamInfo(mFormatContext, mStreamInfo);
+        mStreamInfo = nullptr;
+        avformat_close_input(&mProbedFormatContext);
+        /* only rewrite the cache when there was none for these streams or this open learned something */
+        if (opts::indexCache() && mFormatContext && !mRealtime && (!mIndexCache.isValid() || mKeyframeIndex.isDirty()))
+            IndexCache::Save(mFilename, mFormatContext, video_stream, &mKeyframeIndex);
+        mIndexCache.close();
 
-        avformat_close_input(&mFormatContext);
+        mKeyframeIndex.destroy();
+        /* the decoders are gone, the sinks have seen their last frame */
+        removeFrameSinks();
         
+        avformat_close_input(&mFormatContext);
+        /* a custom context outlives the format context using it */
+        if (mInputIO) {
+            InputIO::Stats io;
+            {
+                sdl::ScopedLock lock(mInputIOMutex);
+                io = mInputIOStats = mInputIO->getStats();
+                delete mInputIO;
+                mInputIO = nullptr;
+            }
+            av_log(NULL, AV_LOG_VERBOSE, "input: %" PRId64 " bytes at %.1f MB/s, %d stalls for %.3fs\n", io.bytesRead,
+                   io.readTime > 0 ? io.bytesRead / io.readTime / (1024 * 1024) : 0.0, io.stalls, io.stallTime);
+        }
+
+        {
+            const char *names[] = { "audio", "video", "subtitle" };
+            PacketQueue *queues[] = { &mAudioPacketQueue, &mVideoPacketQueue, &mSubtitlePacketQueue };
+            for (int i = 0; i < FF_ARRAY_ELEMS(queues); i++) {
+                PacketQueue::PoolStats stats = queues[i]->getPoolStats();
+                av_log(NULL, AV_LOG_VERBOSE, "%s packet pool: high water mark %d nodes, %d slabs, %zu bytes held\n",
+                       names[i], stats.highWaterMark, stats.growCount, stats.bytesHeld);
+            }
+        }
+
         //destroyed by destructors
 //        packet_queue_destroy(&is->videoq);
 //        packet_queue_destroy(&is->audioq);
@@ -1145,13 +1855,133 @@ namespace ffmpeg {
         
         if (mAudioVizTexture)
             SDL_DestroyTexture(mAudioVizTexture);
-        if (mVideoTexture)
-            SDL_DestroyTexture(mVideoTexture);
+        for (int i = 0; i < VIDEO_TEXTURE_RING_SIZE; i++)
+            if (mVideoTextures[i])
+                SDL_DestroyTexture(mVideoTextures[i]);
         if (mSubtitleTexture)
             SDL_DestroyTexture(mSubtitleTexture);
     }
     
-    int VideoState::queuePicture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)
+    int VideoState::HeadlessVideoSink(void *arg)
+    {
+        VideoState *is = (VideoState*)arg;
+        Frame *vp;
+        
+        while (!is->mHeadlessStop) {
+            /* fails until the video stream is opened and once it is aborted */
+            if (!(vp = is->mPictureQueue.peekReadable())) {
+                av_usleep(1000);
+                continue;
+            }
+            /* without a refresh loop, every picture consumed here counts as shown */
+            is->deliverToSinks(AVMEDIA_TYPE_VIDEO, is->mVideoStream, vp->frame, is->mVideoAVStream->time_base,
+                               vp->pts, vp->duration, vp->serial, FrameSink::TAP_DISPLAYED);
+            is->mHeadlessVideoFrames++;
+            is->mPictureQueue.next();
+            if (is->mHost)
+                is->mHost->wake(is);
+        }
+        return 0;
+    }
+    
+    int VideoState::HeadlessAudioSink(void *arg)
+    {
+        VideoState *is = (VideoState*)arg;
+        int len;
+        
+        while (!is->mHeadlessStop) {
+            if ((len = is->decodeAudioFrame()) < 0) {
+                av_usleep(1000);
+                continue;
+            }
+            is->mHeadlessAudioSamples += len / is->mAudioTarget.frame_size;
+        }
+        return 0;
+    }
+    
+    static void SampleOccupancy(VideoState::Occupancy *occupancy, double *sum, int value)
+    {
+        *sum += value;
+        occupancy->peak = FFMAX(occupancy->peak, value);
+    }
+    
+    /* runs until the input is fully decoded or the read thread fails, then stops the
+     * sinks and fills in report; the caller still has to streamClose() */
+    int VideoState::runHeadless(HeadlessReport *report)
+    {
+        HeadlessReport r = {};
+        SDL_Thread *video_sink, *audio_sink;
+        double sums[4] = {0};
+        int64_t start, samples = 0;
+        
+        if (!mHeadless || (!mReadThread && !mHost))
+            return AVERROR(EINVAL);
+        
+        mHeadlessStop = 0;
+        mHeadlessVideoFrames = 0;
+        mHeadlessAudioSamples = 0;
+        start = av_gettime_relative();
+        video_sink = SDL_CreateThread(&VideoState::HeadlessVideoSink, "VideoState::HeadlessVideoSink", (void*)this);
+        audio_sink = SDL_CreateThread(&VideoState::HeadlessAudioSink, "VideoState::HeadlessAudioSink", (void*)this);
+        if (!video_sink || !audio_sink) {
+            av_log(NULL, AV_LOG_FATAL, "SDL_CreateThread(): %s\n", SDL_GetError());
+            mHeadlessStop = 1;
+            SDL_WaitThread(video_sink, NULL);
+            SDL_WaitThread(audio_sink, NULL);
+            return AVERROR(ENOMEM);
+        }
+        
+        for (;;) {
+            if (mAbortRequest || mReadThreadDone)
+                break;
+            if (mEOF && (mAudioStream >= 0 || mVideoStream >= 0) &&
+                (mAudioStream < 0 || (mAudioDecoder.getFinished() == mAudioPacketQueue.getSerial() && mSampleQueue.numRemaining() == 0)) &&
+                (mVideoStream < 0 || (mVideoDecoder.getFinished() == mVideoPacketQueue.getSerial() && mPictureQueue.numRemaining() == 0)))
+                break;
+            SampleOccupancy(&r.videoPackets, &sums[0], mVideoPacketQueue.getNumPackets());
+            SampleOccupancy(&r.audioPackets, &sums[1], mAudioPacketQueue.getNumPackets());
+            SampleOccupancy(&r.pictures, &sums[2], mPictureQueue.numRemaining());
+            SampleOccupancy(&r.sampleFrames, &sums[3], mSampleQueue.numRemaining());
+            samples++;
+            av_usleep((int64_t)(HEADLESS_POLL_INTERVAL * 1000000.0));
+        }
+        r.wallTime = (av_gettime_relative() - start) / 1000000.0;
+        
+        /* wake the sinks up wherever they are blocked */
+        mHeadlessStop = 1;
+        mVideoPacketQueue.abort();
+        mPictureQueue.signal();
+        mAudioPacketQueue.abort();
+        mSampleQueue.signal();
+        SDL_WaitThread(video_sink, NULL);
+        SDL_WaitThread(audio_sink, NULL);
+        
+        r.videoFrames = mHeadlessVideoFrames;
+        r.audioSamples = mHeadlessAudioSamples;
+        if (r.wallTime > 0) {
+            r.videoFramesPerSec = r.videoFrames / r.wallTime;
+            r.audioSamplesPerSec = r.audioSamples / r.wallTime;
+        }
+        if (samples) {
+            r.videoPackets.average = sums[0] / samples;
+            r.audioPackets.average = sums[1] / samples;
+            r.pictures.average = sums[2] / samples;
+            r.sampleFrames.average = sums[3] / samples;
+        }
+        
+        av_log(NULL, AV_LOG_INFO, "headless: %.3fs wall, %" PRId64 " frames (%.1f fps), %" PRId64 " samples (%.0f/s)\n",
+               r.wallTime, r.videoFrames, r.videoFramesPerSec, r.audioSamples, r.audioSamplesPerSec);
+        av_log(NULL, AV_LOG_INFO, "headless: video packets avg %.1f peak %d, audio packets avg %.1f peak %d\n",
+               r.videoPackets.average, r.videoPackets.peak, r.audioPackets.average, r.audioPackets.peak);
+        av_log(NULL, AV_LOG_INFO, "headless: pictures avg %.1f peak %d, sample frames avg %.1f peak %d\n",
+               r.pictures.average, r.pictures.peak, r.sampleFrames.average, r.sampleFrames.peak);
+        
+        if (report)
+            *report = r;
+        return 0;
+    }
+    
+    int VideoState::queuePicture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial, bool block)
     {
         Frame *vp;
         
@@ -1160,11 +1990,13 @@ namespace ffmpeg {
                av_get_picture_type_char(src_frame->pict_type), pts);
 #endif
         
-        if (!(vp = mPictureQueue.peekWriteable()))
-            return -1;
+        if (!(vp = mPictureQueue.peekWriteable(block)))
+            return block || mVideoPacketQueue.getAbortRequest() ? -1 : AVERROR(EAGAIN);
         
         vp->sar = src_frame->sample_aspect_ratio;
         vp->uploaded = 0;
+        vp->texture = -1;
+        vp->sequence = mPictureSequence++;
         
         vp->width = src_frame->width;
         vp->height = src_frame->height;
@@ -1182,6 +2014,52 @@ namespace ffmpeg {
         return 0;
     }
     
+    /* pictures take the ring slots in queue order, so a slot is only reused by a
+     * picture VIDEO_TEXTURE_RING_SIZE places later */
+    int VideoState::uploadPicture(Frame *vp)
+    {
+        int64_t pts = vp->frame->pts;
+        int64_t start = trace::Begin();
+        int slot = (int)(vp->sequence % VIDEO_TEXTURE_RING_SIZE);
+        
+        if (sdl::util::UploadTexture(&mVideoTextures[slot], vp->frame, &mImageConvertContext) < 0)
+            return -1;
+        trace::Record(trace::STAGE_UPLOAD, start, mVideoStream, pts);
+        vp->texture = slot;
+        vp->uploaded = 1;
+        vp->vflip = vp->frame->linesize[0] < 0;
+        return 0;
+    }
+    
+    void VideoState::uploadAhead(double *remaining_time)
+    {
+        int64_t start = av_gettime_relative(), end;
+        Frame *vp;
+        int i;
+        
+        if (mHeadless || !mVideoAVStream || *remaining_time <= 0.0 || !mPictureQueue.numRemaining())
+            return;
+        /* the picture on screen keeps its texture until the next one is shown,
+         * before the first one every slot is free for the queued pictures */
+        if (mPictureQueue.getRIndexShown())
+            end = mPictureQueue.peekLast()->sequence + VIDEO_TEXTURE_RING_SIZE;
+        else
+            end = mPictureQueue.peek()->sequence + VIDEO_TEXTURE_RING_SIZE;
+        
+        for (i = 0; (vp = mPictureQueue.peekAhead(i)); i++) {
+            if (vp->sequence >= end)
+                break;
+            if (vp->uploaded || vp->serial != mVideoPacketQueue.getSerial())
+                continue;
+            if (uploadPicture(vp) < 0)
+                break;
+            mPicturesUploadedAhead++;
+            if ((av_gettime_relative() - start) / 1000000.0 >= *remaining_time)
+                break;
+        }
+        *remaining_time = FFMAX(*remaining_time - (av_gettime_relative() - start) / 1000000.0, 0.0);
+    }
+    
     void VideoState::drawVideo()
     {
        
@@ -1238,13 +2116,12 @@ namespace ffmpeg {
         sdl::util::CalcDisplayRect(&rect, mXLeft, mYTop, mWidth, mHeight, vp->width, vp->height, vp->sar);
         
         if (!vp->uploaded) {
-            if (sdl::util::UploadTexture(&mVideoTexture, vp->frame, &mImageConvertContext) < 0)
+            if (uploadPicture(vp) < 0)
                 return;
-            vp->uploaded = 1;
-            vp->vflip = vp->frame->linesize[0] < 0;
+            mPicturesUploadedOnDisplay++;
         }
         
-        SDL_RenderCopyEx(sdl::renderer()->getHandle(), mVideoTexture, NULL, &rect, 0, NULL, vp->vflip ? SDL_FLIP_VERTICAL : SDL_FLIP_NONE);
+        SDL_RenderCopyEx(sdl::renderer()->getHandle(), mVideoTextures[vp->texture], NULL, &rect, 0, NULL, vp->vflip ? SDL_FLIP_VERTICAL : SDL_FLIP_NONE);
         if (sp) {
 #if USE_ONEPASS_SUBTITLE_RENDER
             SDL_RenderCopy(renderer, is->sub_texture, NULL, &rect);
@@ -1281,7 +2158,8 @@ namespace ffmpeg {
         if (!mPaused) {
             int data_used = mShowMode == VideoState::SHOW_MODE_WAVES ? mWidth : (2*nb_freq);
             n = 2 * channels;
-            delay = mAudioWriteBufferSize;
+            /* samples are shown once rendered, which is this far ahead of the callback */
+            delay = mAudioRing.fill();
             delay /= n;
             
             /* to be more precise, we take into account the time spent since
@@ -1408,242 +2286,441 @@ namespace ffmpeg {
     }
     
     
+    /* a PlayerHost runs the same VideoBegin(), VideoStep() and VideoEnd() on its workers */
     int VideoState::VideoThread( void* arg )
     {
         VideoState *is = (VideoState*)arg;
-        AVFrame *frame = av_frame_alloc();
-        double pts;
-        double duration;
         int ret;
-        AVRational tb = is->mVideoAVStream->time_base;
-        AVRational frame_rate = av_guess_frame_rate(is->mFormatContext, is->mVideoAVStream, NULL);
         
+        if ((ret = VideoBegin(is)) < 0)
+            return ret;
+        while (VideoStep(is, true) >= 0)
+            ;
+        VideoEnd(is);
+        return 0;
+    }
+    
+    int VideoState::VideoBegin(VideoState *is)
+    {
+        DecodeTask *t = &is->mVideoTask;
+        
+        t->frame = av_frame_alloc();
+        t->converted = av_frame_alloc();
+        t->tb = is->mVideoAVStream->time_base;
+        t->frameRate = is->guessFrameRate(is->mVideoAVStream);
+        t->seekSerial = -1;
+        t->seekTarget = NAN;
+        t->pending = false;
 #if CONFIG_AVFILTER
-        AVFilterGraph *graph = avfilter_graph_alloc();
-        AVFilterContext *filt_out = NULL, *filt_in = NULL;
-        int last_w = 0;
-        int last_h = 0;
-        enum AVPixelFormat last_format = (AVPixelFormat)-2;
-        int last_serial = -1;
-        int last_vfilter_idx = 0;
-        if (!graph) {
-            av_frame_free(&frame);
+        t->graph = avfilter_graph_alloc();
+        t->filtOut = t->filtIn = NULL;
+        t->lastW = 0;
+        t->lastH = 0;
+        t->lastFormat = (AVPixelFormat)-2;
+        t->lastSerial = -1;
+        t->lastVFilterIdx = 0;
+        if (!t->graph) {
+            VideoEnd(is);
             return AVERROR(ENOMEM);
         }
-        
 #endif
         
-        if (!frame) {
-#if CONFIG_AVFILTER
-            avfilter_graph_free(&graph);
-#endif
+        if (!t->frame || !t->converted) {
+            VideoEnd(is);
             return AVERROR(ENOMEM);
         }
+        return 0;
+    }
+    
+    /* decodes and queues a picture: 1 once it did some work, 0 when without block
+     * there was no packet to decode or no room for the picture, < 0 once aborted */
+    int VideoState::VideoStep(VideoState *is, bool block)
+    {
+        DecodeTask *t = &is->mVideoTask;
+        AVFrame *frame = t->frame;
+        double pts;
+        double duration;
+        int ret;
+        
+        /* a hosted decoder gives its worker back rather than wait for the display,
+         * the queue may even have shrunk under the picture it decoded */
+        if (t->pending) {
+            ret = is->queuePicture(frame, t->pendingPts, opts::duration(), frame->pkt_pos, t->pendingSerial, block);
+            if (ret == AVERROR(EAGAIN))
+                return 0;
+            t->pending = false;
+            av_frame_unref(frame);
+            return ret < 0 ? ret : 1;
+        }
+        if (!block && !is->mPictureQueue.canWrite())
+            return 0;
+        ret = is->getFrame(frame, block);
+        if (ret == AVERROR(EAGAIN))
+            return 0;
+        if (ret < 0)
+            return ret;
+        if (!ret)
+            return 1;
         
-        for (;;) {
-            ret = is->getFrame(frame);
-            if (ret < 0)
-                goto the_end;
-            if (!ret)
-                continue;
-            
 #if CONFIG_AVFILTER
-            if (   last_w != frame->width
-                || last_h != frame->height
-                || last_format != frame->format
-                || last_serial != is->viddec.pkt_serial
-                || last_vfilter_idx != is->vfilter_idx) {
-                av_log(NULL, AV_LOG_DEBUG,
-                       "Video frame changed from size:%dx%d format:%s serial:%d to size:%dx%d format:%s serial:%d\n",
-                       last_w, last_h,
-                       (const char *)av_x_if_null(av_get_pix_fmt_name(last_format), "none"), last_serial,
-                       frame->width, frame->height,
-                       (const char *)av_x_if_null(av_get_pix_fmt_name((AVPixelFormat)frame->format), "none"), is->viddec.pkt_serial);
-                avfilter_graph_free(&graph);
-                graph = avfilter_graph_alloc();
-                if ((ret = configure_video_filters(graph, is, vfilters_list ? vfilters_list[is->vfilter_idx] : NULL, frame)) < 0) {
-                    SDL_Event event;
-                    event.type = FF_QUIT_EVENT;
-                    event.user.data1 = is;
-                    SDL_PushEvent(&event);
-                    goto the_end;
-                }
-                filt_in  = is->in_video_filter;
-                filt_out = is->out_video_filter;
-                last_w = frame->width;
-                last_h = frame->height;
-                last_format = (AVPixelFormat)frame->format;
-                last_serial = is->viddec.pkt_serial;
-                last_vfilter_idx = is->vfilter_idx;
-                frame_rate = av_buffersink_get_frame_rate(filt_out);
+        if (   t->lastW != frame->width
+            || t->lastH != frame->height
+            || t->lastFormat != frame->format
+            || t->lastSerial != is->viddec.pkt_serial
+            || t->lastVFilterIdx != is->vfilter_idx) {
+            av_log(NULL, AV_LOG_DEBUG,
+                   "Video frame changed from size:%dx%d format:%s serial:%d to size:%dx%d format:%s serial:%d\n",
+                   t->lastW, t->lastH,
+                   (const char *)av_x_if_null(av_get_pix_fmt_name(t->lastFormat), "none"), t->lastSerial,
+                   frame->width, frame->height,
+                   (const char *)av_x_if_null(av_get_pix_fmt_name((AVPixelFormat)frame->format), "none"), is->viddec.pkt_serial);
+            avfilter_graph_free(&t->graph);
+            t->graph = avfilter_graph_alloc();
+            if ((ret = configure_video_filters(t->graph, is, vfilters_list ? vfilters_list[is->vfilter_idx] : NULL, frame)) < 0) {
+                SDL_Event event;
+                event.type = FF_QUIT_EVENT;
+                event.user.data1 = is;
+                SDL_PushEvent(&event);
+                return ret;
             }
+            t->filtIn  = is->in_video_filter;
+            t->filtOut = is->out_video_filter;
+            t->lastW = frame->width;
+            t->lastH = frame->height;
+            t->lastFormat = (AVPixelFormat)frame->format;
+            t->lastSerial = is->viddec.pkt_serial;
+            t->lastVFilterIdx = is->vfilter_idx;
+            t->frameRate = av_buffersink_get_frame_rate(t->filtOut);
+        }
+        
+        ret = av_buffersrc_add_frame(t->filtIn, frame);
+        if (ret < 0)
+            return ret;
+        
+        while (ret >= 0) {
+            is->frame_last_returned_time = av_gettime_relative() / 1000000.0;
             
-            ret = av_buffersrc_add_frame(filt_in, frame);
-            if (ret < 0)
-                goto the_end;
+            ret = av_buffersink_get_frame_flags(t->filtOut, frame, 0);
+            if (ret < 0) {
+                if (ret == AVERROR_EOF)
+                    is->viddec.finished = is->viddec.pkt_serial;
+                ret = 0;
+                break;
+            }
             
-            while (ret >= 0) {
-                is->frame_last_returned_time = av_gettime_relative() / 1000000.0;
-                
-                ret = av_buffersink_get_frame_flags(filt_out, frame, 0);
-                if (ret < 0) {
-                    if (ret == AVERROR_EOF)
-                        is->viddec.finished = is->viddec.pkt_serial;
-                    ret = 0;
-                    break;
-                }
-                
-                is->frame_last_filter_delay = av_gettime_relative() / 1000000.0 - is->frame_last_returned_time;
-                if (fabs(is->frame_last_filter_delay) > AV_NOSYNC_THRESHOLD / 10.0)
-                    is->frame_last_filter_delay = 0;
-                tb = av_buffersink_get_time_base(filt_out);
+            is->frame_last_filter_delay = av_gettime_relative() / 1000000.0 - is->frame_last_returned_time;
+            if (fabs(is->frame_last_filter_delay) > AV_NOSYNC_THRESHOLD / 10.0)
+                is->frame_last_filter_delay = 0;
+            t->tb = av_buffersink_get_time_base(t->filtOut);
 #endif
-                duration = (frame_rate.num && frame_rate.den ? av_q2d((AVRational){frame_rate.den, frame_rate.num}) : 0);
-                pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
-                ret = is->queuePicture(frame, pts, opts::duration(), frame->pkt_pos, is->mVideoDecoder.getPacketSerial());
-                av_frame_unref(frame);
-#if CONFIG_AVFILTER
+            /* fast start may only learn it once the stream plays */
+            if (!t->frameRate.num)
+                t->frameRate = is->guessFrameRate(is->mVideoAVStream);
+            duration = (t->frameRate.num && t->frameRate.den ? av_q2d((AVRational){t->frameRate.den, t->frameRate.num}) : 0);
+            pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(t->tb);
+            if (is->mVideoDecoder.getPacketSerial() != t->seekSerial) {
+                t->seekSerial = is->mVideoDecoder.getPacketSerial();
+                t->seekTarget = is->mAccurateSeekTarget;
             }
-#endif
-            
-            if (ret < 0)
-                goto the_end;
+            if (!isnan(t->seekTarget)) {
+                /* decoded on the way from the keyframe to the target, never converted or shown */
+                if (!isnan(pts) && pts + duration <= t->seekTarget) {
+                    is->mSeekFramesDiscarded++;
+                    av_frame_unref(frame);
+                    return 1;
+                }
+                t->seekTarget = NAN;
+            }
+            /* the sinks get the decoded picture, before any conversion for the display */
+            is->deliverToSinks(AVMEDIA_TYPE_VIDEO, is->mVideoStream, frame, t->tb, pts, duration, is->mVideoDecoder.getPacketSerial());
+            if (!is->mHeadless && (ret = is->convertPicture(&t->converter, frame, t->converted)) < 0)
+                return ret;
+            ret = is->queuePicture(frame, pts, opts::duration(), frame->pkt_pos, is->mVideoDecoder.getPacketSerial(), block);
+            if (ret == AVERROR(EAGAIN)) {
+                t->pending = true;
+                t->pendingPts = pts;
+                t->pendingSerial = is->mVideoDecoder.getPacketSerial();
+                return 1;
+            }
+            av_frame_unref(frame);
+#if CONFIG_AVFILTER
         }
-    the_end:
+#endif
+        
+        return ret < 0 ? ret : 1;
+    }
+    
+    void VideoState::VideoEnd(VideoState *is)
+    {
+        DecodeTask *t = &is->mVideoTask;
+        
 #if CONFIG_AVFILTER
-        avfilter_graph_free(&graph);
+        avfilter_graph_free(&t->graph);
 #endif
-        av_frame_free(&frame);
+        av_frame_free(&t->frame);
+        av_frame_free(&t->converted);
+        t->converter.destroy();
+    }
+    
+    /* pictures SDL has no texture format for are converted here rather than on the
+     * main thread while uploading, frame is replaced by the converted picture */
+    int VideoState::convertPicture(FrameConverter *converter, AVFrame *frame, AVFrame *converted)
+    {
+        Uint32 sdl_pix_fmt;
+        SDL_BlendMode sdl_blendmode;
+        int ret;
+        
+        sdl::util::GetSDLPixFmtAndBlendMode(frame->format, &sdl_pix_fmt, &sdl_blendmode);
+        if (sdl_pix_fmt != SDL_PIXELFORMAT_UNKNOWN)
+            return 0;
+        if (!converter->getThreadCount() && (ret = converter->init(mHost ? 1 : opts::videoConvertThreads())) < 0)
+            return ret;
+        if ((ret = converter->convert(converted, frame, AV_PIX_FMT_BGRA)) < 0) {
+            /* leave it to the upload */
+            av_frame_unref(converted);
+            return 0;
+        }
+        av_frame_unref(frame);
+        av_frame_move_ref(frame, converted);
+        mConvertedFrames++;
         return 0;
     }
     
+    /* a PlayerHost runs the same AudioBegin(), AudioStep() and AudioEnd() on its workers */
     int VideoState::AudioThread( void* arg )
     {
         VideoState *is = (VideoState*)arg;
-        AVFrame *frame = av_frame_alloc();
+        int ret;
+        
+        if ((ret = AudioBegin(is)) < 0)
+            return ret;
+        while (AudioStep(is, true) >= 0)
+            ;
+        AudioEnd(is);
+        return 0;
+    }
+    
+    int VideoState::AudioBegin(VideoState *is)
+    {
+        DecodeTask *t = &is->mAudioTask;
+        
+        t->converted = nullptr;
+        t->seekSerial = -1;
+        t->seekTarget = NAN;
+#if CONFIG_AVFILTER
+        t->lastSerial = -1;
+#endif
+        if (!(t->frame = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+        return 0;
+    }
+    
+    /* decodes and queues a frame of samples: 1 once it did some work, 0 when without
+     * block there was no packet to decode or no room for the samples, < 0 once aborted */
+    int VideoState::AudioStep(VideoState *is, bool block)
+    {
+        DecodeTask *t = &is->mAudioTask;
+        AVFrame *frame = t->frame;
         Frame *af;
 #if CONFIG_AVFILTER
-        int last_serial = -1;
         int64_t dec_channel_layout;
         int reconfigure;
 #endif
         int got_frame = 0;
         AVRational tb;
+        double pts;
         int ret = 0;
         
-        if (!frame)
-            return AVERROR(ENOMEM);
+        if (!block && !is->mSampleQueue.canWrite())
+            return 0;
+        if ((got_frame = is->mAudioDecoder.decodeFrame( frame, NULL, block)) == AVERROR(EAGAIN))
+            return 0;
+        if (got_frame < 0)
+            return got_frame;
         
-        do {
-            if ((got_frame = is->mAudioDecoder.decodeFrame( frame, NULL)) < 0)
-                goto the_end;
+        if (got_frame) {
+            tb = (AVRational){1, frame->sample_rate};
             
-            if (got_frame) {
-                tb = (AVRational){1, frame->sample_rate};
-                
 #if CONFIG_AVFILTER
-                dec_channel_layout = get_valid_channel_layout(frame->channel_layout, frame->channels);
+            dec_channel_layout = get_valid_channel_layout(frame->channel_layout, frame->channels);
+            
+            reconfigure =
+            cmp_audio_fmts(is->audio_filter_src.fmt, is->audio_filter_src.channels,
+                           (AVSampleFormat)frame->format, frame->channels)    ||
+            is->audio_filter_src.channel_layout != dec_channel_layout ||
+            is->audio_filter_src.freq           != frame->sample_rate ||
+            is->auddec.pkt_serial               != t->lastSerial;
+            
+            if (reconfigure) {
+                char buf1[1024], buf2[1024];
+                av_get_channel_layout_string(buf1, sizeof(buf1), -1, is->audio_filter_src.channel_layout);
+                av_get_channel_layout_string(buf2, sizeof(buf2), -1, dec_channel_layout);
+                av_log(NULL, AV_LOG_DEBUG,
+                       "Audio frame changed from rate:%d ch:%d fmt:%s layout:%s serial:%d to rate:%d ch:%d fmt:%s layout:%s serial:%d\n",
+                       is->audio_filter_src.freq, is->audio_filter_src.channels, av_get_sample_fmt_name(is->audio_filter_src.fmt), buf1, t->lastSerial,
+                       frame->sample_rate, frame->channels, av_get_sample_fmt_name((AVSampleFormat)frame->format), buf2, is->auddec.pkt_serial);
                 
-                reconfigure =
-                cmp_audio_fmts(is->audio_filter_src.fmt, is->audio_filter_src.channels,
-                               (AVSampleFormat)frame->format, frame->channels)    ||
-                is->audio_filter_src.channel_layout != dec_channel_layout ||
-                is->audio_filter_src.freq           != frame->sample_rate ||
-                is->auddec.pkt_serial               != last_serial;
+                is->audio_filter_src.fmt            = (AVSampleFormat)frame->format;
+                is->audio_filter_src.channels       = frame->channels;
+                is->audio_filter_src.channel_layout = dec_channel_layout;
+                is->audio_filter_src.freq           = frame->sample_rate;
+                t->lastSerial                       = is->auddec.pkt_serial;
                 
-                if (reconfigure) {
-                    char buf1[1024], buf2[1024];
-                    av_get_channel_layout_string(buf1, sizeof(buf1), -1, is->audio_filter_src.channel_layout);
-                    av_get_channel_layout_string(buf2, sizeof(buf2), -1, dec_channel_layout);
-                    av_log(NULL, AV_LOG_DEBUG,
-                           "Audio frame changed from rate:%d ch:%d fmt:%s layout:%s serial:%d to rate:%d ch:%d fmt:%s layout:%s serial:%d\n",
-                           is->audio_filter_src.freq, is->audio_filter_src.channels, av_get_sample_fmt_name(is->audio_filter_src.fmt), buf1, last_serial,
-                           frame->sample_rate, frame->channels, av_get_sample_fmt_name((AVSampleFormat)frame->format), buf2, is->auddec.pkt_serial);
-                    
-                    is->audio_filter_src.fmt            = (AVSampleFormat)frame->format;
-                    is->audio_filter_src.channels       = frame->channels;
-                    is->audio_filter_src.channel_layout = dec_channel_layout;
-                    is->audio_filter_src.freq           = frame->sample_rate;
-                    last_serial                         = is->auddec.pkt_serial;
-                    
-                    if ((ret = configure_audio_filters(is, afilters, 1)) < 0)
-                        goto the_end;
+                if ((ret = configure_audio_filters(is, afilters, 1)) < 0)
+                    return ret;
+            }
+            
+            if ((ret = av_buffersrc_add_frame(is->in_audio_filter, frame)) < 0)
+                return ret;
+            
+            while ((ret = av_buffersink_get_frame_flags(is->out_audio_filter, frame, 0)) >= 0) {
+                tb = av_buffersink_get_time_base(is->out_audio_filter);
+#endif
+                pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+                if (is->mAudioDecoder.getPacketSerial() != t->seekSerial) {
+                    t->seekSerial = is->mAudioDecoder.getPacketSerial();
+                    t->seekTarget = is->mAccurateSeekTarget;
+                }
+                if (!isnan(t->seekTarget)) {
+                    /* frames that end before an accurate seek target are not played */
+                    if (!isnan(pts) && pts + (double)frame->nb_samples / frame->sample_rate <= t->seekTarget) {
+                        is->mSeekFramesDiscarded++;
+                        av_frame_unref(frame);
+                        return 1;
+                    }
+                    t->seekTarget = NAN;
                 }
                 
-                if ((ret = av_buffersrc_add_frame(is->in_audio_filter, frame)) < 0)
-                    goto the_end;
+                is->deliverToSinks(AVMEDIA_TYPE_AUDIO, is->mAudioStream, frame, tb, pts,
+                                   (double)frame->nb_samples / frame->sample_rate, is->mAudioDecoder.getPacketSerial());
+                if (!(af = is->mSampleQueue.peekWriteable()))
+                    return -1;
+                
+                af->pts = pts;
+                af->position = frame->pkt_pos;
+                af->serial = is->mAudioDecoder.getPacketSerial();
+                af->duration = av_q2d((AVRational){frame->nb_samples, frame->sample_rate});
+                
+                av_frame_move_ref(af->frame, frame);
+                is->mSampleQueue.push();
                 
-                while ((ret = av_buffersink_get_frame_flags(is->out_audio_filter, frame, 0)) >= 0) {
-                    tb = av_buffersink_get_time_base(is->out_audio_filter);
-#endif
-                    if (!(af = is->mSampleQueue.peekWriteable()))
-                        goto the_end;
-                    
-                    af->pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
-                    af->position = frame->pkt_pos;
-                    af->serial = is->mAudioDecoder.getPacketSerial();
-                    af->duration = av_q2d((AVRational){frame->nb_samples, frame->sample_rate});
-                    
-                    av_frame_move_ref(af->frame, frame);
-                    is->mSampleQueue.push();
-                    
 #if CONFIG_AVFILTER
-                    if (is->mAudioPacketQueue.getSerial() != is->mAudioDecoder.getPacketSerial())
-                        break;
-                }
-                if (ret == AVERROR_EOF)
-                    is->auddec.finished = is->auddec.pkt_serial;
-#endif
+                if (is->mAudioPacketQueue.getSerial() != is->mAudioDecoder.getPacketSerial())
+                    break;
             }
-        } while (ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
-    the_end:
+            if (ret == AVERROR_EOF)
+                is->auddec.finished = is->auddec.pkt_serial;
+#endif
+        }
+        return ret >= 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 1 : ret;
+    }
+    
+    void VideoState::AudioEnd(VideoState *is)
+    {
 #if CONFIG_AVFILTER
         avfilter_graph_free(&is->agraph);
 #endif
-        av_frame_free(&frame);
+        av_frame_free(&is->mAudioTask.frame);
+    }
+    
+    int VideoState::KeyframeScanThread( void* arg )
+    {
+        VideoState *is = (VideoState*)arg;
+        int ret = is->mKeyframeIndex.scan(is->mFilename.c_str(), is->mInputFormat, is->mVideoStream, &is->mAbortRequest);
+        if (ret < 0)
+            PrintError(is->mFilename.c_str(), ret);
+        return ret;
+    }
+    
+    int VideoState::StreamInfoThread( void* arg )
+    {
+        VideoState *is = (VideoState*)arg;
+        AVFormatContext *ic = avformat_alloc_context();
+        AVDictionary **opts;
+        int64_t start = av_gettime_relative();
+        int i, orig_nb_streams, ret;
+        
+        if (!ic) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        ic->interrupt_callback.callback = VideoState::DecodeInterruptCallback;
+        ic->interrupt_callback.opaque = is;
+        if ((ret = avformat_open_input(&ic, is->mFilename.c_str(), is->mInputFormat, NULL)) < 0)
+            goto fail;
+        
+        opts = opts::setup_find_stream_info_opts(ic, is->mCodecOptions);
+        orig_nb_streams = ic->nb_streams;
+        ret = avformat_find_stream_info(ic, opts);
+        for (i = 0; i < orig_nb_streams; i++)
+            av_dict_free(&opts[i]);
+        av_freep(&opts);
+        if (ret < 0)
+            goto fail;
+        
+        av_log(NULL, AV_LOG_VERBOSE, "%s: stream info probed alongside playback in %.3fs\n",
+               is->mFilename.c_str(), (av_gettime_relative() - start) / 1000000.0);
+        is->mProbedFormatContext = ic;
+        is->mStreamInfoProbed = 1;
+        return 0;
+    fail:
+        avformat_close_input(&ic);
+        is->mStreamInfoProbed = 1;
         return ret;
     }
     
     int VideoState::SubtitleThread( void* arg )
     {
         VideoState *is = (VideoState*)arg;
+        
+        while (SubtitleStep(is, true) >= 0)
+            ;
+        return 0;
+    }
+    
+    /* decodes a subtitle: 1 once it did some work, 0 when without block there was
+     * no packet to decode or no room for the subtitle, < 0 once aborted */
+    int VideoState::SubtitleStep(VideoState *is, bool block)
+    {
         Frame *sp;
         int got_subtitle;
         double pts;
         
-        for (;;) {
-            if (!(sp = is->mSubtitleQueue.peekWriteable()))
-                return 0;
-            
-            if ((got_subtitle = is->mSubDecoder.decodeFrame(NULL, &sp->subtitle)) < 0)
-                break;
-            
-            pts = 0;
+        if (!block && !is->mSubtitleQueue.canWrite())
+            return 0;
+        if (!(sp = is->mSubtitleQueue.peekWriteable()))
+            return -1;
+        
+        if ((got_subtitle = is->mSubDecoder.decodeFrame(NULL, &sp->subtitle, block)) == AVERROR(EAGAIN))
+            return 0;
+        if (got_subtitle < 0)
+            return got_subtitle;
+        
+        pts = 0;
+        
+        if (got_subtitle && sp->subtitle.format == 0) {
+            if (sp->subtitle.pts != AV_NOPTS_VALUE)
+                pts = sp->subtitle.pts / (double)AV_TIME_BASE;
+            sp->pts = pts;
+            sp->serial = is->mSubDecoder.getPacketSerial();
+            sp->width = is->mSubDecoder.getAVContext()->width;
+            sp->height = is->mSubDecoder.getAVContext()->height;
+            sp->uploaded = 0;
             
-            if (got_subtitle && sp->subtitle.format == 0) {
-                if (sp->subtitle.pts != AV_NOPTS_VALUE)
-                    pts = sp->subtitle.pts / (double)AV_TIME_BASE;
-                sp->pts = pts;
-                sp->serial = is->mSubDecoder.getPacketSerial();
-                sp->width = is->mSubDecoder.getAVContext()->width;
-                sp->height = is->mSubDecoder.getAVContext()->height;
-                sp->uploaded = 0;
-                
-                /* now we can update the picture count */
-                is->mSubtitleQueue.push();
-            } else if (got_subtitle) {
-                avsubtitle_free(&sp->subtitle);
-            }
+            /* now we can update the picture count */
+            is->mSubtitleQueue.push();
+        } else if (got_subtitle) {
+            avsubtitle_free(&sp->subtitle);
         }
-        return 0;
+        return 1;
     }
     
-    int VideoState::getFrame(AVFrame *frame)
+    int VideoState::getFrame(AVFrame *frame, bool block)
     {
         int got_picture;
         
-        if ((got_picture = mVideoDecoder.decodeFrame(frame, NULL)) < 0)
-            return -1;
+        if ((got_picture = mVideoDecoder.decodeFrame(frame, NULL, block)) < 0)
+            return got_picture == AVERROR(EAGAIN) ? got_picture : -1;
         
         if (got_picture) {
             double dpts = NAN;
@@ -1653,7 +2730,7 @@ namespace ffmpeg {
             
             frame->sample_aspect_ratio = av_guess_sample_aspect_ratio(mFormatContext, mVideoAVStream, frame);
             
-            if (opts::framedrop()>0 || (opts::framedrop() && getMasterSyncType() != AV_SYNC_VIDEO_MASTER)) {
+            if (!mHeadless && (opts::framedrop()>0 || (opts::framedrop() && getMasterSyncType() != AV_SYNC_VIDEO_MASTER))) {
                 if (frame->pts != AV_NOPTS_VALUE) {
                     double diff = dpts - getMasterClock();
                     if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
@@ -1673,6 +2750,7 @@ namespace ffmpeg {
     
     void VideoState::checkExternalClockSpeed()
     {
+        double old_speed = mExternalClock.getSpeed();
         if ((mVideoStream >= 0 && mVideoPacketQueue.getNumPackets() <= EXTERNAL_CLOCK_MIN_FRAMES) ||
             (mAudioStream >= 0 && mAudioPacketQueue.getNumPackets() <= EXTERNAL_CLOCK_MIN_FRAMES)) {
             mExternalClock.setSpeed(FFMAX(EXTERNAL_CLOCK_SPEED_MIN, mExternalClock.getSpeed() - EXTERNAL_CLOCK_SPEED_STEP));
@@ -1684,6 +2762,10 @@ namespace ffmpeg {
             if (speed != 1.0)
                 mExternalClock.setSpeed(speed + EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed));
         }
+        if (mExternalClock.getSpeed() != old_speed) {
+            mExternalClockAdjustments++;
+            mExternalClockSpeed = mExternalClock.getSpeed();
+        }
     }
     
     double VideoState::vp_duration(Frame *vp, Frame *nextvp) {
@@ -1700,26 +2782,16 @@ namespace ffmpeg {
     
     double VideoState::computeTargetDelay(double delay)
     {
-        double sync_threshold, diff = 0;
+        double diff = 0;
         
         /* update delay to follow master synchronisation source */
         if (getMasterSyncType() != AV_SYNC_VIDEO_MASTER) {
             /* if video is slave, we try to correct big delays by
              duplicating or deleting a frame */
             diff = mVideoClock.get() - getMasterClock();
-            
-            /* skip or repeat frame. We take into account the
-             delay to compute the threshold. I still don't know
-             if it is the best guess */
-            sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
-            if (!isnan(diff) && fabs(diff) < mMaxFrameDuration) {
-                if (diff <= -sync_threshold)
-                    delay = FFMAX(0, delay + diff);
-                else if (diff >= sync_threshold && delay > AV_SYNC_FRAMEDUP_THRESHOLD)
-                    delay = delay + diff;
-                else if (diff >= sync_threshold)
-                    delay = 2 * delay;
-            }
+            if (!isnan(diff))
+                mAVDrift = -diff;
+            delay = ComputeTargetDelay(delay, diff, mMaxFrameDuration);
         }
         
         av_log(NULL, AV_LOG_TRACE, "video: delay=%0.3f A-V=%f\n",
@@ -1728,6 +2800,25 @@ namespace ffmpeg {
         return delay;
     }
     
+    double VideoState::ComputeTargetDelay(double delay, double diff, double max_frame_duration)
+    {
+        double sync_threshold;
+        
+        /* skip or repeat frame. We take into account the
+         delay to compute the threshold. I still don't know
+         if it is the best guess */
+        sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
+        if (!isnan(diff) && fabs(diff) < max_frame_duration) {
+            if (diff <= -sync_threshold)
+                delay = FFMAX(0, delay + diff);
+            else if (diff >= sync_threshold && delay > AV_SYNC_FRAMEDUP_THRESHOLD)
+                delay = delay + diff;
+            else if (diff >= sync_threshold)
+                delay = 2 * delay;
+        }
+        return delay;
+    }
+    
     void VideoState::videoRefresh(double *remaining_time)
     {
         double time;
@@ -1783,11 +2874,8 @@ namespace ffmpeg {
                 if (delay > 0 && time - mFrameTimer > AV_SYNC_THRESHOLD_MAX)
                     mFrameTimer = time;
                 
-                {
-                    sdl::ScopedLock lock(mPictureQueue.getMutex());
-                    if (!isnan(vp->pts))
-                        updateVideoPts(vp->pts, vp->position, vp->serial);
-                }
+                if (!isnan(vp->pts))
+                    updateVideoPts(vp->pts, vp->position, vp->serial);
                 
                 if (mPictureQueue.numRemaining() > 1) {
                     Frame *nextvp = mPictureQueue.peekNext();
@@ -1833,16 +2921,31 @@ namespace ffmpeg {
                     }
                 }
                 
+                /* vp is the picture shown from now on, the window draws it below */
+                deliverToSinks(AVMEDIA_TYPE_VIDEO, mVideoStream, vp->frame, mVideoAVStream->time_base,
+                               vp->pts, vp->duration, vp->serial, FrameSink::TAP_DISPLAYED);
                 mPictureQueue.next();
                 forceRefresh();
+                if (mHost)
+                    mHost->wake(this);
                 
                 if (mStep && !mPaused)
                     toggleStreamPause();
             }
         display:
+            if (mAdaptivePictureQueue)
+                adaptPictureQueueSize();
             /* display picture */
-            if (sdl::IsVideoEnabled() && getForceRefresh() && mShowMode == VideoState::SHOW_MODE_VIDEO && mPictureQueue.getRIndexShown())
+            if (sdl::IsVideoEnabled() && getForceRefresh() && mShowMode == VideoState::SHOW_MODE_VIDEO && mPictureQueue.getRIndexShown()) {
+                int64_t start = trace::Begin();
                 draw();
+                trace::Record(trace::STAGE_DISPLAY, start, mVideoStream, mPictureQueue.peekLast()->frame->pts);
+                if (mTimeToFirstFrame < 0) {
+                    mTimeToFirstFrame = (av_gettime_relative() - mOpenTime) / 1000000.0;
+                    av_log(NULL, AV_LOG_INFO, "%s: first frame %.3fs after opening, streams known after %.3fs\n",
+                           mFilename.c_str(), mTimeToFirstFrame.load(), mTimeToOpen.load());
+                }
+            }
         }
         mForceRefresh = 0;
         if (opts::showStatus()) {
@@ -1870,14 +2973,16 @@ namespace ffmpeg {
                 else if (mAudioAVStream)
                     av_diff = getMasterClock() - mAudioClock.get();
                 av_log(NULL, AV_LOG_INFO,
-                       "%7.2f %s:%7.3f fd=%4d aq=%5dKB vq=%5dKB sq=%5dB f=%" PRId64 "/%" PRId64 "   \r",
+                       "%7.2f %s:%7.3f fd=%4d aq=%5dKB vq=%5dKB sq=%5dB al=%3dms aj=%4.1fms f=%" PRId64 "/%" PRId64 "   \r",
                        getMasterClock(),
                        (mAudioStream && mVideoAVStream) ? "A-V" : (mVideoAVStream ? "M-V" : (mAudioAVStream ? "M-A" : "   ")),
                        av_diff,
-                       mFrameDropsEarly + mFrameDropsLate,
+                       mFrameDropsEarly.load() + mFrameDropsLate.load(),
                        aqsize / 1024,
                        vqsize / 1024,
                        sqsize,
+                       isnan(mAudioLatency.getLatency()) ? 0 : (int)lrint(mAudioLatency.getLatency() * 1000),
+                       isnan(mAudioLatency.getJitter()) ? 0.0 : mAudioLatency.getJitter() * 1000,
                        mVideoAVStream ? mVideoDecoder.getAVContext()->pts_correction_num_faulty_dts : 0,
                        mVideoAVStream ? mVideoDecoder.getAVContext()->pts_correction_num_faulty_pts : 0);
                 fflush(stdout);
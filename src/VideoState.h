@@ -8,6 +8,8 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <atomic>
 
 extern "C" {
 #include "libavutil/avstring.h"
@@ -35,6 +37,16 @@ extern "C" {
 #include "Decoder.h"
 #include "AudioParams.h"
 #include "Buffer.h"
+#include "AudioGain.h"
+#include "AudioRing.h"
+#include "AudioLatency.h"
+#include "FrameConverter.h"
+#include "KeyframeIndex.h"
+#include "IndexCache.h"
+#include "InputIO.h"
+#include "FrameSink.h"
+#include "FFMPEGUtil.h"
+#include "SDLUtil.h"
 
 enum AVSyncType {
     AV_SYNC_AUDIO_MASTER, /* default choice */
@@ -44,6 +56,8 @@ enum AVSyncType {
 
 namespace ffmpeg {
 
+class PlayerHost;
+
 class VideoState {
 public:
     
@@ -53,6 +67,61 @@ public:
         SHOW_MODE_NONE = -1, SHOW_MODE_VIDEO = 0, SHOW_MODE_WAVES, SHOW_MODE_RDFT, SHOW_MODE_NB
     };
     
+    struct Occupancy {
+        double average;
+        int peak;
+    };
+    
+    struct QueueStats {
+        int packets;
+        int bytes;
+        double duration;                /* seconds */
+    };
+    
+    struct Stats {
+        int64_t time;                   /* av_gettime_relative() when the snapshot was taken */
+        int frameDropsEarly;
+        int frameDropsLate;
+        QueueStats videoQueue;
+        QueueStats audioQueue;
+        QueueStats subtitleQueue;
+        int pictureQueueFrames;         /* decoded pictures waiting to be shown */
+        int pictureQueueSize;
+        int sampleQueueFrames;
+        double avDrift;                 /* last A-V difference seen by computeTargetDelay, seconds */
+        int audioUnderruns;             /* audio callbacks that ran out of decoded samples */
+        int audioRingFill;              /* bytes rendered ahead of the audio callback */
+        double audioLatency;            /* measured audio device latency in seconds, negative until known */
+        double audioJitter;             /* audio callback jitter in seconds, negative until known */
+        int64_t uploads[sdl::util::UPLOAD_PATH_NB];    /* pictures uploaded by each path so far */
+        int64_t convertedFrames;        /* pictures converted to BGRA in the video thread */
+        int64_t picturesUploadedAhead;  /* uploaded by uploadAhead() before their turn */
+        int64_t picturesUploadedOnDisplay;
+        int keyframes;                  /* keyframes in the index */
+        int seeksIndexed;               /* seeks that went straight to an indexed keyframe */
+        int64_t seekFramesDiscarded;    /* decoded on the way to an accurate seek target */
+        double timeToOpen;              /* seconds from streamOpen() until the streams were known, negative until then */
+        double timeToFirstFrame;        /* seconds from streamOpen() to the first picture shown, negative until then */
+        InputIO::Stats io;              /* all zero unless a custom input context reads the file */
+        int frameSinks;                 /* attached with addFrameSink */
+        int64_t sinkFramesQueued;       /* frame references handed to the sinks' queues */
+        int64_t sinkFramesDropped;      /* dropped from them because a sink fell behind or seeked past */
+        int externalClockAdjustments;   /* speed changes made by checkExternalClockSpeed */
+        double externalClockSpeed;
+    };
+    
+    struct HeadlessReport {
+        double wallTime;            /* seconds from runHeadless() to the end of the input */
+        int64_t videoFrames;
+        int64_t audioSamples;
+        double videoFramesPerSec;
+        double audioSamplesPerSec;
+        Occupancy videoPackets;     /* packets waiting for the video decoder */
+        Occupancy audioPackets;     /* packets waiting for the audio decoder */
+        Occupancy pictures;         /* decoded pictures waiting for the sink */
+        Occupancy sampleFrames;     /* decoded audio frames waiting for the sink */
+    };
+    
     VideoState();
     ~VideoState();
     
@@ -72,6 +141,9 @@ public:
     bool hasAudioStream();
     bool hasSubtitleStream();
     void seek(int amount);
+    void setPictureQueueSize(int size);
+    inline void setDecoderThreading(AVMediaType type, const opts::DecoderThreading& threading){mDecoderThreading[type] = threading;}
+    inline void setAdaptivePictureQueue(bool set, int64_t memory_limit = PICTURE_QUEUE_MEMORY_LIMIT){mAdaptivePictureQueue = set; mPictureQueueMemoryLimit = memory_limit;}
     
     FrameQueue& getVideoFrameQueue(){return mPictureQueue;}
     FrameQueue& getAudioFrameQueue(){return mSampleQueue;}
@@ -84,32 +156,129 @@ public:
     inline void seekByBytes(bool set = true){mSeekByBytes = set;}
 
     void videoRefresh(double *remaining_time);
+    /* upload queued pictures to their textures while the refresh loop would idle,
+     * spending at most *remaining_time and taking what it spent off it */
+    void uploadAhead(double *remaining_time);
+    
+    /* headless mode opens no window or audio device, null sinks consume the decoded
+     * frames as fast as the pipeline produces them; set it before streamOpen() */
+    inline void setHeadless(bool set = true){mHeadless = set;}
+    inline bool isHeadless()const{return mHeadless;}
+    int runHeadless(HeadlessReport *report);
+    
+    /* safe to call from any thread while playing; no lock the playing threads
+     * take, only the one streamClose() holds while it frees the input context,
+     * and no AVStream that closing frees */
+    Stats getStats();
+    
+    /* sink gets the decoded frames of the stream of type through a queue of
+     * queue_size frames, or with TAP_DISPLAYED only the pictures shown, as the
+     * display has them; safe to call from any thread, before or while playing */
+    int addFrameSink(FrameSink *sink, AVMediaType type, int queue_size = FRAME_SINK_QUEUE_SIZE, FrameSink::Tap tap = FrameSink::TAP_DECODED);
+    /* returns once the sink is out of onFrame(), after its onEnd() */
+    void removeFrameSink(FrameSink *sink);
+    
+    /* the sync math of synchronizeAudio() and computeTargetDelay() on a clock
+     * difference already taken, diff is the slave clock minus the master one */
+    static int SynchronizeAudio(int nb_samples, double diff, int freq, double threshold, double *diff_cum, double *avg_coef, int *avg_count);
+    static double ComputeTargetDelay(double delay, double diff, double max_frame_duration);
+    
+    /* set by PlayerHost::add(), before streamOpen() */
+    inline PlayerHost* getHost()const{return mHost;}
     
 private:
     
+    friend class PlayerHost;
+    
+    /* what a decoder keeps from one step to the next */
+    struct DecodeTask {
+        AVFrame *frame;
+        AVFrame *converted;
+        FrameConverter converter;
+        AVRational tb;
+        AVRational frameRate;
+        int seekSerial;
+        double seekTarget;
+        /* a hosted decoder's picture waiting in frame for room in the queue */
+        bool pending;
+        double pendingPts;
+        int pendingSerial;
+#if CONFIG_AVFILTER
+        AVFilterGraph *graph;
+        AVFilterContext *filtOut, *filtIn;
+        int lastW, lastH;
+        enum AVPixelFormat lastFormat;
+        int lastSerial, lastVFilterIdx;
+#endif
+    };
+    
     static int ReadThread( void* is );
+    static int ReadBegin(VideoState *is);
+    static int ReadStep(VideoState *is, bool block);
+    static void ReadEnd(VideoState *is, int ret);
     static int VideoThread( void* is );
+    static int VideoBegin(VideoState *is);
+    static int VideoStep(VideoState *is, bool block);
+    static void VideoEnd(VideoState *is);
     static int AudioThread( void* is );
+    static int AudioBegin(VideoState *is);
+    static int AudioStep(VideoState *is, bool block);
+    static void AudioEnd(VideoState *is);
+    static int AudioRenderThread( void* is );
     static int SubtitleThread( void* is );
+    static int SubtitleStep(VideoState *is, bool block);
+    static int KeyframeScanThread( void* is );
+    static int StreamInfoThread( void* is );
+    static int HeadlessVideoSink( void* is );
+    static int HeadlessAudioSink( void* is );
     void streamSeek(int64_t pos, int64_t rel, bool seek_by_bytes);
+    int indexedSeek(int64_t target, int64_t min, int64_t max);
     void openWindow(const std::string& filename);
     static int StreamHasEnoughPackets(AVStream *st, int stream_id, PacketQueue *queue);
     static int DecodeInterruptCallback(void *ctx);
     int streamComponentOpen(int stream_index);
     void streamComponentClose(int stream_index);
+    int startDecoder(Decoder *decoder, int task, int (*thread_fn)(void *));
+    /* one step of a PlayerHost task, < 0 once the task is over */
+    int hostStep(int task);
+    void hostEnd(int task, int ret);
+    void stopHostTask(int task);
     void drawAudioViz();
     void drawVideo();
+    int uploadPicture(Frame *vp);
     int decodeAudioFrame();
+    int startAudioRender();
+    void stopAudioRender();
     int synchronizeAudio(int nb_samples);
+    double audioDiffThreshold();
     void updateSampleDisplay(short *samples, int samples_size);
-    int getFrame(AVFrame *frame);
-    int queuePicture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial);
+    int getFrame(AVFrame *frame, bool block = true);
+    /* without block AVERROR(EAGAIN) and src_frame left as it is while the queue is full */
+    int queuePicture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial, bool block = true);
+    int convertPicture(FrameConverter *converter, AVFrame *frame, AVFrame *converted);
     void updateVideoPts(double pts, int64_t pos, int serial);
     void checkExternalClockSpeed();
     double vp_duration(Frame *vp, Frame *nextvp);
     double computeTargetDelay(double delay);
+    void deliverToSinks(AVMediaType type, int stream_index, AVFrame *frame, AVRational tb, double pts, double duration, int serial, FrameSink::Tap tap = FrameSink::TAP_DECODED);
+    void removeFrameSinks();
+    void updateAudioGain();
+    void adaptPictureQueueSize();
+    /* the playing context's values, or what fast start probed where it has none */
+    int64_t getStartTime();
+    int64_t getBitRate();
+    int64_t getStreamStartTime(int stream_index);
+    AVRational guessFrameRate(AVStream *st);
     
     SDL_Thread *mReadThread;
+    /* a hosted player has no threads of its own for reading and decoding, the
+     * host's workers step its tasks */
+    PlayerHost *mHost;
+    std::atomic<int> mHostTasksBegun;   /* a bit for each PlayerHost::Task, workers step them at once */
+    SDL_mutex *mReadWaitMutex;
+    KeyframeIndex::Run mKeyframeRun;
+    DecodeTask mVideoTask;
+    DecodeTask mAudioTask;
     AVInputFormat *mInputFormat;
     AVDictionary* mFormatOptions;
     AVDictionary* mCodecOptions;
@@ -123,17 +292,59 @@ private:
     int64_t mSeekPosition;
     int64_t mSeekRel;
     bool mSeekByBytes;
+    KeyframeIndex mKeyframeIndex;
+    IndexCache mIndexCache;
+    SDL_Thread *mKeyframeScanThread;
+    std::atomic<int> mSeeksIndexed;
+    /* seconds the decoders discard frames up to after the last seek, NAN when it
+     * was not an accurate one; they pick it up when the packet serial changes */
+    std::atomic<double> mAccurateSeekTarget;
+    std::atomic<int64_t> mSeekFramesDiscarded;
+    opts::DecoderThreading mDecoderThreading[AVMEDIA_TYPE_NB];
     int mReadPauseReturn;
     AVFormatContext *mFormatContext;
+    /* getStats() may run on another thread while streamClose() deletes it, the
+     * mutex keeps it alive for the call; its last stats stay for after */
+    InputIO *mInputIO;
+    InputIO::Stats mInputIOStats;
+    SDL_mutex *mInputIOMutex;
+    /* fast start: a second demuxer probes the file while the first one plays
+     * with the header's parameters, the read thread publishes what it found */
+    SDL_Thread *mStreamInfoThread;
+    AVFormatContext *mProbedFormatContext;
+    std::atomic<int> mStreamInfoProbed;
+    /* mProbedFormatContext once the read thread found it matches, never changed
+     * after; the playing streams are not patched while other threads read them */
+    std::atomic<AVFormatContext*> mStreamInfo;
+    int64_t mOpenTime;
+    std::atomic<double> mTimeToOpen;
+    std::atomic<double> mTimeToFirstFrame;
     int mRealtime;
+    int mReadThreadDone;
+    
+    bool mHeadless;
+    int mHeadlessStop;
+    int64_t mHeadlessVideoFrames;
+    int64_t mHeadlessAudioSamples;
     
     Clock mAudioClock;
     Clock mVideoClock;
     Clock mExternalClock;
     
     FrameQueue mPictureQueue;
+    int mPictureQueueSize;
+    bool mAdaptivePictureQueue;
+    int64_t mPictureQueueMemoryLimit;
+    int mAdaptFrameDropsLate;
+    double mAdaptTime;
     FrameQueue mSubtitleQueue;
     FrameQueue mSampleQueue;
+    /* the decoder threads hold the mutex only to put into the sinks' queues */
+    std::vector<FrameSinkQueue*> mFrameSinks;
+    SDL_mutex *mFrameSinkMutex;
+    std::atomic<int> mNumFrameSinks;
+    std::atomic<int64_t> mSinkFramesQueued;
+    std::atomic<int64_t> mSinkFramesDropped;
     
     Decoder mAudioDecoder;
     Decoder mVideoDecoder;
@@ -152,24 +363,36 @@ private:
     int mAudioDiffAvgCount;
     
     AVStream *mAudioAVStream;
+    /* av_q2d() of the stream time base for getStats(), 0 while closed */
+    std::atomic<double> mAudioTimeBase;
     PacketQueue mAudioPacketQueue;
     int mAudioHWBufferSize;
-    unsigned int mAudioBufferSize;
     uint8_t* mAudioBuffer;
     unsigned int mAudioBuffer1Size;
     uint8_t* mAudioBuffer1;
-    int mAudioBufferIndex; /* in bytes */
-    int mAudioWriteBufferSize;
+    AudioRing mAudioRing;
+    AudioRing::Marker mAudioPlayMarker;    /* last played from, only used by the callback */
+    int64_t mAudioPlayDevicePosition;      /* where the bytes played from it end in the device stream */
+    int64_t mAudioDevicePosition;          /* bytes handed to the device, silence included */
+    AudioLatency mAudioLatency;
+    SDL_Thread *mAudioRenderThread;
+    int mAudioRenderStop;
     int mAudioVolume;
     int mMuted;
+    AudioGain mAudioGain;
     AudioParams mAudioSource;
 #if CONFIG_AVFILTER
     AudioParams mAudioFilterSource;
 #endif
     AudioParams mAudioTarget;
     SwrContext *mSwrCtx;
-    int mFrameDropsEarly;
-    int mFrameDropsLate;
+    std::atomic<int> mFrameDropsEarly;
+    std::atomic<int> mFrameDropsLate;
+    std::atomic<int> mAudioUnderruns;
+    std::atomic<int64_t> mConvertedFrames;
+    std::atomic<int> mExternalClockAdjustments;
+    std::atomic<double> mExternalClockSpeed;
+    std::atomic<double> mAVDrift;
     
     ShowMode mShowMode;
     
@@ -183,10 +406,14 @@ private:
     double mLastDisplayTime;
     SDL_Texture *mAudioVizTexture;
     SDL_Texture *mSubtitleTexture;
-    SDL_Texture *mVideoTexture;
+    SDL_Texture *mVideoTextures[VIDEO_TEXTURE_RING_SIZE];
+    int64_t mPictureSequence;
+    std::atomic<int64_t> mPicturesUploadedAhead;
+    std::atomic<int64_t> mPicturesUploadedOnDisplay;
     
     int mSubtileStream;
     AVStream *mSubtitleAVStream;
+    std::atomic<double> mSubtitleTimeBase;
     PacketQueue mSubtitlePacketQueue;
     
     double mFrameTimer;
@@ -195,6 +422,7 @@ private:
     
     int mVideoStream;
     AVStream *mVideoAVStream;
+    std::atomic<double> mVideoTimeBase;
     PacketQueue mVideoPacketQueue;
     
     double mMaxFrameDuration;      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
@@ -4,12 +4,40 @@
 #include "SDLUtil.h"
 #include "FFMPEGUtil.h"
 #include "VideoState.h"
+#include "Trace.h"
+#include "StatsEmitter.h"
+#include "SharedMemorySink.h"
+#include "PlayerHost.h"
+
+static const char *sTraceFilename = nullptr;
+static ffmpeg::StatsEmitter sStatsEmitter;
+static ffmpeg::SharedMemorySink sSharedMemorySink;
+static ffmpeg::PlayerHost sPlayerHost;
+
+void dump_trace()
+{
+    size_t len;
+    int ret;
+    
+    if (!sTraceFilename)
+        return;
+    len = strlen(sTraceFilename);
+    if (len > 4 && !strcmp(sTraceFilename + len - 4, ".bin"))
+        ret = ffmpeg::trace::DumpBinary(sTraceFilename);
+    else
+        ret = ffmpeg::trace::DumpJSON(sTraceFilename);
+    if (ret < 0)
+        ffmpeg::PrintError(sTraceFilename, ret);
+}
 
 void do_exit(ffmpeg::VideoState* vs)
 {
+    sStatsEmitter.stop();
     if (vs) {
         vs->streamClose();
     }
+    sPlayerHost.stop();
+    dump_trace();
     sdl::Shutdown();
     ffmpeg::Shutdown();
     exit(0);
@@ -23,8 +51,10 @@ void refresh_loop_wait_event(ffmpeg::VideoState *is, SDL_Event *event) {
 //            SDL_ShowCursor(0);
 //            cursor_hidden = 1;
 //        }
-        if (remaining_time > 0.0)
+        if (remaining_time > 0.0) {
+            is->uploadAhead(&remaining_time);
             av_usleep((int64_t)(remaining_time * 1000000.0));
+        }
         remaining_time = REFRESH_RATE;
         if (is->getShowMode() != ffmpeg::VideoState::SHOW_MODE_NONE && (!is->isPaused() || is->getForceRefresh()))
             is->videoRefresh(&remaining_time);
@@ -72,6 +102,9 @@ void event_loop(ffmpeg::VideoState* state){
                     case SDLK_s: // S: Step to next frame
                         state->stepToNextFrame();
                         break;
+                    case SDLK_d: // D: dump the trace collected so far
+                        dump_trace();
+                        break;
                     case SDLK_a:
                         //stream_cycle_channel(cur_stream, AVMEDIA_TYPE_AUDIO);
                         break;
@@ -216,19 +249,76 @@ void event_loop(ffmpeg::VideoState* state){
 
 int main(int argc, char **argv)
 {
+    const char *filename = nullptr;
+    const char *stats_target = nullptr;
+    const char *shm_output = nullptr;
+    bool headless = false;
+    int host_workers = -1;
+    int started;
+    
+    for (int i = 1, n; i < argc; i++) {
+        if (!strcmp(argv[i], "-headless"))
+            headless = true;
+        else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+            sTraceFilename = argv[++i];
+        else if (!strcmp(argv[i], "-stats") && i + 1 < argc)
+            stats_target = argv[++i];
+        else if (!strcmp(argv[i], "-shm_output") && i + 1 < argc)
+            shm_output = argv[++i];
+        else if (!strcmp(argv[i], "-host") && i + 1 < argc)
+            host_workers = atoi(argv[++i]);
+        else if ((n = ffmpeg::opts::Parse(argc, argv, i)))
+            i += n - 1;
+        else
+            filename = argv[i];
+    }
+    if (!filename) {
+        fprintf(stderr, "usage: %s [options] input_file\n", argv[0]);
+        return 1;
+    }
+    
     ffmpeg::StartUp();
-    sdl::Startup("test", sdl::Settings().video().timer(), sdl::Window::Settings().resizeable().hidden());
+    if (sTraceFilename)
+        ffmpeg::trace::Enable();
+    if (headless)
+        started = sdl::Startup("test", sdl::Settings().timer(), sdl::Window::Settings().hidden());
+    else
+        started = sdl::Startup("test", sdl::Settings().video().timer(), sdl::Window::Settings().resizeable().hidden());
+    if (started < 0) {
+        ffmpeg::Shutdown();
+        return 1;
+    }
         
     ffmpeg::VideoState state;
+    state.setHeadless(headless);
+    /* read and decode on a pool of workers, 0 for one per cpu, rather than threads of the player's own */
+    if (host_workers >= 0 && (sPlayerHost.start(host_workers) < 0 || sPlayerHost.add(&state, PLAYER_HOST_WEIGHT_VISIBLE) < 0)) {
+        av_log(NULL, AV_LOG_ERROR, "Could not host the player on %d workers\n", host_workers);
+        sPlayerHost.stop();
+    }
     
     //file_iformat no options ATM
-    auto ret = state.streamOpen("/Users/michaelallison/code/sixmonths/Cartier-HudsonYards-flipdot.mov", nullptr);
+    auto ret = state.streamOpen(filename, nullptr);
     if (!ret) {
         av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
         state.streamClose();
         exit(0);
     }
     
+    if (stats_target && sStatsEmitter.start(&state, stats_target) < 0)
+        av_log(NULL, AV_LOG_ERROR, "Could not start the stats emitter on %s\n", stats_target);
+    
+    /* the pictures shown, for a process on this host that maps the ring */
+    if (shm_output && (sSharedMemorySink.open(shm_output) < 0 ||
+                       state.addFrameSink(&sSharedMemorySink, AVMEDIA_TYPE_VIDEO, FRAME_SINK_QUEUE_SIZE, ffmpeg::FrameSink::TAP_DISPLAYED) < 0))
+        av_log(NULL, AV_LOG_ERROR, "Could not publish the pictures to shared memory %s\n", shm_output);
+    
+    if (headless) {
+        ffmpeg::VideoState::HeadlessReport report;
+        state.runHeadless(&report);
+        do_exit(&state);
+    }
+    
     event_loop(&state);
     
     return 0;